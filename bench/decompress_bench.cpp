@@ -0,0 +1,170 @@
+// Ingestion benchmark: tokenizing a raw file vs the same text compressed, decoded either on a
+// separate thread into double buffers (what the producer does) or serially on the tokenizing
+// thread. Every variant must produce the same words; the benchmark checks word count and an
+// order-sensitive checksum.
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include "../src/decompress.h"
+
+using namespace std;
+
+struct Result {
+    uint64_t words = 0;
+    uint64_t checksum = 1469598103934665603ull;
+    uint64_t bytes = 0; // Text tokenized
+    double seconds = 0;
+    bool ok = true;
+};
+
+inline void mix(Result& r, const char* word, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        r.checksum = (r.checksum ^ (unsigned char)word[i]) * 1099511628211ull;
+    }
+    r.checksum = (r.checksum ^ 0xff) * 1099511628211ull; // Word separator
+    r.words++;
+}
+
+void tokenize_into(Result& r, char* data, size_t size) {
+    r.bytes += size;
+    tokenize_words(data, size, [&](const char* word, size_t length) {
+        mix(r, word, length);
+        return true;
+    });
+}
+
+Result run_raw(const char* path) {
+    Result r;
+    auto start = chrono::steady_clock::now();
+    MappedFile file; // Re-mapped every run: the tokenizer rewrites words in place
+    if (!file.open(path)) {
+        perror("open input");
+        exit(1);
+    }
+    tokenize_into(r, file.data(), file.size());
+    r.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return r;
+}
+
+// Decode and tokenize overlap: the decoder thread fills one buffer while this thread tokenizes the other
+Result run_pipelined(const char* path, Compression kind) {
+    Result r;
+    auto start = chrono::steady_clock::now();
+    DecompressingReader reader;
+    if (!reader.open(path, kind)) {
+        cerr << path << ": " << reader.error() << endl;
+        exit(1);
+    }
+    char* data;
+    size_t size;
+    while ((r.ok = reader.next(data, size)) && size > 0)
+        tokenize_into(r, data, size);
+    reader.close();
+    r.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return r;
+}
+
+// Decode a chunk, then tokenize it, on one thread: what decompressing to a temporary file amounts to
+Result run_serial(const char* path, Compression kind) {
+    Result r;
+    auto start = chrono::steady_clock::now();
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        perror("open input");
+        exit(1);
+    }
+    unique_ptr<Decoder> decoder;
+#ifdef WC_HAVE_ZLIB
+    if (kind == COMPRESSION_GZIP)
+        decoder.reset(new GzipDecoder(fd));
+#endif
+#ifdef WC_HAVE_ZSTD
+    if (kind == COMPRESSION_ZSTD)
+        decoder.reset(new ZstdDecoder(fd));
+#endif
+    vector<char> buffer(DECOMPRESS_CHUNK_SIZE);
+    size_t carry = 0;
+    for (;;) {
+        ssize_t got = decoder->read(buffer.data() + carry, buffer.size() - carry);
+        if (got < 0) {
+            r.ok = false;
+            break;
+        }
+        size_t filled = carry + got;
+        size_t cut = filled;
+        if (got > 0) {
+            while (cut > 0 && !is_word_space((unsigned char)buffer[cut - 1]))
+                cut--;
+            if (cut == 0)
+                cut = filled;
+        }
+        tokenize_into(r, buffer.data(), cut);
+        memmove(buffer.data(), buffer.data() + cut, filled - cut);
+        carry = filled - cut;
+        if (got == 0)
+            break;
+    }
+    close(fd);
+    r.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return r;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        cerr << "Usage: " << argv[0] << " <raw_file> <compressed_file>... [--repetitions N]" << endl;
+        cerr << "  e.g. gzip -k corpus.txt && " << argv[0] << " corpus.txt corpus.txt.gz" << endl;
+        return 1;
+    }
+    int repetitions = 3;
+    vector<const char*> compressed;
+    for (int i = 2; i < argc; ++i) {
+        if (string(argv[i]) == "--repetitions" && i + 1 < argc)
+            repetitions = atoi(argv[++i]);
+        else
+            compressed.push_back(argv[i]);
+    }
+
+    auto best_of = [&](auto run) {
+        Result best;
+        for (int i = 0; i < repetitions; ++i) {
+            Result r = run();
+            if (i == 0 || r.seconds < best.seconds)
+                best = r;
+        }
+        return best;
+    };
+    Result raw = best_of([&] { return run_raw(argv[1]); });
+    printf("%-34s %10.1f MB/s %12llu words\n", "raw (mapped)", raw.bytes / raw.seconds / 1e6, (unsigned long long)raw.words);
+
+    bool mismatch = false;
+    for (const char* path : compressed) {
+        Compression kind = detect_compression(path);
+        if (kind == COMPRESSION_NONE || !compression_supported(kind)) {
+            cerr << path << ": not compressed, or " << compression_name(kind) << " support was not built in" << endl;
+            return 1;
+        }
+        MappedFile probe;
+        probe.open(path);
+        double ratio = probe.size() ? (double)raw.bytes / probe.size() : 0;
+        probe.close();
+        struct Variant {
+            const char* name;
+            Result result;
+        };
+        Variant variants[] = {{"serial", best_of([&] { return run_serial(path, kind); })},
+                              {"pipelined", best_of([&] { return run_pipelined(path, kind); })}};
+        for (const Variant& v : variants) {
+            bool same = v.result.ok && v.result.words == raw.words && v.result.checksum == raw.checksum;
+            mismatch = mismatch || !same;
+            string name = string(compression_name(kind)) + " " + v.name + " (x" + to_string(ratio).substr(0, 4) + ")";
+            printf("%-34s %10.1f MB/s %12llu words  %.1f%% of raw %s\n", name.c_str(), v.result.bytes / v.result.seconds / 1e6,
+                   (unsigned long long)v.result.words, 100 * raw.seconds / v.result.seconds, same ? "" : "MISMATCH");
+        }
+    }
+    return mismatch ? 1 : 0;
+}
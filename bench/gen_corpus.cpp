@@ -0,0 +1,177 @@
+// Deterministic synthetic corpus: words drawn from a Zipf-distributed vocabulary, written as
+// text lines with sentence capitals and punctuation so the tokenizer sees realistic input.
+// The same options and seed always produce byte-identical output (own PRNG, no <random>).
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <algorithm>
+#include <cmath>
+#include <cctype>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <getopt.h>
+
+using namespace std;
+
+// splitmix64: tiny, fast and identical on every platform
+struct Rng {
+    uint64_t state;
+
+    uint64_t next() {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    double uniform() { return (next() >> 11) * (1.0 / 9007199254740992.0); } // [0, 1)
+    uint64_t below(uint64_t n) { return next() % n; }
+};
+
+struct Options {
+    uint64_t size = 64ull << 20;
+    uint64_t vocab = 100000;
+    double zipf = 1.0;
+    double length_mean = 6.0;
+    double length_stddev = 3.0;
+    int min_length = 1;
+    int max_length = 20;
+    uint64_t seed = 1;
+    int words_per_line = 12;
+};
+
+void print_usage(const char* prog) {
+    cerr << "Usage: " << prog << " [--size BYTES] [--vocab N] [--zipf S] [--length-mean L] [--length-stddev D]"
+         << " [--min-length N] [--max-length N] [--words-per-line N] [--seed N] <output_file|->" << endl;
+}
+
+// Approximately normal word lengths (Irwin-Hall: sum of 12 uniforms), clamped to the allowed range
+int draw_length(Rng& rng, const Options& opt) {
+    double sum = 0;
+    for (int i = 0; i < 12; ++i)
+        sum += rng.uniform();
+    int length = (int)lround(opt.length_mean + opt.length_stddev * (sum - 6.0));
+    return max(opt.min_length, min(opt.max_length, length));
+}
+
+// Distinct lowercase words; a length whose combinations are used up is retried one letter longer
+vector<string> build_vocabulary(Rng& rng, const Options& opt) {
+    vector<string> words;
+    unordered_set<string> seen;
+    words.reserve(opt.vocab);
+    while (words.size() < opt.vocab) {
+        int length = draw_length(rng, opt);
+        for (int attempt = 0;; ++attempt) {
+            if (attempt >= 8 && length < 254)
+                length++, attempt = 0;
+            string word(length, 'a');
+            for (char& c : word)
+                c = (char)('a' + rng.below(26));
+            if (seen.insert(word).second) {
+                words.push_back(word);
+                break;
+            }
+        }
+    }
+    return words;
+}
+
+int main(int argc, char* argv[]) {
+    Options opt;
+    static const struct option long_options[] = {
+        {"size", required_argument, nullptr, 's'},
+        {"vocab", required_argument, nullptr, 'v'},
+        {"zipf", required_argument, nullptr, 'z'},
+        {"length-mean", required_argument, nullptr, 'm'},
+        {"length-stddev", required_argument, nullptr, 'd'},
+        {"min-length", required_argument, nullptr, 'n'},
+        {"max-length", required_argument, nullptr, 'x'},
+        {"words-per-line", required_argument, nullptr, 'w'},
+        {"seed", required_argument, nullptr, 'r'},
+        {nullptr, 0, nullptr, 0}
+    };
+    int c;
+    while ((c = getopt_long(argc, argv, "", long_options, nullptr)) != -1) {
+        switch (c) {
+        case 's': opt.size = strtoull(optarg, nullptr, 10); break;
+        case 'v': opt.vocab = strtoull(optarg, nullptr, 10); break;
+        case 'z': opt.zipf = atof(optarg); break;
+        case 'm': opt.length_mean = atof(optarg); break;
+        case 'd': opt.length_stddev = atof(optarg); break;
+        case 'n': opt.min_length = atoi(optarg); break;
+        case 'x': opt.max_length = atoi(optarg); break;
+        case 'w': opt.words_per_line = atoi(optarg); break;
+        case 'r': opt.seed = strtoull(optarg, nullptr, 10); break;
+        default:
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc || opt.vocab == 0 || opt.zipf < 0 || opt.min_length < 1 || opt.max_length > 254
+        || opt.min_length > opt.max_length || opt.words_per_line < 1) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    string path = argv[optind];
+    FILE* out = path == "-" ? stdout : fopen(path.c_str(), "wb");
+    if (!out) {
+        perror(("gen_corpus: cannot create " + path).c_str());
+        return 1;
+    }
+
+    Rng rng{opt.seed};
+    vector<string> vocabulary = build_vocabulary(rng, opt);
+
+    // Rank r (0-based) has weight 1 / (r + 1)^s; words are sampled by binary search on the CDF
+    vector<double> cdf(vocabulary.size());
+    double total = 0;
+    for (size_t r = 0; r < cdf.size(); ++r) {
+        total += 1.0 / pow((double)(r + 1), opt.zipf);
+        cdf[r] = total;
+    }
+
+    string line;
+    uint64_t written = 0;
+    uint64_t words = 0;
+    while (written < opt.size) {
+        line.clear();
+        for (int i = 0; i < opt.words_per_line; ++i) {
+            size_t rank = upper_bound(cdf.begin(), cdf.end(), rng.uniform() * total) - cdf.begin();
+            const string& word = vocabulary[min(rank, vocabulary.size() - 1)];
+            if (i > 0)
+                line += ' ';
+            size_t start = line.size();
+            line += word;
+            if (i == 0)
+                line[start] = (char)toupper((unsigned char)line[start]);
+            if (i == opt.words_per_line - 1)
+                line += '.';
+            else if (rng.below(16) == 0)
+                line += ',';
+            words++;
+        }
+        line += '\n';
+        size_t bytes = min<uint64_t>(line.size(), opt.size - written);
+        if (bytes < line.size()) { // Keep the last word whole rather than overshooting the requested size
+            size_t cut = line.rfind(' ', bytes);
+            bytes = cut == string::npos ? bytes : cut;
+            line.resize(bytes);
+            line += '\n';
+            bytes = line.size();
+        }
+        if (fwrite(line.data(), 1, bytes, out) != bytes) {
+            perror("gen_corpus: write failed");
+            return 1;
+        }
+        written += bytes;
+    }
+    if (out != stdout && fclose(out) != 0) {
+        perror("gen_corpus: close failed");
+        return 1;
+    }
+    cerr << "gen_corpus: " << written << " bytes, about " << words << " words over a vocabulary of " << vocabulary.size() << endl;
+    return 0;
+}
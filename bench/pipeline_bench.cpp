@@ -0,0 +1,403 @@
+// End-to-end throughput driver: runs N producers and M consumers (in --bench mode, so without the
+// simulated work and per-word logging), optionally the aggregator, and prints one JSON object with
+// words/s, bytes/s, p50/p99 producer-to-consumer block handoff latency and peak RSS per role.
+// With --baseline the single-process wordcount engine counts the same input afterwards, so every
+// result carries the number the IPC path has to beat. With --split all producers share the first
+// corpus file, each reading its own --part of it; with --work-queue they claim every corpus file
+// (large ones in slices) from the shared work queue through a manifest. With --pin every process
+// gets a CPU of its own (producers first, then consumers, wrapping around the CPUs this driver may
+// use), so pinned and unpinned runs can be compared.
+// Everything runs inside a scratch directory so output files from earlier runs cannot leak in.
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <cerrno>
+#include <filesystem>
+#include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sched.h>
+
+#include "../src/common.h"
+#include "../src/work_queue.h"
+
+using namespace std;
+
+struct Child {
+    pid_t pid;
+    string role;
+    string log;
+    long max_rss_kb = 0;
+    int status = 0;
+};
+
+void print_usage(const char* prog) {
+    cerr << "Usage: " << prog << " [--producers N] [--consumers M] [--producer-opt OPT]... [--consumer-opt OPT]..."
+         << " [--split | --work-queue] [--pin] [--aggregate] [--baseline] [--baseline-opt OPT]... [--work-dir DIR] [--json FILE] <corpus_file>..." << endl;
+}
+
+// Absolute path of a sibling binary, so children can be started after chdir into the work directory
+string sibling_binary(const char* argv0, const string& name) {
+    char resolved[PATH_MAX];
+    string self = realpath(argv0, resolved) ? resolved : argv0;
+    size_t slash = self.rfind('/');
+    return (slash == string::npos ? string(".") : self.substr(0, slash)) + "/" + name;
+}
+
+// Starts a child with stdout/stderr redirected to `log`; returns -1 on failure
+pid_t spawn(const vector<string>& args, const string& log) {
+    pid_t pid = fork();
+    if (pid != 0)
+        return pid;
+    int fd = open(log.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd != -1) {
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        close(fd);
+    }
+    vector<char*> argv;
+    for (const string& arg : args)
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    argv.push_back(nullptr);
+    execv(argv[0], argv.data());
+    perror(("pipeline_bench: exec " + args[0] + " failed").c_str());
+    _exit(127);
+}
+
+// Waits for every child, recording exit status and peak RSS
+bool reap(vector<Child>& children) {
+    bool ok = true;
+    for (Child& child : children) {
+        struct rusage usage;
+        if (wait4(child.pid, &child.status, 0, &usage) == -1) {
+            perror("pipeline_bench: wait4 failed");
+            ok = false;
+            continue;
+        }
+        child.max_rss_kb = usage.ru_maxrss;
+        if (!WIFEXITED(child.status) || WEXITSTATUS(child.status) != 0) {
+            cerr << "pipeline_bench: " << child.role << " failed, see " << child.log << endl;
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+// Removes any segment or semaphores left behind by an earlier, interrupted run. The aggregator
+// still needs the dictionary of an interned job, so that can be kept.
+void unlink_ipc(bool keep_dictionary = false) {
+    shm_unlink(SHARED_MEM_NAME);
+    shm_unlink(WORK_QUEUE_NAME);
+    if (!keep_dictionary)
+        shm_unlink(DICTIONARY_NAME);
+    JobNames job; // The driver runs the default job
+    for (uint32_t p = 0; p < MAX_PARTITIONS; ++p) {
+        sem_unlink(partition_sem_name(job, SEM_EMPTY_NAME, p).c_str());
+        sem_unlink(partition_sem_name(job, SEM_FULL_NAME, p).c_str());
+        sem_unlink(partition_sem_name(job, SEM_MUTEX_NAME, p).c_str());
+    }
+}
+
+long peak_rss(const vector<Child>& children, const string& role) {
+    long peak = 0;
+    for (const Child& child : children) {
+        if (child.role == role)
+            peak = max(peak, child.max_rss_kb);
+    }
+    return peak;
+}
+
+uint64_t percentile(const vector<uint64_t>& sorted, double p) {
+    if (sorted.empty())
+        return 0;
+    size_t index = (size_t)(p * (sorted.size() - 1) + 0.5);
+    return sorted[index];
+}
+
+string json_string(const string& s) {
+    string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\')
+            out += '\\';
+        out += c;
+    }
+    return out + "\"";
+}
+
+int main(int argc, char* argv[]) {
+    int producers = 1;
+    int consumers = 1;
+    vector<string> producer_opts, consumer_opts, baseline_opts;
+    bool aggregate = false;
+    bool baseline = false;
+    bool split = false;
+    bool work_queue = false;
+    bool pin = false;
+    string work_dir = "bench_run";
+    string json_path;
+
+    static const struct option long_options[] = {
+        {"producers", required_argument, nullptr, 'p'},
+        {"consumers", required_argument, nullptr, 'c'},
+        {"producer-opt", required_argument, nullptr, 'P'},
+        {"consumer-opt", required_argument, nullptr, 'C'},
+        {"aggregate", no_argument, nullptr, 'a'},
+        {"baseline", no_argument, nullptr, 'b'},
+        {"split", no_argument, nullptr, 's'},
+        {"work-queue", no_argument, nullptr, 'q'},
+        {"pin", no_argument, nullptr, 'n'},
+        {"baseline-opt", required_argument, nullptr, 'B'},
+        {"work-dir", required_argument, nullptr, 'w'},
+        {"json", required_argument, nullptr, 'j'},
+        {nullptr, 0, nullptr, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, nullptr)) != -1) {
+        switch (opt) {
+        case 'p': producers = atoi(optarg); break;
+        case 'c': consumers = atoi(optarg); break;
+        case 'P': producer_opts.push_back(optarg); break;
+        case 'C': consumer_opts.push_back(optarg); break;
+        case 'a': aggregate = true; break;
+        case 'b': baseline = true; break;
+        case 's': split = true; break;
+        case 'q': work_queue = true; break;
+        case 'n': pin = true; break;
+        case 'B': baseline_opts.push_back(optarg); break;
+        case 'w': work_dir = optarg; break;
+        case 'j': json_path = optarg; break;
+        default:
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc || producers < 1 || consumers < 1 || (split && work_queue)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    // Producer i reads corpus file i modulo the number of files given, or part i of the first one;
+    // through the work queue the pool reads each file once
+    vector<string> corpus;
+    uint64_t input_bytes = 0;
+    int corpus_files = split ? 1 : work_queue ? argc - optind : producers;
+    for (int i = 0; i < corpus_files; ++i) {
+        const char* file = argv[optind + i % (argc - optind)];
+        char resolved[PATH_MAX];
+        struct stat st;
+        if (!realpath(file, resolved) || stat(resolved, &st) == -1) {
+            perror(("pipeline_bench: cannot use corpus " + string(file)).c_str());
+            return 1;
+        }
+        corpus.push_back(resolved);
+        input_bytes += st.st_size;
+    }
+
+    if (!json_path.empty() && json_path[0] != '/') { // Relative to where we were started, not the work directory
+        char cwd[PATH_MAX];
+        if (getcwd(cwd, sizeof(cwd)))
+            json_path = string(cwd) + "/" + json_path;
+    }
+    string producer_bin = sibling_binary(argv[0], "producer");
+    string consumer_bin = sibling_binary(argv[0], "consumer");
+    string aggregator_bin = sibling_binary(argv[0], "aggregator");
+    string wordcount_bin = sibling_binary(argv[0], "wordcount");
+    if (mkdir(work_dir.c_str(), 0777) == -1 && errno != EEXIST) {
+        perror(("pipeline_bench: cannot create " + work_dir).c_str());
+        return 1;
+    }
+    if (chdir(work_dir.c_str()) == -1) {
+        perror(("pipeline_bench: cannot enter " + work_dir).c_str());
+        return 1;
+    }
+    for (const auto& entry : std::filesystem::directory_iterator(".")) {
+        string name = entry.path().filename().string();
+        if (name.rfind("consumer_output_", 0) == 0 || name.rfind("consumer_latency_", 0) == 0 || name == "aggregated_word_counts.txt" || name == "aggregated_word_counts.idx" || name == "wordcount_counts.txt")
+            unlink(name.c_str());
+    }
+    unlink_ipc();
+    if (work_queue) {
+        ofstream manifest("work_queue.list");
+        for (const string& file : corpus)
+            manifest << file << "\n";
+    }
+
+    // CPUs handed out by --pin, in order
+    vector<int> cpus;
+    cpu_set_t allowed;
+    if (pin && sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &allowed))
+                cpus.push_back(cpu);
+        }
+    }
+    auto cpu_for = [&](int process) { return to_string(cpus[process % cpus.size()]); };
+
+    vector<Child> children;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < producers; ++i) {
+        vector<string> args = {producer_bin, "--bench"};
+        if (!cpus.empty())
+            args.insert(args.end(), {"--cpus", cpu_for(i)});
+        args.insert(args.end(), producer_opts.begin(), producer_opts.end());
+        if (split)
+            args.push_back("--part=" + to_string(i + 1) + "/" + to_string(producers));
+        if (work_queue)
+            args.insert(args.end(), {"--manifest", "work_queue.list"});
+        else
+            args.push_back(corpus[split ? 0 : i]);
+        string log = "producer_" + to_string(i + 1) + ".log";
+        children.push_back(Child{spawn(args, log), "producer", log});
+    }
+    // Consumers expect the segment to exist; give the first producer up to 10 s to create it
+    for (int waited = 0; waited < 10000; ++waited) {
+        int fd = shm_open(SHARED_MEM_NAME, O_RDONLY, 0);
+        if (fd != -1) {
+            close(fd);
+            break;
+        }
+        usleep(1000);
+    }
+    for (int i = 0; i < consumers; ++i) {
+        string id = to_string(i + 1);
+        vector<string> args = {consumer_bin, "--bench", "--latency-file", "consumer_latency_" + id + ".bin"};
+        if (!cpus.empty())
+            args.insert(args.end(), {"--cpus", cpu_for(producers + i)});
+        args.insert(args.end(), consumer_opts.begin(), consumer_opts.end());
+        args.push_back(to_string(producers));
+        args.push_back(id);
+        string log = "consumer_" + id + ".log";
+        children.push_back(Child{spawn(args, log), "consumer", log});
+    }
+    for (const Child& child : children) {
+        if (child.pid == -1) {
+            perror("pipeline_bench: fork failed");
+            return 1;
+        }
+    }
+    bool ok = reap(children);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    unlink_ipc(true);
+
+    double aggregate_seconds = 0;
+    if (ok && aggregate) {
+        auto aggregate_start = chrono::steady_clock::now();
+        vector<Child> aggregator = {Child{spawn({aggregator_bin}, "aggregator.log"), "aggregator", "aggregator.log"}};
+        ok = reap(aggregator);
+        aggregate_seconds = chrono::duration<double>(chrono::steady_clock::now() - aggregate_start).count();
+        children.push_back(aggregator[0]);
+    }
+    shm_unlink(DICTIONARY_NAME);
+
+    // The same input (repeats included) through the single-process engine
+    double baseline_seconds = 0;
+    uint64_t baseline_words = 0;
+    bool baseline_matches = false;
+    if (ok && baseline) {
+        vector<string> args = {wordcount_bin, "--output", "wordcount_counts.txt"};
+        args.insert(args.end(), baseline_opts.begin(), baseline_opts.end());
+        args.insert(args.end(), corpus.begin(), corpus.end());
+        auto baseline_start = chrono::steady_clock::now();
+        vector<Child> engine = {Child{spawn(args, "wordcount.log"), "wordcount", "wordcount.log"}};
+        ok = reap(engine);
+        baseline_seconds = chrono::duration<double>(chrono::steady_clock::now() - baseline_start).count();
+        children.push_back(engine[0]);
+
+        ifstream counts("wordcount_counts.txt");
+        for (string line; getline(counts, line);) {
+            if (line.rfind("Total Words Processed", 0) == 0) {
+                baseline_words = strtoull(line.c_str() + line.find(':') + 1, nullptr, 10);
+                break;
+            }
+        }
+        if (aggregate) { // Both paths must write the same report
+            ifstream a("aggregated_word_counts.txt"), b("wordcount_counts.txt");
+            ostringstream x, y;
+            x << a.rdbuf();
+            y << b.rdbuf();
+            baseline_matches = x.str() == y.str();
+            if (!baseline_matches) {
+                cerr << "pipeline_bench: wordcount_counts.txt and aggregated_word_counts.txt differ" << endl;
+                ok = false;
+            }
+        }
+    }
+
+    // Words as counted by the consumers, and every consumer's handoff latency samples
+    uint64_t words = 0;
+    vector<uint64_t> latencies;
+    for (int i = 0; i < consumers; ++i) {
+        string id = to_string(i + 1);
+        ifstream log("consumer_" + id + ".log");
+        string line;
+        while (getline(log, line)) {
+            size_t at = line.find("Bench words=");
+            if (at != string::npos)
+                words += strtoull(line.c_str() + at + strlen("Bench words="), nullptr, 10);
+        }
+        ifstream samples("consumer_latency_" + id + ".bin", ios::binary);
+        uint64_t sample;
+        while (samples.read(reinterpret_cast<char*>(&sample), sizeof(sample)))
+            latencies.push_back(sample);
+    }
+    sort(latencies.begin(), latencies.end());
+
+    ostringstream json;
+    json << "{\"producers\": " << producers << ", \"consumers\": " << consumers << ", \"split\": " << (split ? "true" : "false")
+         << ", \"work_queue\": " << (work_queue ? "true" : "false") << ", \"pinned\": " << (cpus.empty() ? "false" : "true")
+         << ", \"producer_options\": [";
+    for (size_t i = 0; i < producer_opts.size(); ++i)
+        json << (i ? ", " : "") << json_string(producer_opts[i]);
+    json << "], \"consumer_options\": [";
+    for (size_t i = 0; i < consumer_opts.size(); ++i)
+        json << (i ? ", " : "") << json_string(consumer_opts[i]);
+    json << "], \"ok\": " << (ok ? "true" : "false")
+         << ", \"input_bytes\": " << input_bytes << ", \"words\": " << words << ", \"seconds\": " << seconds
+         << ", \"words_per_sec\": " << (uint64_t)(words / seconds) << ", \"bytes_per_sec\": " << (uint64_t)(input_bytes / seconds)
+         << ", \"handoff_latency_ns\": {\"samples\": " << latencies.size() << ", \"p50\": " << percentile(latencies, 0.50)
+         << ", \"p99\": " << percentile(latencies, 0.99) << "}"
+         << ", \"peak_rss_kb\": {\"producer\": " << peak_rss(children, "producer") << ", \"consumer\": " << peak_rss(children, "consumer");
+    if (aggregate)
+        json << ", \"aggregator\": " << peak_rss(children, "aggregator");
+    json << "}";
+    if (baseline)
+        json << ", \"wordcount\": " << peak_rss(children, "wordcount");
+    json << "}";
+    if (aggregate)
+        json << ", \"aggregate_seconds\": " << aggregate_seconds;
+    if (baseline) {
+        json << ", \"baseline\": {\"options\": [";
+        for (size_t i = 0; i < baseline_opts.size(); ++i)
+            json << (i ? ", " : "") << json_string(baseline_opts[i]);
+        json << "], \"words\": " << baseline_words << ", \"seconds\": " << baseline_seconds
+             << ", \"words_per_sec\": " << (uint64_t)(baseline_seconds > 0 ? baseline_words / baseline_seconds : 0)
+             << ", \"bytes_per_sec\": " << (uint64_t)(baseline_seconds > 0 ? input_bytes / baseline_seconds : 0)
+             << ", \"pipeline_slowdown\": " << (baseline_seconds > 0 ? (seconds + aggregate_seconds) / baseline_seconds : 0);
+        if (aggregate)
+            json << ", \"output_matches\": " << (baseline_matches ? "true" : "false");
+        json << "}";
+    }
+    json << "}";
+
+    cout << json.str() << endl;
+    if (!json_path.empty()) {
+        ofstream out(json_path);
+        out << json.str() << "\n";
+        if (!out) {
+            perror(("pipeline_bench: cannot write " + json_path).c_str());
+            return 1;
+        }
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,147 @@
+// Micro-benchmark: original ifstream >> + cleanWord tokenizer vs the mmap/SIMD tokenizer.
+// Both paths must produce the same words; the benchmark checks word count and an order-sensitive checksum.
+// Then the normalization policies are timed against each other on the same input (run it on a
+// non-English corpus to see what UTF-8 validation and folding cost).
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+
+#include "../src/tokenizer.h"
+
+using namespace std;
+
+struct Result {
+    uint64_t words = 0;
+    uint64_t checksum = 1469598103934665603ull;
+    double seconds = 0;
+};
+
+inline void mix(Result& r, const char* word, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        r.checksum = (r.checksum ^ (unsigned char)word[i]) * 1099511628211ull;
+    }
+    r.checksum = (r.checksum ^ 0xff) * 1099511628211ull; // Word separator
+    r.words++;
+}
+
+// The producer's original per-word path
+string cleanWord(const string& rawWord) {
+    string cleaned;
+    for (char c : rawWord) {
+        if (isalnum(static_cast<unsigned char>(c))) {
+            cleaned += tolower(static_cast<unsigned char>(c));
+        }
+    }
+    return cleaned;
+}
+
+Result run_clean_word(const char* path) {
+    Result r;
+    auto start = chrono::steady_clock::now();
+    ifstream input(path);
+    string rawWord;
+    while (input >> rawWord) {
+        string cleaned = cleanWord(rawWord);
+        if (!cleaned.empty())
+            mix(r, cleaned.data(), cleaned.size());
+    }
+    r.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return r;
+}
+
+Result run_mapped(const char* path, ClassifyFoldFn classify) {
+    Result r;
+    auto start = chrono::steady_clock::now();
+    MappedFile file; // Re-mapped every run: the tokenizer rewrites words in place
+    if (!file.open(path)) {
+        perror("open input");
+        exit(1);
+    }
+    tokenize_words(file.data(), file.size(), [&](const char* word, size_t length) {
+        mix(r, word, length);
+        return true;
+    }, classify);
+    r.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return r;
+}
+
+Result run_policy(const char* path, Normalization normalization) {
+    Result r;
+    auto start = chrono::steady_clock::now();
+    MappedFile file;
+    if (!file.open(path)) {
+        perror("open input");
+        exit(1);
+    }
+    tokenize_normalized(normalization, file.data(), file.size(), [&](const char* word, size_t length) {
+        mix(r, word, length);
+        return true;
+    });
+    r.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return r;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        cerr << "Usage: " << argv[0] << " <input_file> [repetitions]" << endl;
+        return 1;
+    }
+    const char* path = argv[1];
+    int repetitions = argc > 2 ? atoi(argv[2]) : 3;
+
+    MappedFile probe;
+    if (!probe.open(path)) {
+        perror("open input");
+        return 1;
+    }
+    double megabytes = probe.size() / (1024.0 * 1024.0);
+    probe.close();
+
+    struct Variant {
+        const char* name;
+        ClassifyFoldFn classify; // nullptr selects the cleanWord baseline
+    };
+    vector<Variant> variants = {{"cleanWord", nullptr}, {"scalar", classify_fold_scalar}};
+#ifdef TOKENIZER_X86
+    variants.push_back({"sse2", classify_fold_sse2});
+    if (__builtin_cpu_supports("avx2"))
+        variants.push_back({"avx2", classify_fold_avx2});
+#endif
+
+    Result baseline;
+    bool mismatch = false;
+    for (const Variant& v : variants) {
+        Result best;
+        for (int i = 0; i < repetitions; ++i) {
+            Result r = v.classify ? run_mapped(path, v.classify) : run_clean_word(path);
+            if (i == 0 || r.seconds < best.seconds)
+                best = r;
+        }
+        if (!v.classify)
+            baseline = best;
+        bool same = best.words == baseline.words && best.checksum == baseline.checksum;
+        mismatch = mismatch || !same;
+        printf("%-12s %10.1f MB/s %12llu words %s\n", v.name, megabytes / best.seconds,
+               (unsigned long long)best.words, same ? "" : "MISMATCH");
+    }
+
+    // Policies keep different bytes, so only the default one has to match the baseline
+    for (Normalization normalization : {NORMALIZE_ASCII, NORMALIZE_ASCII_PUNCT, NORMALIZE_UTF8}) {
+        Result best;
+        for (int i = 0; i < repetitions; ++i) {
+            Result r = run_policy(path, normalization);
+            if (i == 0 || r.seconds < best.seconds)
+                best = r;
+        }
+        bool same = normalization != NORMALIZE_ASCII || (best.words == baseline.words && best.checksum == baseline.checksum);
+        mismatch = mismatch || !same;
+        printf("%-12s %10.1f MB/s %12llu words %s\n", normalization_name(normalization), megabytes / best.seconds,
+               (unsigned long long)best.words, same ? "" : "MISMATCH");
+    }
+    return mismatch ? 1 : 0;
+}
@@ -0,0 +1,70 @@
+// Micro-benchmark: the consumer's original unordered_map<string, int> counting vs WordCountTable.
+// The input is tokenized once up front so only the counting is timed.
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+
+#include "../src/tokenizer.h"
+#include "../src/word_table.h"
+
+using namespace std;
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        cerr << "Usage: " << argv[0] << " <input_file> [repetitions]" << endl;
+        return 1;
+    }
+    int repetitions = argc > 2 ? atoi(argv[2]) : 3;
+
+    MappedFile file;
+    if (!file.open(argv[1])) {
+        perror("open input");
+        return 1;
+    }
+    vector<string_view> words;
+    tokenize_words(file.data(), file.size(), [&](const char* word, size_t length) {
+        words.emplace_back(word, length);
+        return true;
+    });
+
+    double best_map = 0, best_table = 0;
+    size_t map_unique = 0, table_unique = 0;
+    uint64_t map_total = 0, table_total = 0;
+    for (int i = 0; i < repetitions; ++i) {
+        auto start = chrono::steady_clock::now();
+        unordered_map<string, int> counts;
+        for (string_view w : words) {
+            counts[string(w)]++;
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if (i == 0 || seconds < best_map)
+            best_map = seconds;
+        map_unique = counts.size();
+        map_total = 0;
+        for (const auto& [word, count] : counts)
+            map_total += count;
+
+        start = chrono::steady_clock::now();
+        WordCountTable table;
+        for (string_view w : words) {
+            table.add(w.data(), w.size());
+        }
+        seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if (i == 0 || seconds < best_table)
+            best_table = seconds;
+        table_unique = table.size();
+        table_total = 0;
+        table.for_each([&](const WordCountTable::Entry& e) { table_total += e.count; });
+    }
+
+    bool same = map_unique == table_unique && map_total == table_total;
+    printf("%zu words, %zu distinct\n", words.size(), table_unique);
+    printf("%-14s %8.1f Mwords/s\n", "unordered_map", words.size() / best_map / 1e6);
+    printf("%-14s %8.1f Mwords/s %s\n", "WordCountTable", words.size() / best_table / 1e6, same ? "" : "MISMATCH");
+    return same ? 0 : 1;
+}
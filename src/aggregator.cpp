@@ -1,31 +1,793 @@
 #include <iostream>
 #include <fstream>
 #include <string>
-#include <unordered_map>
 #include <vector>
-#include <algorithm> 
-#include <filesystem> 
+#include <queue>
+#include <algorithm>
+#include <filesystem>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <atomic>
+#include <mutex>
+#include <thread>
 
-namespace fs = std::filesystem; 
+#include <memory>
+#include <map>
+#include <unistd.h>
 
-bool cmp(const std::pair<std::string, int>& a, const std::pair<std::string, int>& b) {
-    return a.second > b.second; 
+#include "tokenizer.h"
+#include "word_table.h"
+#include "count_run.h"
+#include "word_report.h"
+#include "sketch.h"
+#include "dictionary.h"
+#include "count_index.h"
+#include "job.h"
+
+namespace fs = std::filesystem;
+
+std::mutex log_mutex; // Worker threads share std::cout/std::cerr
+
+void report_bad_line(const char* problem, const std::string& filename, const char* line, size_t length) {
+    std::lock_guard<std::mutex> lock(log_mutex);
+    std::cerr << problem << filename << ": " << std::string_view(line, length) << std::endl;
 }
 
-int main() {
-    std::cout << "Starting word count aggregation..." << std::endl;
+// Splits a "word\tcount" line; returns false (after reporting) for malformed lines.
+// `word` points into the line.
+bool parse_count_line(const char* line, size_t length, const std::string& filename, std::string_view& word, uint64_t& count) {
+    const char* tab = static_cast<const char*>(memchr(line, '\t', length));
+    if (!tab) {
+        report_bad_line("Warning: Skipping malformed line in ", filename, line, length);
+        return false;
+    }
+    word = std::string_view(line, tab - line);
+    const char* end = line + length;
+    if (tab + 1 == end) {
+        report_bad_line("Error: Invalid number format in line from ", filename, line, length);
+        return false;
+    }
+    count = 0;
+    for (const char* p = tab + 1; p < end; ++p) {
+        unsigned digit = (unsigned char)*p - '0';
+        if (digit > 9) {
+            report_bad_line("Error: Invalid number format in line from ", filename, line, length);
+            return false;
+        }
+        if (count > (UINT64_MAX - digit) / 10) {
+            report_bad_line("Error: Number out of range in line from ", filename, line, length);
+            return false;
+        }
+        count = count * 10 + digit;
+    }
+    return true;
+}
+
+// Streams the records of one mapped consumer output file
+struct CountFileCursor {
+    std::string filename;
+    MappedFile file;
+    size_t offset = 0;
+    std::string_view word;
+    uint64_t count = 0;
+    bool has_partition = false; // From the file's partition_line(), if it starts with one
+    uint32_t partition = 0;
+    uint32_t partition_count = 0;
+
+    bool open(const fs::path& path) {
+        filename = path.filename().string();
+        if (!file.open(path.c_str())) {
+            std::lock_guard<std::mutex> lock(log_mutex);
+            std::cerr << "Error: Could not open file " << filename << std::endl;
+            return false;
+        }
+        const char* newline = static_cast<const char*>(memchr(file.data(), '\n', file.size()));
+        size_t length = newline ? (size_t)(newline - file.data()) : file.size();
+        has_partition = parse_partition_line(std::string_view(file.data(), length), partition, partition_count);
+        if (has_partition)
+            offset = length + 1;
+        return true;
+    }
+
+    bool next() {
+        const char* data = file.data();
+        size_t size = file.size();
+        while (offset < size) {
+            const char* line = data + offset;
+            const char* newline = static_cast<const char*>(memchr(line, '\n', size - offset));
+            size_t length = newline ? (size_t)(newline - line) : size - offset;
+            offset += length + 1;
+            if (length == 0)
+                continue;
+            if (parse_count_line(line, length, filename, word, count))
+                return true;
+        }
+        return false;
+    }
+};
+
+// Hash mode. Worker threads claim whole files and parse them straight from their mappings into
+// their own shards of `counts`, so no two threads ever touch the same table.
+void count_files(const std::vector<fs::path>& files, ShardedWordCounts& counts) {
+    std::atomic<size_t> next_file(0);
+    auto parse_files = [&](unsigned worker) {
+        size_t i;
+        while ((i = next_file.fetch_add(1)) < files.size()) {
+            CountFileCursor cursor;
+            if (!cursor.open(files[i]))
+                continue;
+            {
+                std::lock_guard<std::mutex> lock(log_mutex);
+                std::cout << "  Reading: " << cursor.filename << std::endl;
+            }
+            while (cursor.next())
+                counts.add(worker, cursor.word.data(), cursor.word.size(), cursor.count);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned w = 1; w < counts.workers(); ++w)
+        pool.emplace_back(parse_files, w);
+    parse_files(0);
+    for (std::thread& thread : pool)
+        thread.join();
+}
+
+// Interned jobs: the consumers counted word IDs into dense arrays (consumer_output_<id>.ids).
+// The arrays are summed element-wise, then every ID with a count is looked up in the job's
+// dictionary and added to `counts` as its word. Returns false (after reporting) on error.
+bool count_id_files(const std::vector<fs::path>& files, const std::string& dictionary_name, ShardedWordCounts& counts) {
+    size_t mapped_size = 0;
+    std::string error;
+    WordDictionary* dictionary = map_dictionary(dictionary_name, false, mapped_size, error);
+    if (dictionary == MAP_FAILED) {
+        std::cerr << "Error: Consumers counted word IDs, but the dictionary is gone: " << error << std::endl;
+        return false;
+    }
+    std::vector<uint64_t> totals;
+    bool ok = true;
+    for (const fs::path& path : files) {
+        std::cout << "  Summing: " << path.filename().string() << std::endl;
+        if (!add_id_counts(path.string(), dictionary->nonce, totals, error)) {
+            std::cerr << "Error: " << path.filename().string() << ": " << error << std::endl;
+            ok = false;
+        }
+    }
+    for (uint32_t id = 0; ok && id < totals.size(); ++id) {
+        const char* word;
+        uint8_t length;
+        if (totals[id] == 0)
+            continue;
+        if (!dictionary->word(id, word, length)) {
+            std::cerr << "Error: Word ID " << id << " has a count but no word in the dictionary" << std::endl;
+            ok = false;
+            break;
+        }
+        counts.add(0, word, length, totals[id]);
+    }
+    munmap(dictionary, mapped_size);
+    return ok;
+}
+
+// Whether the consumer outputs are the disjoint partitions --partitioned needs: each names its
+// partition, all of the same job, and no partition appears twice (a single-partition job, or two
+// consumers on one ring, split a partition's words over several files). Reports why not.
+bool disjoint_partitions(const std::vector<fs::path>& files) {
+    std::map<uint32_t, std::string> owners;
+    uint32_t partition_count = 0;
+    for (const fs::path& path : files) {
+        CountFileCursor cursor;
+        if (!cursor.open(path))
+            continue;
+        if (!cursor.has_partition) {
+            std::cout << "  " << cursor.filename << " does not say which partition it holds." << std::endl;
+            return false;
+        }
+        if (partition_count && cursor.partition_count != partition_count) {
+            std::cout << "  " << cursor.filename << " comes from a job with " << cursor.partition_count << " partitions, not " << partition_count << "." << std::endl;
+            return false;
+        }
+        partition_count = cursor.partition_count;
+        auto owner = owners.emplace(cursor.partition, cursor.filename);
+        if (!owner.second) {
+            std::cout << "  " << cursor.filename << " and " << owner.first->second << " both hold partition " << cursor.partition << "." << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Partitioned mode: every consumer drained its own hash partition, so no word appears in two files
+// and each file is already sorted by count. A k-way merge produces the final order without re-hashing;
+// with `top_k` only the first K merged lines are kept, though every record is still counted and
+// indexed. The totals are only known at the end, so the lines are streamed to `body` rather than held.
+bool merge_partitions(const std::vector<fs::path>& files, size_t top_k, std::ostream& body, CountIndexWriter& index,
+                      size_t& unique_words, uint64_t& total_words) {
+    std::vector<CountFileCursor> cursors(files.size());
+    auto later = [&](size_t a, size_t b) {
+        const CountFileCursor& x = cursors[a];
+        const CountFileCursor& y = cursors[b];
+        return count_order({y.word.data(), (uint32_t)y.word.size(), y.count}, {x.word.data(), (uint32_t)x.word.size(), x.count});
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(later)> heap(later);
+
+    for (size_t i = 0; i < files.size(); ++i) {
+        if (!cursors[i].open(files[i]))
+            continue;
+        std::cout << "  Merging: " << cursors[i].filename << std::endl;
+        if (cursors[i].next())
+            heap.push(i);
+    }
+
+    while (!heap.empty()) {
+        size_t i = heap.top();
+        heap.pop();
+        bool reported = top_k == 0 || unique_words < top_k;
+        if (reported)
+            body << cursors[i].word << ": " << cursors[i].count << "\n";
+        if (!index.add(cursors[i].word, cursors[i].count, reported))
+            return false;
+        unique_words++;
+        total_words += cursors[i].count;
+        if (cursors[i].next())
+            heap.push(i);
+    }
+    return true;
+}
+
+const size_t DEFAULT_MERGE_MEMORY = 256 << 20; // --runs budget for read buffers plus the in-memory report buffer
+const size_t RUN_READ_BUFFER = 256 << 10;       // Per open run
+const size_t MAX_FAN_IN = 1024;
+
+// k-way heap merge over count runs that share one order. In word order equal words from
+// different runs are summed into one record; count-ordered runs are expected to be disjoint.
+class RunMerger {
+public:
+    explicit RunMerger(uint32_t order) : order_(order), heap_(Later{this}) {}
+
+    // Returns false (after reporting) if a run cannot be opened or has the wrong order
+    bool open(const std::vector<std::string>& paths) {
+        for (const std::string& path : paths) {
+            sources_.push_back(Source{std::make_unique<CountRunReader>(RUN_READ_BUFFER), path, nullptr, 0, 0});
+            Source& source = sources_.back();
+            if (!source.reader->open(path.c_str())) {
+                std::cerr << "Error: Could not read run " << path << ": " << source.reader->error() << std::endl;
+                return false;
+            }
+            if (source.reader->order() != order_) {
+                std::cerr << "Error: Run " << path << " is not sorted the way this merge needs" << std::endl;
+                return false;
+            }
+        }
+        for (size_t i = 0; i < sources_.size(); ++i) {
+            if (!advance(i))
+                return false;
+        }
+        return true;
+    }
+
+    // Returns false at the end of the merge or on error (check failed())
+    bool next(std::string& word, uint64_t& count) {
+        if (heap_.empty() || failed_)
+            return false;
+        size_t i = heap_.top();
+        heap_.pop();
+        word.assign(sources_[i].word, sources_[i].length);
+        count = sources_[i].count;
+        if (!advance(i))
+            return false;
+        while (order_ == RUN_ORDER_WORD && !heap_.empty() && sources_[heap_.top()].view() == word) {
+            i = heap_.top();
+            heap_.pop();
+            count += sources_[i].count;
+            if (!advance(i))
+                return false;
+        }
+        return true;
+    }
+
+    bool failed() const { return failed_; }
+
+private:
+    struct Source {
+        std::unique_ptr<CountRunReader> reader;
+        std::string path;
+        const char* word;
+        uint8_t length;
+        uint64_t count;
+
+        std::string_view view() const { return std::string_view(word, length); }
+    };
+
+    struct Later {
+        const RunMerger* merger;
+        bool operator()(size_t a, size_t b) const {
+            const Source& x = merger->sources_[a];
+            const Source& y = merger->sources_[b];
+            if (merger->order_ == RUN_ORDER_WORD)
+                return x.view() > y.view();
+            return count_order({y.word, y.length, y.count}, {x.word, x.length, x.count});
+        }
+    };
+
+    // Pulls the next record of source i back into the heap; false only on a read error
+    bool advance(size_t i) {
+        Source& source = sources_[i];
+        if (source.reader->next(source.word, source.length, source.count)) {
+            heap_.push(i);
+            return true;
+        }
+        if (source.reader->failed()) {
+            std::cerr << "Error: Corrupt run " << source.path << ": " << source.reader->error() << std::endl;
+            failed_ = true;
+            return false;
+        }
+        return true;
+    }
+
+    uint32_t order_;
+    std::vector<Source> sources_;
+    std::priority_queue<size_t, std::vector<size_t>, Later> heap_;
+    bool failed_ = false;
+};
+
+// --runs mode: bounded-memory aggregation of word-sorted binary runs.
+// collect() merges the consumer runs by word, spilling intermediate runs whenever there are more
+// runs than the memory budget can keep open at once, and gathers the report records: the K best
+// in a heap with --top, otherwise in a buffer that is sorted into count-ordered spill runs each
+// time it outgrows its half of the budget; every merged word is also added to the index.
+// write_body() then streams the report in count order, ranking each line in the index.
+class RunAggregation {
+public:
+    RunAggregation(size_t memory_budget, size_t fan_in, size_t top_k, unsigned threads, std::string spill_dir)
+        : buffer_budget_(memory_budget / 2), top_k_(top_k), threads_(threads), spill_dir_(std::move(spill_dir)) {
+        fan_in_ = fan_in ? fan_in : memory_budget / 2 / RUN_READ_BUFFER;
+        fan_in_ = std::max<size_t>(2, std::min(fan_in_, MAX_FAN_IN));
+    }
+
+    ~RunAggregation() {
+        for (const std::string& spill : spills_)
+            unlink(spill.c_str());
+    }
 
-    std::unordered_map<std::string, int> all_word_counts;
-    int total_words_processed_across_consumers = 0;
+    // With `merged`, every merged record is also written there (the --deltas running total)
+    bool collect(const std::vector<fs::path>& files, CountIndexWriter& index, size_t& unique_words, uint64_t& total_words,
+                 CountRunWriter* merged = nullptr) {
+        std::vector<std::string> runs;
+        for (const fs::path& path : files)
+            runs.push_back(path.string());
+        if (!reduce_fan_in(runs, RUN_ORDER_WORD))
+            return false;
 
-    // Directory to scan for consumer output files (current directory)
-    std::string output_dir = ".";
+        RunMerger merger(RUN_ORDER_WORD);
+        if (!merger.open(runs))
+            return false;
+        std::string word;
+        uint64_t count;
+        while (merger.next(word, count)) {
+            unique_words++;
+            total_words += count;
+            if (merged && !merged->add(word.data(), (uint8_t)word.size(), count)) {
+                perror("Aggregator: Could not write the running total");
+                return false;
+            }
+            if (!index.add(word, count)) {
+                std::cerr << "Error: Could not write the index: " << index.error() << std::endl;
+                return false;
+            }
+            if (top_k_)
+                keep_top(word, count);
+            else if (!buffer(word, count))
+                return false;
+        }
+        return !merger.failed();
+    }
+
+    bool write_body(std::ostream& body, CountIndexWriter& index) {
+        auto line = [&](std::string_view word, uint64_t count) {
+            body << word << ": " << count << "\n";
+            if (index.rank(word))
+                return true;
+            std::cerr << "Error: Could not write the index: " << index.error() << std::endl;
+            return false;
+        };
+        if (top_k_) {
+            std::sort(top_.begin(), top_.end(), [](const TopEntry& a, const TopEntry& b) { return count_order(a.entry(), b.entry()); });
+            for (const TopEntry& top : top_) {
+                if (!line(top.word, top.count))
+                    return false;
+            }
+            return true;
+        }
+        if (count_runs_.empty()) {
+            parallel_sort(buffered_, threads_);
+            for (const WordCountTable::Entry& entry : buffered_) {
+                if (!line(entry.word(), entry.count))
+                    return false;
+            }
+            return true;
+        }
+        if (!buffered_.empty() && !spill_buffer())
+            return false;
+        if (!reduce_fan_in(count_runs_, RUN_ORDER_COUNT))
+            return false;
+        RunMerger merger(RUN_ORDER_COUNT);
+        if (!merger.open(count_runs_))
+            return false;
+        std::string word;
+        uint64_t count;
+        while (merger.next(word, count)) {
+            if (!line(word, count))
+                return false;
+        }
+        return !merger.failed();
+    }
+
+private:
+    struct TopEntry {
+        std::string word;
+        uint64_t count;
+
+        WordCountTable::Entry entry() const { return {word.data(), (uint32_t)word.size(), count}; }
+    };
+
+    std::string spill_path() {
+        return spill_dir_ + "/aggregator_spill_" + std::to_string(getpid()) + "_" + std::to_string(spills_.size()) + ".run";
+    }
+
+    // Merges runs fan_in at a time into spill runs until one merge can take them all
+    bool reduce_fan_in(std::vector<std::string>& runs, uint32_t order) {
+        while (runs.size() > fan_in_) {
+            std::vector<std::string> next_level;
+            for (size_t first = 0; first < runs.size(); first += fan_in_) {
+                std::vector<std::string> group(runs.begin() + first, runs.begin() + std::min(first + fan_in_, runs.size()));
+                if (group.size() == 1) {
+                    next_level.push_back(group[0]);
+                    continue;
+                }
+                std::string spill = spill_path();
+                spills_.push_back(spill);
+                std::cout << "  Spilling " << group.size() << " runs to " << spill << std::endl;
+                RunMerger merger(order);
+                CountRunWriter writer;
+                if (!merger.open(group))
+                    return false;
+                if (!writer.open(spill.c_str(), order)) {
+                    perror(("Aggregator: Could not create spill run " + spill).c_str());
+                    return false;
+                }
+                std::string word;
+                uint64_t count;
+                while (merger.next(word, count)) {
+                    if (!writer.add(word.data(), (uint8_t)word.size(), count)) {
+                        perror(("Aggregator: Could not write spill run " + spill).c_str());
+                        return false;
+                    }
+                }
+                if (merger.failed())
+                    return false;
+                if (!writer.finish()) {
+                    perror(("Aggregator: Could not write spill run " + spill).c_str());
+                    return false;
+                }
+                next_level.push_back(spill);
+            }
+            runs.swap(next_level);
+        }
+        return true;
+    }
+
+    // Min-heap of the K best records seen so far; its top is the one to evict next
+    void keep_top(const std::string& word, uint64_t count) {
+        auto worse_last = [](const TopEntry& a, const TopEntry& b) { return count_order(a.entry(), b.entry()); };
+        TopEntry candidate{word, count};
+        if (top_.size() < top_k_) {
+            top_.push_back(std::move(candidate));
+            std::push_heap(top_.begin(), top_.end(), worse_last);
+        } else if (count_order(candidate.entry(), top_.front().entry())) {
+            std::pop_heap(top_.begin(), top_.end(), worse_last);
+            top_.back() = std::move(candidate);
+            std::push_heap(top_.begin(), top_.end(), worse_last);
+        }
+    }
+
+    bool buffer(const std::string& word, uint64_t count) {
+        char* key = arena_.allocate(word.size() ? word.size() : 1);
+        memcpy(key, word.data(), word.size());
+        buffered_.push_back({key, (uint32_t)word.size(), count});
+        buffered_bytes_ += sizeof(WordCountTable::Entry) + word.size();
+        if (buffered_bytes_ >= buffer_budget_)
+            return spill_buffer();
+        return true;
+    }
+
+    // Sorts the buffered records into a count-ordered spill run and empties the buffer
+    bool spill_buffer() {
+        parallel_sort(buffered_, threads_);
+        std::string spill = spill_path();
+        spills_.push_back(spill);
+        std::cout << "  Spilling " << buffered_.size() << " sorted counts to " << spill << std::endl;
+        CountRunWriter writer;
+        bool ok = writer.open(spill.c_str(), RUN_ORDER_COUNT);
+        for (size_t i = 0; ok && i < buffered_.size(); ++i)
+            ok = writer.add(buffered_[i].key, (uint8_t)buffered_[i].length, buffered_[i].count);
+        if (!ok || !writer.finish()) {
+            perror(("Aggregator: Could not write spill run " + spill).c_str());
+            return false;
+        }
+        count_runs_.push_back(spill);
+        buffered_.clear();
+        buffered_bytes_ = 0;
+        arena_ = ByteArena();
+        return true;
+    }
+
+    size_t buffer_budget_;
+    size_t fan_in_;
+    size_t top_k_;
+    unsigned threads_;
+    std::string spill_dir_;
+    std::vector<std::string> spills_;     // Every spill file created, removed on destruction
+    std::vector<std::string> count_runs_; // Count-ordered spills of the report buffer
+    std::vector<TopEntry> top_;
+    ByteArena arena_;
+    std::vector<WordCountTable::Entry> buffered_;
+    size_t buffered_bytes_ = 0;
+};
+
+// --approx mode: merges the consumers' sketches (consumer --approx) and writes estimated counts
+// for the heaviest words, each with the most it can overstate the true count, plus a HyperLogLog
+// estimate of the number of distinct words. Returns the process exit code.
+int aggregate_sketches(const std::vector<fs::path>& files, size_t top_k, const std::string& output_filename) {
+    std::vector<WordSketch> sketches;
+    uint64_t total_words = 0;
+    size_t keep = top_k;
+    for (const fs::path& path : files) {
+        std::cout << "  Merging: " << path.filename().string() << std::endl;
+        WordSketch sketch;
+        std::string error;
+        if (!load_sketch(path.string(), sketch, error)) {
+            std::cerr << "Error: Cannot read sketch " << path.string() << ": " << error << std::endl;
+            return 1;
+        }
+        if (!sketches.empty() && sketch.distinct.precision() != sketches[0].distinct.precision()) {
+            std::cerr << "Error: " << path.string() << " uses a different --hll-precision than " << files[0].string() << std::endl;
+            return 1;
+        }
+        total_words += sketch.top.total();
+        if (!top_k)
+            keep = std::max<size_t>(keep, sketch.top.capacity());
+        sketches.push_back(std::move(sketch));
+    }
+    if (sketches.empty()) {
+        std::cout << "No sketches found from consumers. Please ensure consumers ran with --approx." << std::endl;
+        return 0;
+    }
+
+    HyperLogLog distinct(sketches[0].distinct.precision());
+    uint64_t max_error = 0;
+    for (const WordSketch& sketch : sketches) {
+        distinct.merge(sketch.distinct);
+        max_error += sketch.top.min_count();
+    }
+    std::vector<HeavyHitter> heavy = merge_heavy_hitters(sketches, keep);
+
+    std::ofstream out(output_filename);
+    if (!out.is_open()) {
+        std::cerr << "Error: Could not open final output file " << output_filename << std::endl;
+        return 1;
+    }
+    out << "--- Approximate Word Count Summary ---\n";
+    out << "Estimated Unique Words: " << (uint64_t)(distinct.estimate() + 0.5) << " (HyperLogLog, standard error "
+        << distinct.standard_error() * 100 << "%)\n";
+    out << "Total Words Processed (sum of all consumers): " << total_words << "\n";
+    out << "Showing Top " << heavy.size() << " Words; each count exceeds the true count by at most the error shown (never more than "
+        << max_error << ")\n";
+    out << "-------------------------------------------\n";
+    for (const HeavyHitter& hit : heavy)
+        out << hit.word << ": " << hit.count << " (error <= " << hit.error << ")\n";
+    out.close();
+    if (!out) {
+        std::cerr << "Error: Could not write final output file " << output_filename << std::endl;
+        return 1;
+    }
+    std::cout << "Aggregation complete! Approximate results are in '" << output_filename << "'" << std::endl;
+    return 0;
+}
+
+const char* DELTA_STATE_FILE = "aggregator_deltas.state";
+
+// --deltas mode: folds what daemon consumers counted since the last run into a running total.
+// The state file names the current total, aggregated_counts_<generation>.run (sorted by word), and
+// the last delta folded from each consumer:
+//   generation <N>
+//   folded <consumer_id> <sequence>
+// A run merges the total with the newer deltas into generation N + 1 and only then replaces the
+// state file (write, fsync, rename). A crash before that leaves the old state and total, and the
+// same deltas are simply folded again by the next run.
+struct DeltaState {
+    uint64_t generation = 0; // 0: nothing folded yet
+    std::map<std::string, uint64_t> folded;
+
+    static std::string total_path(uint64_t generation) {
+        return "aggregated_counts_" + std::to_string(generation) + ".run";
+    }
+
+    // A missing file is the empty state; returns false (after reporting) for a corrupt one
+    bool load(const std::string& path) {
+        std::ifstream in(path);
+        if (!in.is_open())
+            return true;
+        std::string key;
+        while (in >> key) {
+            std::string consumer_id;
+            uint64_t sequence = 0;
+            if (key == "generation" && in >> generation)
+                continue;
+            if (key == "folded" && in >> consumer_id >> sequence) {
+                folded[consumer_id] = sequence;
+                continue;
+            }
+            std::cerr << "Error: Corrupt delta state in " << path << "; remove it and " << total_path(generation)
+                      << " to fold every delta from scratch." << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    bool save(const std::string& path) const {
+        std::string tmp = path + ".tmp";
+        {
+            std::ofstream out(tmp);
+            out << "generation " << generation << "\n";
+            for (const auto& consumer : folded)
+                out << "folded " << consumer.first << " " << consumer.second << "\n";
+            out.close(); // A write can still fail on the final flush
+            if (out.fail()) {
+                unlink(tmp.c_str());
+                return false;
+            }
+        }
+        int fd = open(tmp.c_str(), O_WRONLY);
+        bool synced = fd != -1 && fsync(fd) == 0;
+        if (fd != -1)
+            close(fd);
+        return synced && replace_file(tmp, path);
+    }
+};
+
+// Lists the deltas newer than `state` in `dir`, ordered by consumer and sequence, and records the
+// newest of each consumer in `next`
+std::vector<fs::path> find_new_deltas(const std::string& dir, const DeltaState& state, DeltaState& next) {
+    std::vector<std::pair<std::pair<std::string, uint64_t>, fs::path>> found;
+    for (const auto& entry : fs::directory_iterator(dir)) {
+        std::string consumer_id;
+        uint64_t sequence = 0;
+        if (!entry.is_regular_file() || !parse_delta_run_name(entry.path().filename().string(), consumer_id, sequence))
+            continue;
+        auto folded = state.folded.find(consumer_id);
+        if (folded != state.folded.end() && sequence <= folded->second)
+            continue;
+        found.push_back({{consumer_id, sequence}, entry.path()});
+        uint64_t& newest = next.folded[consumer_id];
+        newest = std::max(newest, sequence);
+    }
+    std::sort(found.begin(), found.end());
+    std::vector<fs::path> deltas;
+    for (const auto& delta : found)
+        deltas.push_back(delta.second);
+    return deltas;
+}
+
+// Deletes the totals of other generations and every delta that is both folded and covered by its
+// consumer's snapshot (a restarting consumer still needs the deltas newer than its snapshot)
+void prune_deltas(const std::string& dir, const DeltaState& state) {
+    std::map<std::string, uint64_t> snapshot_sequence;
+    for (const auto& entry : fs::directory_iterator(dir)) {
+        std::string filename = entry.path().filename().string();
+        std::string consumer_id;
+        uint64_t sequence = 0;
+        if (filename.rfind("aggregated_counts_", 0) == 0 && filename != DeltaState::total_path(state.generation)
+            && filename.size() > 4 && filename.compare(filename.size() - 4, 4, ".run") == 0) {
+            fs::remove(entry.path());
+            continue;
+        }
+        if (!parse_delta_run_name(filename, consumer_id, sequence))
+            continue;
+        auto folded = state.folded.find(consumer_id);
+        if (folded == state.folded.end() || sequence > folded->second)
+            continue;
+        if (!snapshot_sequence.count(consumer_id)) {
+            CountRunReader snapshot(4096);
+            snapshot_sequence[consumer_id] = snapshot.open((dir + "/" + snapshot_run_name(consumer_id)).c_str()) ? snapshot.sequence() : 0;
+        }
+        if (sequence <= snapshot_sequence[consumer_id])
+            fs::remove(entry.path());
+    }
+}
+
+int main(int argc, char* argv[]) {
+    bool partitioned = false;
+    bool binary_runs = false;
+    bool fold_deltas = false;
+    bool approximate = false;
+    size_t top_k = 0;     // 0: write every word
+    size_t merge_memory = DEFAULT_MERGE_MEMORY;
+    size_t fan_in = 0;    // 0: derived from merge_memory
+    std::string spill_dir; // The job's directory unless given
+    JobNames job;
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--partitioned") {
+            partitioned = true;
+        } else if (arg == "--top" && i + 1 < argc) {
+            if (!parse_count_option("--top", argv[++i], top_k))
+                return 1;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            if (!parse_count_option("--threads", argv[++i], threads))
+                return 1;
+        } else if (arg == "--runs") {
+            binary_runs = true;
+        } else if (arg == "--deltas") {
+            fold_deltas = true;
+        } else if (arg == "--approx") {
+            approximate = true;
+        } else if (arg == "--memory" && i + 1 < argc) {
+            if (!parse_count_option("--memory", argv[++i], merge_memory))
+                return 1;
+        } else if (arg == "--fan-in" && i + 1 < argc) {
+            if (!parse_count_option("--fan-in", argv[++i], fan_in))
+                return 1;
+        } else if (arg == "--spill-dir" && i + 1 < argc) {
+            spill_dir = argv[++i];
+        } else if (arg == "--job" && i + 1 < argc) {
+            if (!valid_job_id(argv[++i])) {
+                std::cerr << "Error: --job expects an ID of up to " << MAX_JOB_ID_LENGTH << " letters, digits, '_' or '-'." << std::endl;
+                return 1;
+            }
+            job = JobNames(argv[i]);
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--partitioned | --runs | --deltas | --approx] [--memory BYTES] [--fan-in N] [--spill-dir DIR] [--top K] [--threads N] [--job ID]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::cout << "Starting word count aggregation..." << std::endl;
+
+    // Directory to scan for consumer output files: the job's, by default the current directory
+    std::string output_dir = job.dir;
+    if (spill_dir.empty())
+        spill_dir = job.dir;
+    std::string delta_state_file = job.path(DELTA_STATE_FILE);
     std::string file_prefix = "consumer_output_";
-    std::string file_suffix = ".txt";
+    std::string file_suffix = binary_runs ? ".run" : ".txt"; // --runs reads the consumers' binary output
+    if (approximate) {
+        file_prefix = "consumer_sketch_";
+        file_suffix = ".sk";
+    }
+    std::vector<fs::path> input_files;
+    std::vector<fs::path> id_files; // Dense ID counts from the consumers of an interned job
+    DeltaState delta_state, next_delta_state; // --deltas only
 
     try {
+        if (fold_deltas) {
+            if (!delta_state.load(delta_state_file))
+                return 1;
+            next_delta_state = delta_state;
+            if (delta_state.generation)
+                input_files.push_back(job.path(DeltaState::total_path(delta_state.generation)));
+            std::vector<fs::path> deltas = find_new_deltas(output_dir, delta_state, next_delta_state);
+            if (!deltas.empty())
+                next_delta_state.generation++;
+            std::cout << "Folding " << deltas.size() << " new delta run(s) into "
+                      << (delta_state.generation ? DeltaState::total_path(delta_state.generation) : std::string("an empty total")) << std::endl;
+            input_files.insert(input_files.end(), deltas.begin(), deltas.end());
+        }
         // Iterate through all entries in the current directory
         for (const auto& entry : fs::directory_iterator(output_dir)) {
+            if (fold_deltas)
+                break;
             if (entry.is_regular_file()) {
                 std::string filename = entry.path().filename().string();
 
@@ -33,74 +795,150 @@ int main() {
                 if (filename.rfind(file_prefix, 0) == 0 &&
                     filename.length() > file_prefix.length() + file_suffix.length() &&
                     filename.substr(filename.length() - file_suffix.length()) == file_suffix) {
-
-                    std::cout << "  Reading: " << filename << std::endl;
-                    std::ifstream infile(entry.path());
-                    if (!infile.is_open()) {
-                        std::cerr << "Error: Could not open file " << filename << std::endl;
-                        continue;
-                    }
-
-                    std::string line;
-                    while (std::getline(infile, line)) {
-                        size_t tab_pos = line.find('\t');
-                        if (tab_pos != std::string::npos) {
-                            std::string word = line.substr(0, tab_pos);
-                            try {
-                                int count = std::stoi(line.substr(tab_pos + 1));
-                                all_word_counts[word] += count;
-                                total_words_processed_across_consumers += count;
-                            } catch (const std::invalid_argument& e) {
-                                std::cerr << "Error: Invalid number format in line from " << filename << ": " << line << std::endl;
-                            } catch (const std::out_of_range& e) {
-                                std::cerr << "Error: Number out of range in line from " << filename << ": " << line << std::endl;
-                            }
-                        } else {
-                            std::cerr << "Warning: Skipping malformed line in " << filename << ": " << line << std::endl;
-                        }
-                    }
-                    infile.close();
+                    input_files.push_back(entry.path());
                 }
+                if (!binary_runs && !approximate && filename.rfind(file_prefix, 0) == 0 && entry.path().extension() == ".ids")
+                    id_files.push_back(entry.path());
             }
         }
     } catch (const fs::filesystem_error& e) {
         std::cerr << "Filesystem error: " << e.what() << std::endl;
         return 1;
     }
+    std::sort(input_files.begin(), input_files.end());
+    std::sort(id_files.begin(), id_files.end());
+    if (partitioned && !id_files.empty()) {
+        std::cout << "Consumers counted interned word IDs; summing them instead of merging partitions." << std::endl;
+        partitioned = false;
+    }
+    if (partitioned && !disjoint_partitions(input_files)) {
+        std::cout << "The consumer outputs are not disjoint partitions; summing them instead of merging partitions." << std::endl;
+        partitioned = false;
+    }
+    std::string final_output_filename = job.path("aggregated_word_counts.txt");
+    if (approximate) {
+        unlink(count_index_path(final_output_filename).c_str()); // Estimates are not indexed
+        return aggregate_sketches(input_files, top_k, final_output_filename);
+    }
 
-    if (all_word_counts.empty()) {
-        std::cout << "No word count data found from consumers. Please ensure consumers ran successfully." << std::endl;
-        return 0;
+    size_t unique_words = 0;
+    uint64_t total_words_processed_across_consumers = 0;
+    std::unique_ptr<ShardedWordCounts> counts; // Owns the keys the sorted entries point at
+    std::vector<WordCountTable::Entry> sorted_words;
+    std::string body_filename = final_output_filename + ".body"; // Partitioned merge: lines written before the totals are known
+    RunAggregation runs(merge_memory, fan_in, top_k, (unsigned)threads, spill_dir);
+
+    // Point and top-N lookups (wclookup) read the mapped index instead of parsing the report. It is
+    // fed the merged counts before any --top cut, so it holds every word, not only the report's.
+    std::string index_filename = count_index_path(final_output_filename);
+    CountIndexWriter index;
+    if (!index.open(index_filename)) {
+        std::cerr << "Error: Could not build the index: " << index.error() << std::endl;
+        return 1;
     }
 
-    // Convert map to vector for sorting
-    std::vector<std::pair<std::string, int>> sorted_words;
-    for (const auto& pair : all_word_counts) {
-        sorted_words.push_back(pair);
+    if (binary_runs || fold_deltas) {
+        for (const fs::path& path : input_files)
+            std::cout << "  Merging: " << path.filename().string() << std::endl;
     }
+    if (fold_deltas && next_delta_state.generation != delta_state.generation) {
+        // New deltas: the merge also writes the next generation of the running total
+        std::string total = job.path(DeltaState::total_path(next_delta_state.generation));
+        std::string tmp = total + ".tmp";
+        CountRunWriter writer;
+        if (!writer.open(tmp.c_str(), RUN_ORDER_WORD)) {
+            perror(("Aggregator: Could not create " + tmp).c_str());
+            return 1;
+        }
+        if (!runs.collect(input_files, index, unique_words, total_words_processed_across_consumers, &writer))
+            return 1;
+        if (!writer.finish(true) || !replace_file(tmp, total) || !next_delta_state.save(delta_state_file)) {
+            perror(("Aggregator: Could not save " + total).c_str());
+            return 1;
+        }
+        prune_deltas(output_dir, next_delta_state);
+    } else if (binary_runs || fold_deltas) {
+        if (!runs.collect(input_files, index, unique_words, total_words_processed_across_consumers))
+            return 1;
+    } else if (partitioned) {
+        std::ofstream body(body_filename, std::ios::binary);
+        if (!body.is_open()) {
+            std::cerr << "Error: Could not open " << body_filename << std::endl;
+            return 1;
+        }
+        bool indexed = merge_partitions(input_files, top_k, body, index, unique_words, total_words_processed_across_consumers);
+        body.close();
+        if (!indexed || body.fail()) {
+            if (indexed)
+                std::cerr << "Error: Could not write " << body_filename << std::endl;
+            else
+                std::cerr << "Error: Could not write the index: " << index.error() << std::endl;
+            unlink(body_filename.c_str());
+            return 1;
+        }
+    } else {
+        counts = std::make_unique<ShardedWordCounts>((unsigned)std::max<size_t>(1, std::min(threads, input_files.size())));
+        count_files(input_files, *counts);
+        if (!id_files.empty() && !count_id_files(id_files, job.ipc(DICTIONARY_NAME), *counts))
+            return 1;
+        sorted_words = counts->merge((unsigned)threads, 0, unique_words, total_words_processed_across_consumers);
 
-    // Sort by count in descending order
-    std::sort(sorted_words.begin(), sorted_words.end(), cmp);
+        // Sort by count in descending order (or pick out the K most frequent words); the report's
+        // words go into the index first, in rank order, then the ones --top leaves out
+        sort_top(sorted_words, top_k, (unsigned)threads);
+        size_t reported = top_k ? std::min(top_k, sorted_words.size()) : sorted_words.size();
+        for (size_t i = 0; i < sorted_words.size(); ++i) {
+            if (!index.add(sorted_words[i].word(), sorted_words[i].count, i < reported)) {
+                std::cerr << "Error: Could not write the index: " << index.error() << std::endl;
+                return 1;
+            }
+        }
+        sorted_words.resize(reported);
+    }
 
-    // Write the final aggregated counts to the output file
-    std::string final_output_filename = "aggregated_word_counts.txt";
-    std::ofstream final_outfile(final_output_filename);
+    if (unique_words == 0) {
+        unlink(body_filename.c_str());
+        std::cout << "No word count data found from consumers. Please ensure consumers ran successfully." << std::endl;
+        return 0;
+    }
+
+    // Write the final aggregated counts next to the output file and rename it into place; the
+    // body streams straight from the merge (or the partitioned body file) instead of a buffer
+    std::string report_tmp = final_output_filename + ".tmp";
+    std::ofstream final_outfile(report_tmp);
     if (!final_outfile.is_open()) {
-        std::cerr << "Error: Could not open final output file " << final_output_filename << std::endl;
+        std::cerr << "Error: Could not open final output file " << report_tmp << std::endl;
+        unlink(body_filename.c_str());
         return 1;
     }
 
     std::cout << "\nWriting truly aggregated results to '" << final_output_filename << "'" << std::endl;
-    final_outfile << "--- Truly Aggregated Word Count Summary ---\n";
-    final_outfile << "Total Unique Words: " << sorted_words.size() << "\n";
-    final_outfile << "Total Words Processed (sum of all consumers): " << total_words_processed_across_consumers << "\n";
-    final_outfile << "-------------------------------------------\n";
-    for (const auto& pair : sorted_words) {
-        final_outfile << pair.first << ": " << pair.second << "\n";
+    write_report_header(final_outfile, unique_words, total_words_processed_across_consumers, top_k);
+    bool body_written = true;
+    if (binary_runs || fold_deltas) {
+        body_written = runs.write_body(final_outfile, index);
+    } else if (partitioned) {
+        std::ifstream body(body_filename, std::ios::binary);
+        body_written = body.is_open() && (final_outfile << body.rdbuf()) && !body.bad();
+        unlink(body_filename.c_str());
+    } else {
+        for (const WordCountTable::Entry& entry : sorted_words) {
+            final_outfile << entry.word() << ": " << entry.count << "\n";
+        }
     }
     final_outfile.close();
+    if (!body_written || final_outfile.fail() || rename(report_tmp.c_str(), final_output_filename.c_str()) == -1) {
+        std::cerr << "Error: Could not write final output file " << final_output_filename << std::endl;
+        unlink(report_tmp.c_str());
+        return 1;
+    }
 
-    std::cout << "Aggregation complete! Results are in '" << final_output_filename << "'" << std::endl;
+    if (!index.finish(total_words_processed_across_consumers)) {
+        std::cerr << "Error: Could not build the index: " << index.error() << std::endl;
+        return 1;
+    }
+
+    std::cout << "Aggregation complete! Results are in '" << final_output_filename << "', indexed in '" << index_filename << "'" << std::endl;
 
     return 0;
-}
\ No newline at end of file
+}
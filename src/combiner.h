@@ -0,0 +1,92 @@
+#ifndef COMBINER_H
+#define COMBINER_H
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "hash.h"
+
+const size_t DEFAULT_COMBINER_MEMORY = 4 * 1024 * 1024; // Bytes used by --combine without a value
+const size_t MIN_COMBINER_MEMORY = 64 * 1024;
+
+// Bounded pre-aggregation table for a producer. Counts repeated words locally so the ring
+// carries one (word, count) record per distinct word instead of one record per occurrence.
+// Open addressing with linear probing; key bytes live in a fixed arena. When either the
+// slots or the arena fill up, the caller flushes everything and starts over.
+class WordCombiner {
+public:
+    explicit WordCombiner(size_t memory_budget) {
+        // Half the budget for slots (rounded down to a power of two), half for key bytes
+        size_t slots = 1;
+        while (slots * 2 * sizeof(Slot) <= memory_budget / 2)
+            slots *= 2;
+        slots_.assign(slots, Slot());
+        mask_ = slots - 1;
+        max_entries_ = slots / 4 * 3; // Flush at 75% load so probe runs stay short
+        arena_.resize(memory_budget - slots * sizeof(Slot));
+    }
+
+    // Counts one occurrence. Returns false (without counting) if the table is full and must be flushed.
+    bool add(const char* word, uint8_t length) {
+        uint64_t hash = hash_word(word, length);
+        for (size_t i = hash & mask_;; i = (i + 1) & mask_) {
+            Slot& slot = slots_[i];
+            if (slot.count == 0) {
+                if (entries_ >= max_entries_ || arena_used_ + length > arena_.size())
+                    return false;
+                memcpy(arena_.data() + arena_used_, word, length);
+                slot.hash = hash;
+                slot.offset = (uint32_t)arena_used_;
+                slot.length = length;
+                slot.count = 1;
+                arena_used_ += length;
+                entries_++;
+                return true;
+            }
+            if (slot.hash == hash && slot.length == length && memcmp(arena_.data() + slot.offset, word, length) == 0) {
+                slot.count++;
+                return true;
+            }
+        }
+    }
+
+    // Hands every (word, length, count) to emit(), then empties the table.
+    // Returns false without clearing if emit() asks to stop (shutdown).
+    template <typename Emit>
+    bool flush(Emit&& emit) {
+        for (Slot& slot : slots_) {
+            if (slot.count != 0 && !emit((const char*)arena_.data() + slot.offset, slot.length, slot.count))
+                return false;
+        }
+        clear();
+        return true;
+    }
+
+    bool empty() const { return entries_ == 0; }
+    size_t entries() const { return entries_; }
+
+private:
+    struct Slot {
+        uint64_t hash = 0;
+        uint32_t offset = 0;
+        uint8_t length = 0;
+        uint64_t count = 0; // 0 marks an empty slot
+    };
+
+    void clear() {
+        for (Slot& slot : slots_)
+            slot.count = 0;
+        entries_ = 0;
+        arena_used_ = 0;
+    }
+
+    std::vector<Slot> slots_;
+    std::vector<char> arena_;
+    size_t mask_ = 0;
+    size_t entries_ = 0;
+    size_t max_entries_ = 0;
+    size_t arena_used_ = 0;
+};
+
+#endif
@@ -4,33 +4,442 @@
 #include <string>
 #include <vector>
 #include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <semaphore.h>
 
+#include "ring.h"
+#include "hash.h"
+#include "word_block.h"
+#include "stats.h"
+#include "placement.h"
+#include "dictionary.h"
+#include "job.h"
 
-const int MAX_WORD_LENGTH = 255;
-const int MAX_WORD_ENTRIES = 10; // Number of word entries the shared memory will hold
+const int MAX_WORD_LENGTH = 255; // Including the terminator, so words are truncated to 254 bytes
 
-struct WordEntry {
-    char word[MAX_WORD_LENGTH];
+// Ring geometry defaults; all can be overridden by the producer that creates the buffer
+const uint32_t DEFAULT_SLOT_SIZE = 64 * 1024; // Bytes per block
+const uint32_t DEFAULT_RING_DEPTH = 16;       // Number of blocks each ring holds
+const uint32_t DEFAULT_PARTITIONS = 1;        // Number of rings (hash partitions)
+const uint32_t MIN_SLOT_SIZE = 1024;
+const uint32_t MAX_SLOT_SIZE = 64 * 1024 * 1024;
+const uint32_t MIN_RING_DEPTH = 2; // A one-slot sequence ring cannot tell "full" from "free"
+const uint32_t MAX_RING_DEPTH = 1 << 16;
+const uint32_t MAX_PARTITIONS = 1024;
+
+// Queue implementations selectable at startup; the process that initializes the buffer picks one
+enum QueueKind : int {
+    QUEUE_SEMAPHORE = 0, // head/tail guarded by SEM_MUTEX_NAME, slots counted by SEM_EMPTY/SEM_FULL
+    QUEUE_LOCKFREE = 1   // BlockRing with per-slot sequence numbers, futex wait only when empty/full
+};
+
+// Lifecycle of the job sharing one segment. The state word doubles as a futex: every change is
+// followed by a wake-all, so nobody has to poll it.
+enum JobState : uint32_t {
+    JOB_STARTING = 0, // Segment created (still zero-filled) but not laid out yet
+    JOB_OPEN = 1,     // Initialized: producers join, publish and leave
+    JOB_CLOSED = 2    // Every expected producer has left and every ring is closed; consumers drain and exit
+};
+
+// How the creating producer set up the segment's memory; attaching processes map it the same way
+enum SegmentFlags : uint32_t {
+    SEGMENT_HUGE_PAGES = 1, // Sized to a multiple of HUGE_PAGE_SIZE and madvise'd for transparent huge pages
+    SEGMENT_INTERNED = 2    // Producers ship word IDs from the DICTIONARY_NAME segment, created before this one was opened
 };
 
+// One hash partition of the vocabulary: a ring of its own, drained by the consumer(s) attached to it
+struct Partition {
+    BlockRing ring; // Slot storage is shared by both queues; the semaphore path ignores the sequence numbers
+
+    // Semaphore queue state, kept on separate cache lines from each other
+    alignas(CACHE_LINE_SIZE) int head; // Index of the next available slot for writing (producer)
+    alignas(CACHE_LINE_SIZE) int tail; // Index of the next entry to be read (consumer)
+    int queued; // Blocks between tail and head, guarded by sem_mutex; tells a real block from a close wakeup
+};
+
+// Header of the shared segment. It is followed in the same mapping by the StatsBlock, then by
+// `partition_count` Partition headers and then by each partition's ring slots.
 struct SharedWordBuffer {
-    std::atomic_bool initialized; // Flag to ensure one-time initialization of the buffer
-    WordEntry entries[MAX_WORD_ENTRIES];
-    int head; // Index of the next available slot for writing (producer)
-    int tail; // Index of the next entry to be read (consumer)
-
-    // Track active producers and EOF signals for graceful multi-producer shutdown
-    std::atomic_int active_producers_count; // Number of producers currently running
-    std::atomic_int eof_signals_received;   // Count of EOF signals received from producers
+    std::atomic<uint32_t> state;  // JobState; futex word
+    std::atomic_int queue_kind;   // QueueKind chosen by the initializing process
+    uint64_t layout;              // segment_layout() of the build that laid the segment out
+    uint64_t total_size;          // Size of the whole mapping in bytes
+    uint32_t partition_count;     // Number of hash partitions (one ring each)
+    uint32_t segment_flags;       // SegmentFlags
+
+    // Track producers for graceful multi-producer shutdown
+    std::atomic_int active_producers_count;   // Number of producers currently running
+    std::atomic<uint32_t> producers_left;     // Producers that have finished (or given up) so far
+    std::atomic<uint32_t> expected_producers; // Producers the job waits for, from the first consumer's command line; 0 until then
+    std::atomic<uint32_t> active_consumers;   // Consumers attached now; left above 0 by one that crashed
+
+    Partition& partition(uint32_t index);
+    StatsBlock& stats();
 };
 
-// IPC Resource Names 
+// IPC Resource Names; a job with an ID appends it to each (JobNames::ipc)
 const char* SHARED_MEM_NAME = "/word_shared_memory";
 const char* SEM_EMPTY_NAME = "/word_sem_empty";
 const char* SEM_FULL_NAME = "/word_sem_full";
 const char* SEM_MUTEX_NAME = "/word_sem_mutex";
 
-// Special word to signal end of file from a producer
-const char* EOF_SIGNAL_WORD = "__EOF__";
+const uint64_t SEGMENT_LAYOUT_VERSION = 1; // Bump whenever the segment's layout changes
+const int STALE_SEGMENT_GRACE_SECONDS = 5; // How old a segment nobody holds must be before it is reclaimed while still empty
+
+// The semaphore queue uses one set of named semaphores per partition
+struct QueueSemaphores {
+    sem_t* empty = SEM_FAILED;
+    sem_t* full = SEM_FAILED;
+    sem_t* mutex = SEM_FAILED;
+};
+
+inline std::string partition_sem_name(const JobNames& job, const char* base, uint32_t partition) {
+    return job.ipc(std::string(base) + "_" + std::to_string(partition));
+}
+
+// Opens (or, with `create`, creates) the semaphores of one partition. Returns false on failure with errno set.
+inline bool open_queue_semaphores(const JobNames& job, uint32_t partition, bool create, uint32_t ring_depth, QueueSemaphores& sems) {
+    if (create) { // Start from fresh values: semaphores left by an earlier job would keep theirs
+        for (const char* base : {SEM_EMPTY_NAME, SEM_FULL_NAME, SEM_MUTEX_NAME})
+            sem_unlink(partition_sem_name(job, base, partition).c_str());
+        sems.empty = sem_open(partition_sem_name(job, SEM_EMPTY_NAME, partition).c_str(), O_CREAT, 0666, ring_depth);
+        sems.full = sem_open(partition_sem_name(job, SEM_FULL_NAME, partition).c_str(), O_CREAT, 0666, 0);
+        sems.mutex = sem_open(partition_sem_name(job, SEM_MUTEX_NAME, partition).c_str(), O_CREAT, 0666, 1);
+    } else {
+        sems.empty = sem_open(partition_sem_name(job, SEM_EMPTY_NAME, partition).c_str(), 0);
+        sems.full = sem_open(partition_sem_name(job, SEM_FULL_NAME, partition).c_str(), 0);
+        sems.mutex = sem_open(partition_sem_name(job, SEM_MUTEX_NAME, partition).c_str(), 0);
+    }
+    return sems.empty != SEM_FAILED && sems.full != SEM_FAILED && sems.mutex != SEM_FAILED;
+}
+
+inline const char* queue_kind_name(int kind) {
+    return kind == QUEUE_LOCKFREE ? "lockfree" : "semaphore";
+}
+
+// Returns -1 for an unrecognised name
+inline int parse_queue_kind(const std::string& name) {
+    if (name == "lockfree")
+        return QUEUE_LOCKFREE;
+    if (name == "semaphore")
+        return QUEUE_SEMAPHORE;
+    return -1;
+}
+
+inline uint64_t shared_header_size() {
+    return (sizeof(SharedWordBuffer) + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+}
+
+// Offset of the first Partition header: the StatsBlock sits between it and the SharedWordBuffer header
+inline uint64_t shared_partitions_offset() {
+    return shared_header_size() + (sizeof(StatsBlock) + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+}
+
+// Identifies this build's segment layout: the version and the sizes of the structures in it, so a
+// process built from other sources refuses a segment it would misread
+inline uint64_t segment_layout() {
+    uint64_t fields[] = {SEGMENT_LAYOUT_VERSION, sizeof(SharedWordBuffer), sizeof(StatsBlock), sizeof(Partition), (uint64_t)CACHE_LINE_SIZE};
+    return hash_word(reinterpret_cast<const char*>(fields), sizeof(fields));
+}
+
+inline StatsBlock& SharedWordBuffer::stats() {
+    return *reinterpret_cast<StatsBlock*>(reinterpret_cast<char*>(this) + shared_header_size());
+}
+
+inline Partition& SharedWordBuffer::partition(uint32_t index) {
+    return reinterpret_cast<Partition*>(reinterpret_cast<char*>(this) + shared_partitions_offset())[index];
+}
+
+inline uint64_t shared_buffer_size(uint32_t partitions, uint32_t ring_depth, uint32_t slot_size) {
+    return shared_partitions_offset() + partitions * (sizeof(Partition) + BlockRing::slots_bytes(ring_depth, slot_size));
+}
+
+// Where partition `p`'s slots start, relative to its BlockRing: after every Partition header,
+// each partition's slots in turn
+inline uint64_t ring_slots_offset(SharedWordBuffer* wordBuffer, uint32_t p, uint32_t partitions, uint32_t ring_depth, uint32_t slot_size) {
+    uint64_t slots_base = shared_partitions_offset() + partitions * sizeof(Partition);
+    uint64_t ring_offset = reinterpret_cast<char*>(&wordBuffer->partition(p).ring) - reinterpret_cast<char*>(wordBuffer);
+    return slots_base + p * BlockRing::slots_bytes(ring_depth, slot_size) - ring_offset;
+}
+
+// Size of the segment to create: shared_buffer_size(), rounded up to whole huge pages if asked for
+inline uint64_t shared_segment_size(uint32_t partitions, uint32_t ring_depth, uint32_t slot_size, uint32_t segment_flags) {
+    uint64_t size = shared_buffer_size(partitions, ring_depth, slot_size);
+    if (segment_flags & SEGMENT_HUGE_PAGES)
+        size = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    return size;
+}
+
+// Lays out a freshly created (zero-filled) segment of shared_segment_size() bytes
+inline void init_shared_buffer(SharedWordBuffer* wordBuffer, int queue_kind, uint32_t partitions, uint32_t ring_depth, uint32_t slot_size,
+                               uint32_t segment_flags = 0) {
+    wordBuffer->queue_kind.store(queue_kind);
+    wordBuffer->layout = segment_layout();
+    wordBuffer->total_size = shared_segment_size(partitions, ring_depth, slot_size, segment_flags);
+    wordBuffer->partition_count = partitions;
+    wordBuffer->segment_flags = segment_flags;
+    wordBuffer->active_producers_count.store(0);
+    wordBuffer->producers_left.store(0);
+    wordBuffer->expected_producers.store(0);
+    wordBuffer->active_consumers.store(0);
+
+    for (uint32_t p = 0; p < partitions; ++p) {
+        Partition& part = wordBuffer->partition(p);
+        part.head = 0;
+        part.tail = 0;
+        part.queued = 0;
+        part.ring.init(ring_depth, slot_size, ring_slots_offset(wordBuffer, p, partitions, ring_depth, slot_size));
+    }
+    wordBuffer->state.store(JOB_OPEN);
+    futex_wake_all(&wordBuffer->state);
+}
+
+// True once as many producers have left as the consumers expect and none is still running.
+// Producers update producers_left and then active_producers_count before calling this, and
+// consumers publish expected_producers before calling it, so (all accesses being sequentially
+// consistent) whichever side acts last sees the job complete.
+inline bool job_complete(SharedWordBuffer* wordBuffer) {
+    uint32_t expected = wordBuffer->expected_producers.load();
+    return expected > 0 && wordBuffer->producers_left.load() >= expected && wordBuffer->active_producers_count.load() == 0;
+}
+
+// Moves an open job to JOB_CLOSED, closes every ring (waking consumers parked on one) and wakes
+// anyone waiting on the state word. Returns false if the job was not open. The semaphore queue
+// also needs one post on each partition's sem_full; callers do that with the semaphores they hold.
+inline bool close_job(SharedWordBuffer* wordBuffer) {
+    uint32_t open = JOB_OPEN;
+    if (!wordBuffer->state.compare_exchange_strong(open, JOB_CLOSED))
+        return false;
+    for (uint32_t p = 0; p < wordBuffer->partition_count; ++p)
+        wordBuffer->partition(p).ring.close();
+    futex_wake_all(&wordBuffer->state);
+    return true;
+}
+
+// Blocks currently queued in a partition, for the occupancy histogram. Lock-free positions are
+// read without synchronization, so the value is clamped to the ring's capacity.
+inline uint64_t partition_occupancy(Partition& part, int queue_kind, const QueueSemaphores* sems) {
+    if (queue_kind == QUEUE_LOCKFREE) {
+        int64_t queued = (int64_t)(part.ring.enqueue_pos.load(std::memory_order_relaxed) - part.ring.dequeue_pos.load(std::memory_order_relaxed));
+        return queued < 0 ? 0 : (uint64_t)queued > part.ring.capacity ? part.ring.capacity : (uint64_t)queued;
+    }
+    int full = 0;
+    if (sems && sems->full != SEM_FAILED)
+        sem_getvalue(sems->full, &full);
+    return full < 0 ? 0 : (uint64_t)full;
+}
+
+// The slot storage of one partition's ring, for placing it in memory
+inline void partition_slots(Partition& part, char*& slots, uint64_t& bytes) {
+    slots = reinterpret_cast<char*>(part.ring.slot(0));
+    bytes = BlockRing::slots_bytes(part.ring.capacity, part.ring.slot_size);
+}
+
+// Checks a laid-out segment header against this build and the segment's size on disk, before
+// trusting its geometry. Returns false with `error` set.
+inline bool check_segment_header(const SharedWordBuffer* header, uint64_t file_size, std::string& error) {
+    if (header->layout != segment_layout())
+        error = "it was laid out by an incompatible build";
+    else if (header->total_size != file_size)
+        error = "its size (" + std::to_string(file_size) + " bytes) does not match its header (" + std::to_string(header->total_size) + ")";
+    else if (header->partition_count < 1 || header->partition_count > MAX_PARTITIONS)
+        error = "bad partition count " + std::to_string(header->partition_count);
+    else if (header->total_size < shared_partitions_offset() + header->partition_count * sizeof(Partition))
+        error = "it is too small for its partitions";
+    else if (header->queue_kind.load() != QUEUE_SEMAPHORE && header->queue_kind.load() != QUEUE_LOCKFREE)
+        error = "unknown queue kind";
+    else if (header->segment_flags & ~(uint32_t)(SEGMENT_HUGE_PAGES | SEGMENT_INTERNED))
+        error = "unknown segment flags";
+    return error.empty();
+}
+
+// Checks that the rings fill the segment exactly as init_shared_buffer() lays them out, so no
+// slot lies outside the mapping
+inline bool check_segment_rings(SharedWordBuffer* wordBuffer, std::string& error) {
+    uint32_t partitions = wordBuffer->partition_count;
+    uint32_t ring_depth = wordBuffer->partition(0).ring.capacity;
+    uint32_t slot_size = wordBuffer->partition(0).ring.slot_size;
+    if (ring_depth < MIN_RING_DEPTH || ring_depth > MAX_RING_DEPTH || slot_size < MIN_SLOT_SIZE || slot_size > MAX_SLOT_SIZE)
+        error = "bad ring geometry";
+    else if (shared_segment_size(partitions, ring_depth, slot_size, wordBuffer->segment_flags) != wordBuffer->total_size)
+        error = "its rings do not add up to its size";
+    for (uint32_t p = 0; error.empty() && p < partitions; ++p) {
+        BlockRing& ring = wordBuffer->partition(p).ring;
+        if (ring.capacity != ring_depth || ring.slot_size != slot_size || ring.slot_stride != BlockRing::stride_for(slot_size)
+            || ring.slots_offset != ring_slots_offset(wordBuffer, p, partitions, ring_depth, slot_size))
+            error = "the ring of partition " + std::to_string(p) + " is not where the layout puts it";
+    }
+    return error.empty();
+}
+
+// Every producer and consumer of a job holds a shared flock() on the job's segment for as long as
+// it runs, and the kernel drops the lock when the process exits, however it exits. A segment that
+// nobody holds may still be waiting for consumers to drain what finished producers left in it,
+// but it is stale, and reclaimed (unlinked, so that the next producer creates a fresh one), if
+//  - it was never laid out: its creator died, or
+//  - a producer or consumer still counts as active: it crashed, or
+//  - the job is closed and every ring is empty: it ran to completion, or
+//  - it does not pass the layout checks: another build left it, or it is damaged.
+// A creator locks its segment right after creating it, so an empty segment is only taken for
+// stale once it is STALE_SEGMENT_GRACE_SECONDS old. Monitors (wcstat) do not lock the segment.
+
+// Whether `name` still refers to the segment open as `fd`
+inline bool is_current_segment(const std::string& name, int fd) {
+    int current = shm_open(name.c_str(), O_RDONLY, 0);
+    if (current == -1)
+        return false;
+    struct stat a, b;
+    bool same = fstat(fd, &a) == 0 && fstat(current, &b) == 0 && a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+    close(current);
+    return same;
+}
+
+// Creates the segment `name` and locks it. Returns -1 with errno set (EEXIST if it exists).
+inline int create_job_segment(const std::string& name) {
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0666);
+    if (fd != -1 && flock(fd, LOCK_SH) == -1) {
+        int error = errno;
+        shm_unlink(name.c_str());
+        close(fd);
+        errno = error;
+        return -1;
+    }
+    return fd;
+}
+
+// Whether a segment nobody holds is stale (see above)
+inline bool segment_is_stale(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+        return false;
+    if (st.st_size == 0)
+        return time(nullptr) - st.st_ctime >= STALE_SEGMENT_GRACE_SECONDS;
+    if ((uint64_t)st.st_size < shared_header_size())
+        return true;
+    SharedWordBuffer* wordBuffer = (SharedWordBuffer*) mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (wordBuffer == MAP_FAILED)
+        return false;
+    std::string error;
+    bool stale = wordBuffer->state.load() == JOB_STARTING || !check_segment_header(wordBuffer, st.st_size, error)
+                 || !check_segment_rings(wordBuffer, error)
+                 || wordBuffer->active_producers_count.load() > 0 || wordBuffer->active_consumers.load() > 0;
+    if (!stale && wordBuffer->state.load() == JOB_CLOSED) {
+        stale = true;
+        for (uint32_t p = 0; stale && p < wordBuffer->partition_count; ++p) {
+            Partition& part = wordBuffer->partition(p);
+            stale = wordBuffer->queue_kind.load() == QUEUE_LOCKFREE
+                        ? part.ring.enqueue_pos.load() == part.ring.dequeue_pos.load()
+                        : part.queued == 0;
+        }
+    }
+    munmap(wordBuffer, st.st_size);
+    return stale;
+}
+
+// Opens the segment `name` with `flags` and locks it, unless it is stale. A stale segment is
+// unlinked instead, `reclaimed` is set and -1 returned with errno ENOENT, as when there is none.
+inline int attach_job_segment(const std::string& name, int flags, bool& reclaimed) {
+    reclaimed = false;
+    for (;;) {
+        int fd = shm_open(name.c_str(), flags, 0666);
+        if (fd == -1)
+            return -1;
+        if (flock(fd, LOCK_EX | LOCK_NB) == 0) { // Nobody holds it
+            // Only a process holding a segment's exclusive lock unlinks it, so the name cannot change before the unlink
+            bool current = is_current_segment(name, fd);
+            bool stale = current && segment_is_stale(fd);
+            if (stale) {
+                shm_unlink(name.c_str());
+                reclaimed = true;
+            }
+            if (current && !stale && flock(fd, LOCK_SH) == 0) // Still waiting for consumers: join it
+                return fd;
+            close(fd);
+            if (stale) {
+                errno = ENOENT;
+                return -1;
+            }
+            usleep(1000); // Its creator has yet to lock it, or it was replaced meanwhile: look again
+            continue;
+        }
+        // Held by a live job. Once this process holds it too it cannot be reclaimed; waiting for
+        // the shared lock also waits out a process that holds the exclusive one to reclaim it.
+        if (errno == EWOULDBLOCK && flock(fd, LOCK_SH) == 0) {
+            if (is_current_segment(name, fd))
+                return fd;
+            close(fd); // Reclaimed while we waited: look again
+            continue;
+        }
+        int error = errno;
+        close(fd);
+        errno = error;
+        return -1;
+    }
+}
+
+// Maps a buffer created by another process. Waits (polling every `poll_us`) until the creator
+// has sized the segment, then sleeps on the state word until it is initialized, checks its
+// layout and maps all of it with `prot`.
+// Returns MAP_FAILED on error, or if `running` is cleared while waiting.
+inline SharedWordBuffer* map_initialized_buffer(int shm_fd, const std::atomic_bool& running, useconds_t poll_us, size_t& mapped_size,
+                                                int prot = PROT_READ | PROT_WRITE) {
+    struct stat st;
+    for (;;) {
+        if (fstat(shm_fd, &st) == -1) {
+            perror("fstat shared memory failed");
+            return (SharedWordBuffer*) MAP_FAILED;
+        }
+        if ((uint64_t)st.st_size >= shared_header_size())
+            break;
+        if (!running.load())
+            return (SharedWordBuffer*) MAP_FAILED;
+        usleep(poll_us);
+    }
+
+    SharedWordBuffer* header = (SharedWordBuffer*) mmap(0, shared_header_size(), prot, MAP_SHARED, shm_fd, 0);
+    if (header == MAP_FAILED) {
+        perror("mmap shared memory header failed");
+        return header;
+    }
+    while (running.load() && header->state.load() == JOB_STARTING) {
+        futex_wait(&header->state, JOB_STARTING); // Times out now and then to re-check `running`
+    }
+    uint64_t total_size = header->total_size;
+    uint32_t segment_flags = header->segment_flags;
+    bool ready = header->state.load() != JOB_STARTING;
+    std::string error;
+    if (ready && fstat(shm_fd, &st) == -1) {
+        perror("fstat shared memory failed");
+        ready = false;
+    } else if (ready && !check_segment_header(header, st.st_size, error)) {
+        fprintf(stderr, "Shared memory segment rejected: %s\n", error.c_str());
+        ready = false;
+    }
+    munmap(header, shared_header_size());
+    if (!ready)
+        return (SharedWordBuffer*) MAP_FAILED;
+
+    SharedWordBuffer* wordBuffer = (SharedWordBuffer*) mmap(0, total_size, prot, MAP_SHARED, shm_fd, 0);
+    if (wordBuffer == MAP_FAILED) {
+        perror("mmap shared memory failed");
+        return wordBuffer;
+    }
+    if (!check_segment_rings(wordBuffer, error)) {
+        fprintf(stderr, "Shared memory segment rejected: %s\n", error.c_str());
+        munmap(wordBuffer, total_size);
+        return (SharedWordBuffer*) MAP_FAILED;
+    }
+    if (segment_flags & SEGMENT_HUGE_PAGES)
+        advise_huge_pages(wordBuffer, total_size); // Best effort, like the creator's
+    mapped_size = total_size;
+    return wordBuffer;
+}
 
-#endif
\ No newline at end of file
+#endif
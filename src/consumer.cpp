@@ -3,7 +3,6 @@
 #include <fcntl.h>
 #include <semaphore.h>
 #include <unistd.h>
-#include <unordered_map>          
 #include <cstring>
 #include <csignal>
 #include <atomic>
@@ -11,188 +10,714 @@
 #include <algorithm>    
 #include <vector>       
 #include <fstream>      
+#include <getopt.h>
+#include <dirent.h>
+#include <memory>
 
 #include "common.h"
+#include "word_table.h"
+#include "count_run.h"
+#include "sketch.h"
 
 using namespace std;
 
 atomic_bool running(true);
 
+size_t mapped_size = 0; // Bytes of the shared segment mapped by this process
+
+JobNames job; // With --job, the namespace of the job's IPC names and the directory of its files
+
+// The shared word dictionary, when the job interns words
+WordDictionary* dictionary = static_cast<WordDictionary*> MAP_FAILED;
+size_t dictionary_mapped_size = 0;
+
+const double DEFAULT_SNAPSHOT_INTERVAL = 10; // Seconds between daemon snapshots
+
+ProcessStats unpublished_stats;        // Stands in when every shared stats slot is taken
+ProcessStats* stats = &unpublished_stats; // This consumer's slot in the shared StatsBlock
+
 void signal_handler(int signum) {
-    cout << "\nConsumer: SIGINT received (" << signum << "). Shutting down gracefully..." << endl;
+    cout << "\nConsumer: Signal " << signum << " received. Shutting down gracefully..." << endl;
     running.store(false);
 }
 
-int cleanUp(int shm_fd, SharedWordBuffer* wordBuffer, sem_t* sem_empty, sem_t* sem_full, sem_t* sem_mutex, bool isError = false) {
-    if (sem_empty != SEM_FAILED && sem_close(sem_empty) == -1)
+int cleanUp(int shm_fd, SharedWordBuffer* wordBuffer, QueueSemaphores& sems, bool isError = false) {
+    if (sems.empty != SEM_FAILED && sem_close(sems.empty) == -1)
         perror("Consumer: sem_close SEM_EMPTY_NAME failed");
 
-    if (sem_full != SEM_FAILED && sem_close(sem_full) == -1)
+    if (sems.full != SEM_FAILED && sem_close(sems.full) == -1)
         perror("Consumer: sem_close SEM_FULL_NAME failed");
 
-    if (sem_mutex != SEM_FAILED && sem_close(sem_mutex) == -1)
+    if (sems.mutex != SEM_FAILED && sem_close(sems.mutex) == -1)
         perror("Consumer: sem_close SEM_MUTEX_NAME failed");
 
-    if (wordBuffer != MAP_FAILED && munmap(wordBuffer, sizeof(SharedWordBuffer)) == -1)
+    if (wordBuffer != MAP_FAILED)
+        wordBuffer->active_consumers--;
+
+    if (wordBuffer != MAP_FAILED && munmap(wordBuffer, mapped_size) == -1)
         perror("Consumer: munmap failed");
 
+    if (dictionary != MAP_FAILED && munmap(dictionary, dictionary_mapped_size) == -1)
+        perror("Consumer: munmap dictionary failed");
+
     if (shm_fd != -1 && close(shm_fd) == -1)
         perror("Consumer: close shm_fd failed");
 
     return isError ? 1 : 0;
 }
 
+// Waits on sem_full, until `deadline_ns` (a monotonic_ns() time) if it is not 0.
+// Returns 0 once a post was taken, -1 with errno set (ETIMEDOUT at the deadline).
+int wait_full(sem_t* full, uint64_t deadline_ns) {
+    if (!deadline_ns)
+        return sem_wait(full);
+    struct timespec ts;
+    ts.tv_sec = deadline_ns / 1000000000ull;
+    ts.tv_nsec = deadline_ns % 1000000000ull;
+    return sem_clockwait(full, CLOCK_MONOTONIC, &ts);
+}
+
+// Copy one block out using a partition's semaphore-guarded head/tail.
+// Returns 0 on success, 1 if interrupted by shutdown, 2 once the job is closed and the partition
+// drained, 3 if nothing arrived before `deadline_ns` (0: no deadline), -1 on a semaphore error.
+int dequeue_semaphore(Partition& part, char* block, const QueueSemaphores& sems, uint64_t deadline_ns = 0) {
+    if (sem_trywait(sems.full) == -1) { // Nothing queued right now: block, and account for the wait
+        uint64_t wait_start = monotonic_ns();
+        while (wait_full(sems.full, deadline_ns) == -1) {
+            if (errno == EINTR) {
+                if (!running.load())
+                    return 1; // Signal received, gracefully exit loop
+                continue;
+            }
+            if (errno == ETIMEDOUT) {
+                stats->record_queue_wait(monotonic_ns() - wait_start);
+                return 3;
+            }
+            perror("Consumer: sem_wait SEM_FULL_NAME failed");
+            return -1;
+        }
+        stats->record_queue_wait(monotonic_ns() - wait_start);
+    }
+
+    if (sem_trywait(sems.mutex) == -1) { // Another process holds the queue
+        uint64_t wait_start = monotonic_ns();
+        while (sem_wait(sems.mutex) == -1) {
+            if (errno == EINTR) {
+                if (!running.load()) {
+                    sem_post(sems.full); // Release previously acquired sem_full
+                    return 1;
+                }
+                continue;
+            }
+            perror("Consumer: sem_wait SEM_MUTEX_NAME failed");
+            sem_post(sems.full); // If mutex fails, release sem_full to avoid deadlock
+            return -1;
+        }
+        stats->record_lock_wait(monotonic_ns() - wait_start);
+    }
+
+    if (part.queued == 0) { // Not a block but the post made when the job closed: pass it on to the next consumer
+        if (sem_post(sems.mutex) == -1)
+            perror("Consumer: sem_post SEM_MUTEX_NAME failed");
+        if (sem_post(sems.full) == -1)
+            perror("Consumer: sem_post SEM_FULL_NAME failed");
+        return 2;
+    }
+
+    const char* slot = part.ring.slot_data(part.tail);
+    memcpy(block, slot, block_header(slot)->bytes_used);
+    part.tail = (part.tail + 1) % part.ring.capacity;
+    part.queued--;
+
+    if (sem_post(sems.mutex) == -1) {
+        perror("Consumer: sem_post SEM_MUTEX_NAME failed");
+    }
+
+    if (sem_post(sems.empty) == -1) {
+        perror("Consumer: sem_post SEM_EMPTY_NAME failed");
+    }
+
+    return 0;
+}
+
+void print_usage(const char* prog) {
+    cerr << "Usage: " << prog << " [--output text|binary] [--cpus LIST] [--job ID] [--bench [--latency-file PATH]] <total_expected_producers> <consumer_id>" << endl;
+    cerr << "       " << prog << " --approx[=COUNTERS] [--hll-precision P] [--job ID] [--bench] <total_expected_producers> <consumer_id>" << endl;
+    cerr << "       " << prog << " --daemon [--snapshot-interval SECONDS] [--job ID] [--bench] <consumer_id>" << endl;
+}
+
+// Text: consumer_output_<id>.txt, a partition_line() then "word\tcount" lines in count order.
+// Returns false (after reporting) if the file cannot be written.
+bool write_text_counts(const string& filename, const string& consumer_id, uint32_t partition, uint32_t partition_count,
+                       const WordCountTable& wordCounts) {
+    ofstream outfile(filename);
+    if (!outfile.is_open()) {
+        perror(("Consumer (ID: " + consumer_id + "): Failed to open output file " + filename).c_str());
+        return false;
+    }
+    outfile << partition_line(partition, partition_count) << "\n";
+    // Sorted by count (descending, ties by word) so the aggregator can merge partitions without re-hashing
+    vector<WordCountTable::Entry> sortedCounts = wordCounts.entries();
+    sort(sortedCounts.begin(), sortedCounts.end(), count_order);
+    for (const WordCountTable::Entry& entry : sortedCounts) {
+        outfile << entry.word() << "\t" << entry.count << "\n"; // Write word and count, tab-separated
+    }
+    outfile.close();
+    if (outfile.fail()) {
+        perror(("Consumer (ID: " + consumer_id + "): Failed to write output file " + filename).c_str());
+        return false;
+    }
+    return true;
+}
+
+// Writes a table as a count run sorted by word. Returns false with errno set.
+bool write_word_run(const string& filename, const WordCountTable& wordCounts, uint64_t sequence = 0, bool durable = false) {
+    vector<WordCountTable::Entry> sortedCounts = wordCounts.entries();
+    sort(sortedCounts.begin(), sortedCounts.end(), [](const WordCountTable::Entry& a, const WordCountTable::Entry& b) {
+        return a.word() < b.word();
+    });
+    CountRunWriter run;
+    bool ok = run.open(filename.c_str(), RUN_ORDER_WORD, sequence);
+    for (size_t i = 0; ok && i < sortedCounts.size(); ++i) {
+        ok = run.add(sortedCounts[i].key, (uint8_t)sortedCounts[i].length, sortedCounts[i].count);
+    }
+    return ok && run.finish(durable);
+}
+
+// Binary: consumer_output_<id>.run, a count run sorted by word for the aggregator's --runs merge.
+// Returns false (after reporting) if the file cannot be written.
+bool write_binary_counts(const string& filename, const string& consumer_id, const WordCountTable& wordCounts) {
+    if (!write_word_run(filename, wordCounts)) {
+        perror(("Consumer (ID: " + consumer_id + "): Failed to write output file " + filename).c_str());
+        return false;
+    }
+    return true;
+}
+
+// Counts of a daemon consumer, kept across producer jobs and restarts. Blocks are counted into a
+// small delta table; at every snapshot the delta is written as consumer_delta_<id>_<seq>.run, folded
+// into the totals, and the totals are written as consumer_snapshot_<id>.run stamped with the same
+// seq. Each file goes through a temporary file, fsync and rename, so after a crash it is either the
+// previous complete version or the new one. On restart the snapshot is loaded and any newer delta
+// (written just before a crash, ahead of its snapshot) folded in; a crash loses at most the counts
+// of the interval in progress.
+class CountSnapshots {
+public:
+    CountSnapshots(const string& consumer_id, const JobNames& job) : consumer_id_(consumer_id), job_(job) {}
+
+    // Returns false (after reporting) if an existing snapshot or delta cannot be read
+    bool load() {
+        string snapshot = job_.path(snapshot_run_name(consumer_id_));
+        if (access(snapshot.c_str(), F_OK) == 0) {
+            if (!load_run(snapshot, sequence_))
+                return false;
+        }
+        vector<pair<uint64_t, string>> newer;
+        if (DIR* dir = opendir(job_.dir.c_str())) {
+            while (struct dirent* entry = readdir(dir)) {
+                string id;
+                uint64_t sequence = 0;
+                if (parse_delta_run_name(entry->d_name, id, sequence) && id == consumer_id_ && sequence > sequence_)
+                    newer.emplace_back(sequence, job_.path(entry->d_name));
+            }
+            closedir(dir);
+        }
+        sort(newer.begin(), newer.end());
+        for (const pair<uint64_t, string>& delta : newer) {
+            uint64_t sequence = 0;
+            if (!load_run(delta.second, sequence))
+                return false;
+            sequence_ = delta.first;
+        }
+        if (sequence_ > 0)
+            cout << "Consumer (ID: " << consumer_id_ << "): Resumed from snapshot " << sequence_ << " (" << totals_.size()
+                 << " unique words, " << total_words_ << " words)." << endl;
+        return true;
+    }
+
+    WordCountTable& delta() { return delta_; }
+    uint64_t sequence() const { return sequence_; }
+
+    // Writes the delta, then the new snapshot. Nothing happens while the delta is empty.
+    // Returns false (after reporting) on a write error; the delta is then kept for the next try.
+    bool write() {
+        if (delta_.empty())
+            return true;
+        uint64_t sequence = sequence_ + 1;
+        if (!write_replacing(job_.path(delta_run_name(consumer_id_, sequence)), delta_, sequence))
+            return false;
+        delta_.for_each([&](const WordCountTable::Entry& entry) {
+            totals_.add(entry.key, entry.length, entry.count);
+            total_words_ += entry.count;
+        });
+        delta_ = WordCountTable();
+        sequence_ = sequence;
+        // A failed snapshot is covered by the delta just written; the next one catches up
+        if (!write_replacing(job_.path(snapshot_run_name(consumer_id_)), totals_, sequence))
+            return false;
+        cout << "Consumer (ID: " << consumer_id_ << "): Snapshot " << sequence << " written (" << totals_.size()
+             << " unique words, " << total_words_ << " words)." << endl;
+        return true;
+    }
+
+private:
+    bool load_run(const string& filename, uint64_t& sequence) {
+        CountRunReader reader;
+        if (!reader.open(filename.c_str()) || reader.order() != RUN_ORDER_WORD) {
+            cerr << "Consumer (ID: " << consumer_id_ << "): Cannot load " << filename << ": "
+                 << (reader.failed() ? reader.error() : string("not sorted by word")) << endl;
+            return false;
+        }
+        sequence = reader.sequence();
+        const char* word;
+        uint8_t length;
+        uint64_t count;
+        while (reader.next(word, length, count)) {
+            totals_.add(word, length, count);
+            total_words_ += count;
+        }
+        if (reader.failed()) {
+            cerr << "Consumer (ID: " << consumer_id_ << "): Cannot load " << filename << ": " << reader.error() << endl;
+            return false;
+        }
+        return true;
+    }
+
+    bool write_replacing(const string& filename, const WordCountTable& table, uint64_t sequence) {
+        string tmp = filename + ".tmp";
+        if (!write_word_run(tmp, table, sequence, true) || !replace_file(tmp, filename)) {
+            perror(("Consumer (ID: " + consumer_id_ + "): Failed to write " + filename).c_str());
+            unlink(tmp.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    string consumer_id_;
+    JobNames job_;
+    WordCountTable totals_;
+    WordCountTable delta_;
+    uint64_t total_words_ = 0;
+    uint64_t sequence_ = 0; // Sequence of the newest snapshot or delta folded into totals_
+};
+
 int main(int argc, char* argv[]) {
-    if (argc < 3) { // Expects 2 arguments
-        cerr << "Usage: " << argv[0] << " <total_expected_producers> <consumer_id>" << endl;
+    bool binary_output = false;
+    bool bench_mode = false;  // No simulated work and no per-word logging
+    string latency_file;      // Where to dump per-block handoff latencies, if anywhere
+    bool daemon_mode = false; // Stay attached across jobs and keep snapshots instead of one output file
+    double snapshot_interval = DEFAULT_SNAPSHOT_INTERVAL;
+    uint32_t sketch_counters = 0; // With --approx, count into a fixed-size sketch instead of the exact table
+    uint32_t hll_precision = DEFAULT_HLL_PRECISION;
+    vector<int> cpus; // With --cpus, run only on these CPUs and keep this partition's ring on their node
+
+    static const struct option long_options[] = {
+        {"output", required_argument, nullptr, 'o'},
+        {"bench", no_argument, nullptr, 'b'},
+        {"latency-file", required_argument, nullptr, 'l'},
+        {"daemon", no_argument, nullptr, 'D'},
+        {"snapshot-interval", required_argument, nullptr, 'i'},
+        {"approx", optional_argument, nullptr, 'a'},
+        {"hll-precision", required_argument, nullptr, 'H'},
+        {"cpus", required_argument, nullptr, 'C'},
+        {"job", required_argument, nullptr, 'j'},
+        {nullptr, 0, nullptr, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "o:", long_options, nullptr)) != -1) {
+        switch (opt) {
+        case 'o':
+            if (string(optarg) == "binary") {
+                binary_output = true;
+            } else if (string(optarg) != "text") {
+                cerr << "Error: unknown output format '" << optarg << "'." << endl;
+                return 1;
+            }
+            break;
+        case 'b':
+            bench_mode = true;
+            break;
+        case 'l':
+            latency_file = optarg;
+            break;
+        case 'D':
+            daemon_mode = true;
+            break;
+        case 'i': {
+            char* end = nullptr;
+            snapshot_interval = strtod(optarg, &end);
+            if (end == optarg || *end != '\0' || !(snapshot_interval > 0) || snapshot_interval > 86400) {
+                cerr << "Error: --snapshot-interval must be between 0 and 86400 seconds." << endl;
+                return 1;
+            }
+            break;
+        }
+        case 'a': {
+            sketch_counters = DEFAULT_SKETCH_COUNTERS;
+            char* end = nullptr;
+            unsigned long value = optarg ? strtoul(optarg, &end, 10) : sketch_counters;
+            if (optarg && (end == optarg || *end != '\0' || value < MIN_SKETCH_COUNTERS || value > MAX_SKETCH_COUNTERS)) {
+                cerr << "Error: --approx must be between " << MIN_SKETCH_COUNTERS << " and " << MAX_SKETCH_COUNTERS << " counters." << endl;
+                return 1;
+            }
+            sketch_counters = (uint32_t)value;
+            break;
+        }
+        case 'H': {
+            char* end = nullptr;
+            unsigned long value = strtoul(optarg, &end, 10);
+            if (end == optarg || *end != '\0' || value < MIN_HLL_PRECISION || value > MAX_HLL_PRECISION) {
+                cerr << "Error: --hll-precision must be between " << MIN_HLL_PRECISION << " and " << MAX_HLL_PRECISION << "." << endl;
+                return 1;
+            }
+            hll_precision = (uint32_t)value;
+            break;
+        }
+        case 'C':
+            if (!parse_cpu_list(optarg, cpus)) {
+                cerr << "Error: --cpus expects a CPU list such as 0-3,8." << endl;
+                return 1;
+            }
+            break;
+        case 'j':
+            if (!valid_job_id(optarg)) {
+                cerr << "Error: --job expects an ID of up to " << MAX_JOB_ID_LENGTH << " letters, digits, '_' or '-'." << endl;
+                return 1;
+            }
+            job = JobNames(optarg);
+            break;
+        default:
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (sketch_counters && (daemon_mode || binary_output)) {
+        cerr << "Error: --approx writes a sketch; it cannot be combined with --daemon or --output binary." << endl;
+        return 1;
+    }
+    if (argc - optind != (daemon_mode ? 1 : 2)) { // A daemon waits for no particular number of producers
+        print_usage(argv[0]);
         return 1;
     }
-    int total_expected_producers = atoi(argv[1]);
-    if (total_expected_producers <= 0) {
+    int total_expected_producers = daemon_mode ? 0 : atoi(argv[optind]);
+    if (!daemon_mode && total_expected_producers <= 0) {
         cerr << "Error: total_expected_producers must be a positive integer." << endl;
         return 1;
     }
-    string consumer_id = argv[2]; // Unique ID for this consumer
+    string consumer_id = argv[argc - 1]; // Unique ID for this consumer
 
-    cout << "Word Consumer Process Started (ID: " << consumer_id << "). Expecting EOFs from " << total_expected_producers << " producers." << endl;
+    if (daemon_mode)
+        cout << "Word Consumer Process Started (ID: " << consumer_id << ") as a daemon, snapshotting every " << snapshot_interval << " s." << endl;
+    else
+        cout << "Word Consumer Process Started (ID: " << consumer_id << "). Waiting for " << total_expected_producers << " producers." << endl;
+    if (!job.id.empty())
+        cout << "Consumer (ID: " << consumer_id << "): Job " << job.id << "; writing to " << job.dir << "/." << endl;
 
-    // Register signal handler for graceful shutdown
-    if (signal(SIGINT, signal_handler) == SIG_ERR) {
+    // Register signal handler for graceful shutdown; a daemon is usually stopped with SIGTERM
+    if (signal(SIGINT, signal_handler) == SIG_ERR || (daemon_mode && signal(SIGTERM, signal_handler) == SIG_ERR)) {
         perror("Consumer: signal failed");
         return 1;
     }
 
+    if (!cpus.empty() && !pin_to_cpus(cpus)) {
+        perror("Consumer: sched_setaffinity failed");
+        return 1;
+    }
+
+    if (!job.make_dir()) {
+        perror(("Consumer: Cannot create the job directory " + job.dir).c_str());
+        return 1;
+    }
+
+    unique_ptr<CountSnapshots> snapshots;
+    if (daemon_mode) {
+        snapshots.reset(new CountSnapshots(consumer_id, job));
+        if (!snapshots->load())
+            return 1;
+    }
+
     int shm_fd = -1;
     SharedWordBuffer* wordBuffer = (SharedWordBuffer*) MAP_FAILED;
-    sem_t* sem_empty = SEM_FAILED;
-    sem_t* sem_full = SEM_FAILED;
-    sem_t* sem_mutex = SEM_FAILED;
-    unordered_map<string, int> wordCounts; // Map to store word frequencies (local to this consumer)
-    int words_processed = 0;
-
-    // Open Shared Memory
-    shm_fd = shm_open(SHARED_MEM_NAME, O_RDWR, 0666);
+    QueueSemaphores sems; // This consumer's partition only, semaphore queue only
+    WordCountTable wordCounts; // Word frequencies local to this consumer
+    uint64_t words_processed = 0;
+    uint64_t blocks_processed = 0;
+    vector<uint64_t> latencies; // Nanoseconds from publish to pickup, one per word block
+
+    // Open Shared Memory; a daemon may start before the first producer creates it. A segment
+    // that no running process holds is left over from an earlier job and is removed, not joined.
+    string shm_name = job.ipc(SHARED_MEM_NAME);
+    bool reclaimed = false;
+    shm_fd = attach_job_segment(shm_name, O_RDWR, reclaimed);
+    if (reclaimed)
+        cout << "Consumer (ID: " << consumer_id << "): Removed the shared word buffer of an earlier job that finished or crashed." << endl;
+    if (shm_fd == -1 && errno == ENOENT && daemon_mode) {
+        cout << "Consumer (ID: " << consumer_id << "): Waiting for a producer to create shared memory..." << endl;
+        while (shm_fd == -1 && errno == ENOENT && running.load()) {
+            usleep(100000);
+            shm_fd = attach_job_segment(shm_name, O_RDWR, reclaimed);
+        }
+        if (!running.load())
+            return cleanUp(shm_fd, wordBuffer, sems);
+    }
     if (shm_fd == -1) {
         perror("Consumer: shm_open failed");
         cerr << "Consumer: Ensure producer process(es) are running and initialized the shared memory." << endl;
-        return cleanUp(shm_fd, wordBuffer, sem_empty, sem_full, sem_mutex, true);
+        return cleanUp(shm_fd, wordBuffer, sems, true);
     }
 
-    // Map Shared Memory to Process Address Space
-    wordBuffer = (SharedWordBuffer*) mmap(0, sizeof(SharedWordBuffer), PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
-    if (wordBuffer == MAP_FAILED) {
-        perror("Consumer: mmap failed");
-        return cleanUp(shm_fd, wordBuffer, sem_empty, sem_full, sem_mutex, true);
+    // Wait for shared memory to be initialized by a producer, then map all of it
+    cout << "Consumer (ID: " << consumer_id << "): Waiting for shared memory initialization..." << endl;
+    wordBuffer = map_initialized_buffer(shm_fd, running, 1000, mapped_size);
+    if (wordBuffer == MAP_FAILED)
+        return cleanUp(shm_fd, wordBuffer, sems, true);
+    wordBuffer->active_consumers++; // Until cleanUp(); a crash leaves the segment marked stale
+
+    // Attach to the partition selected by the consumer ID: consumer N drains partition (N - 1) mod partition_count
+    uint32_t partition = 0;
+    if (wordBuffer->partition_count > 1) {
+        char* end = nullptr;
+        long numeric_id = strtol(consumer_id.c_str(), &end, 10);
+        if (end == consumer_id.c_str() || *end != '\0' || numeric_id <= 0) {
+            cerr << "Error: with " << wordBuffer->partition_count << " partitions the consumer_id must be a positive integer." << endl;
+            return cleanUp(shm_fd, wordBuffer, sems, true);
+        }
+        partition = (uint32_t)((numeric_id - 1) % wordBuffer->partition_count);
     }
-
-    // Open Semaphores
-    sem_empty = sem_open(SEM_EMPTY_NAME, 0); // Open existing semaphore
-    if (sem_empty == SEM_FAILED) {
-        perror("Consumer: sem_open SEM_EMPTY_NAME failed");
-        cerr << "Consumer: Ensure producer process(es) have created the semaphores." << endl;
-        return cleanUp(shm_fd, wordBuffer, sem_empty, sem_full, sem_mutex, true);
+    Partition& part = wordBuffer->partition(partition);
+
+    // An interned job ships word IDs; the dictionary tells how many there can be and, where a
+    // word is needed (daemon and approximate counting), which word an ID stands for
+    if (wordBuffer->segment_flags & SEGMENT_INTERNED) {
+        string error;
+        dictionary = map_dictionary(job.ipc(DICTIONARY_NAME), false, dictionary_mapped_size, error);
+        if (dictionary == MAP_FAILED) {
+            cerr << "Consumer (ID: " << consumer_id << "): Cannot use the job's dictionary: " << error << endl;
+            return cleanUp(shm_fd, wordBuffer, sems, true);
+        }
+        cout << "Consumer (ID: " << consumer_id << "): Counting interned word IDs." << endl;
     }
 
-    sem_full = sem_open(SEM_FULL_NAME, 0); // Open existing semaphore
-    if (sem_full == SEM_FAILED) {
-        perror("Consumer: sem_open SEM_FULL_NAME failed");
-        return cleanUp(shm_fd, wordBuffer, sem_empty, sem_full, sem_mutex, true);
+    // A pinned consumer keeps its ring on its own node: slot pages nobody has touched yet are
+    // allocated there when first used, and faulting them in now takes that off the hot path
+    if (!cpus.empty()) {
+        int node = current_numa_node();
+        char* slots;
+        uint64_t slots_bytes;
+        partition_slots(part, slots, slots_bytes);
+        bool placed = prefer_node(slots, slots_bytes, node);
+        prefault(slots, slots_bytes);
+        cout << "Consumer (ID: " << consumer_id << "): Pinned to NUMA node " << node << "; ring of partition " << partition
+             << (placed ? " placed on it" : " left where the kernel put it") << " and pre-faulted (" << slots_bytes << " bytes)." << endl;
     }
 
-    sem_mutex = sem_open(SEM_MUTEX_NAME, 0); // Open existing semaphore
-    if (sem_mutex == SEM_FAILED) {
-        perror("Consumer: sem_open SEM_MUTEX_NAME failed");
-        return cleanUp(shm_fd, wordBuffer, sem_empty, sem_full, sem_mutex, true);
+    StatsBlock& sharedStats = wordBuffer->stats();
+    stats = claim_stats_slot(sharedStats.consumer_slots, sharedStats.consumers, &unpublished_stats, getpid());
+
+    bool use_lockfree = wordBuffer->queue_kind.load() == QUEUE_LOCKFREE;
+    cout << "Consumer (ID: " << consumer_id << "): Using the " << queue_kind_name(wordBuffer->queue_kind.load()) << " queue, partition "
+         << partition << " of " << wordBuffer->partition_count << " (" << part.ring.capacity << " blocks of " << part.ring.slot_size << " bytes)." << endl;
+    vector<char> blockCopy(part.ring.slot_size); // The semaphore path copies each block out of its slot
+
+    // Open Semaphores (only the semaphore queue needs them)
+    if (!use_lockfree && !open_queue_semaphores(job, partition, false, 0, sems)) {
+        perror("Consumer: sem_open failed");
+        cerr << "Consumer: Ensure producer process(es) have created the semaphores." << endl;
+        return cleanUp(shm_fd, wordBuffer, sems, true);
     }
 
-    // Wait for shared memory to be initialized by a producer if it's not already
-    cout << "Consumer (ID: " << consumer_id << "): Waiting for shared memory initialization..." << endl;
-    while (running.load() && !wordBuffer->initialized.load()) {
-        sleep(1);
+    // Tell the producers how many of them the job waits for; the first consumer's number wins.
+    // A daemon leaves it unset, so the job stays open while producers come and go.
+    uint32_t expected = 0;
+    if (!daemon_mode && !wordBuffer->expected_producers.compare_exchange_strong(expected, (uint32_t)total_expected_producers)
+        && expected != (uint32_t)total_expected_producers) {
+        cerr << "Consumer (ID: " << consumer_id << "): Warning: another consumer is waiting for " << expected << " producers; using that." << endl;
+    }
+    // If every producer left before any consumer said how many to wait for, nobody else will close the job
+    if (!daemon_mode && job_complete(wordBuffer)) {
+        close_job(wordBuffer);
+        if (!use_lockfree && sem_post(sems.full) == -1)
+            perror("Consumer: sem_post SEM_FULL_NAME failed");
     }
 
-    if (!running.load())
-        return cleanUp(shm_fd, wordBuffer, sem_empty, sem_full, sem_mutex, true);
+    // Approximate mode keeps a fixed-size sketch (heavy hitters plus distinct words) instead of every word
+    unique_ptr<WordSketch> sketch;
+    if (sketch_counters) {
+        sketch.reset(new WordSketch(sketch_counters, hll_precision));
+        sketch->partition = partition;
+        sketch->partition_count = wordBuffer->partition_count;
+        cout << "Consumer (ID: " << consumer_id << "): Approximate counting with " << sketch_counters << " counters and 2^" << hll_precision
+             << " HyperLogLog registers." << endl;
+    }
 
-    // Read and Analyze Words
+    // A daemon counts into the snapshot delta and wakes up at least once per snapshot interval
+    WordCountTable& counts = daemon_mode ? snapshots->delta() : wordCounts;
+    auto count_word = [&](const char* word, uint8_t length, uint64_t count) {
+        if (sketch)
+            sketch->add(word, length, count);
+        else
+            counts.add(word, length, count);
+    };
+    // ID records are counted in a dense array indexed by ID, unless every record needs its word
+    bool resolve_ids = daemon_mode || sketch;
+    vector<uint64_t> id_counts;
+    uint64_t bad_ids = 0; // IDs the dictionary does not hold; never sent by a working producer
+    auto count_id = [&](uint32_t id, uint64_t count) {
+        const char* word;
+        uint8_t length;
+        if (dictionary == MAP_FAILED || id >= dictionary->capacity || (resolve_ids && !dictionary->word(id, word, length))) {
+            bad_ids++;
+            return;
+        }
+        if (resolve_ids) {
+            count_word(word, length, count);
+            return;
+        }
+        if (id >= id_counts.size())
+            id_counts.resize(max<size_t>(id + 1, min<size_t>(2 * id_counts.size(), dictionary->capacity)));
+        id_counts[id] += count;
+    };
+    uint64_t interval_ns = (uint64_t)(snapshot_interval * 1e9);
+    uint64_t next_snapshot = daemon_mode ? monotonic_ns() + interval_ns : 0;
+
+    // Read and Analyze Words until the job is closed and this partition is drained
+    bool drained = false;
     while (running.load()) {
-        // Check if all producers have finished (and sent their EOFs)
-        if (wordBuffer->eof_signals_received.load() >= total_expected_producers && wordBuffer->active_producers_count.load() == 0) {
-            cout << "Consumer (ID: " << consumer_id << "): All producers finished and signaled EOF. Exiting." << endl;
-            running.store(false); // Set running to false to break the loop
-            break;
+        if (daemon_mode && monotonic_ns() >= next_snapshot) {
+            snapshots->write();
+            next_snapshot = monotonic_ns() + interval_ns;
         }
 
-        if (sem_wait(sem_full) == -1) {
-            if (errno == EINTR) {
-                if (!running.load()) 
-                    break; // Signal received, gracefully exit loop
-                continue;
+        const char* blockData;
+        uint64_t claimed_pos = 0;
+        if (use_lockfree) {
+            bool blocked = false;
+            uint64_t start = monotonic_ns();
+            blockData = part.ring.pop_begin(claimed_pos, running, &blocked, next_snapshot); // Read in place, released below
+            if (blocked)
+                stats->record_queue_wait(monotonic_ns() - start);
+            if (!blockData && running.load() && !part.ring.closed.load())
+                continue; // Snapshot due
+            if (!blockData) { // Closed and empty, or interrupted by SIGINT
+                drained = running.load();
+                break;
             }
-            perror("Consumer: sem_wait SEM_FULL_NAME failed");
-            return cleanUp(shm_fd, wordBuffer, sem_empty, sem_full, sem_mutex, true);
+        } else {
+            int status = dequeue_semaphore(part, blockCopy.data(), sems, next_snapshot);
+            if (status == 1) // Interrupted by SIGINT
+                break;
+            if (status == 2) {
+                drained = true;
+                break;
+            }
+            if (status == 3) // Snapshot due
+                continue;
+            if (status == -1)
+                return cleanUp(shm_fd, wordBuffer, sems, true);
+            blockData = blockCopy.data();
         }
 
-        if (sem_wait(sem_mutex) == -1) {
-            if (errno == EINTR) {
-                if (!running.load()) {
-                    sem_post(sem_full); // Release previously acquired sem_full
-                    break;
-                }
+        blocks_processed++;
+        uint64_t occupied = partition_occupancy(part, wordBuffer->queue_kind.load(), use_lockfree ? nullptr : &sems);
+        uint64_t words_before = words_processed;
+        uint64_t published = block_header(blockData)->publish_ns;
+        if (!latency_file.empty() && published)
+            latencies.push_back(monotonic_ns() - published);
+
+        // Drain every word packed into the block
+        BlockReader reader(blockData);
+        const char* word;
+        uint8_t length;
+        uint32_t id;
+        uint64_t count; // Greater than 1 for records pre-aggregated by a combining producer
+        while (reader.ids() && reader.next_id(id, count)) {
+            words_processed += count;
+            count_id(id, count);
+            if (bench_mode)
                 continue;
+            cout << "Consumer (ID: " << consumer_id << "): Read word ID " << id << (count == 1 ? "" : " x " + to_string(count)) << endl;
+            if (running.load()) {
+                usleep(rand() % 70000 + 10000); // Simulate some work (10-80ms)
             }
-            perror("Consumer: sem_wait SEM_MUTEX_NAME failed");
-            sem_post(sem_full); // If mutex fails, release sem_full to avoid deadlock
-            return cleanUp(shm_fd, wordBuffer, sem_empty, sem_full, sem_mutex, true);
-        }
-
-        WordEntry currentEntry = wordBuffer->entries[wordBuffer->tail];
-        wordBuffer->tail = (wordBuffer->tail + 1) % MAX_WORD_ENTRIES;
-
-        if (sem_post(sem_mutex) == -1) {
-            perror("Consumer: sem_post SEM_MUTEX_NAME failed");
-        }
-
-        if (sem_post(sem_empty) == -1) {
-            perror("Consumer: sem_post SEM_EMPTY_NAME failed");
         }
+        while (!reader.ids() && reader.next(word, length, count)) {
+            if (bench_mode) {
+                words_processed += count;
+                count_word(word, length, count);
+                continue;
+            }
+            if (count == 1)
+                cout << "Consumer (ID: " << consumer_id << "): Read word [" << string_view(word, length) << "]" << endl;
+            else
+                cout << "Consumer (ID: " << consumer_id << "): Read word [" << string_view(word, length) << "] x " << count << endl;
+            words_processed += count;
 
-        if (strcmp(currentEntry.word, EOF_SIGNAL_WORD) == 0) {
-            cout << "Consumer (ID: " << consumer_id << "): Received an EOF signal. Current total EOFs received: " << wordBuffer->eof_signals_received.load() + 1 << endl;
-            wordBuffer->eof_signals_received++;
+            // count word frequency, straight from the block bytes
+            count_word(word, length, count);
 
-            // If all expected producers have sent EOFs, we can stop
-            if (wordBuffer->eof_signals_received.load() >= total_expected_producers && wordBuffer->active_producers_count.load() == 0) {
-                cout << "Consumer (ID: " << consumer_id << "): All expected EOFs received and no active producers. Terminating." << endl;
-                running.store(false);
+            if (running.load()) {
+                usleep(rand() % 70000 + 10000); // Simulate some work (10-80ms)
             }
-            continue; // Don't process the EOF word as a regular word
         }
 
-        cout << "Consumer (ID: " << consumer_id << "): Read word [" << currentEntry.word << "]" << endl;
-        words_processed++;
+        stats->record_handoff(words_processed - words_before, block_header(blockData)->bytes_used, occupied, part.ring.capacity);
+        if (use_lockfree)
+            part.ring.pop_end(claimed_pos);
+    }
+    stats->state.store(STATS_SLOT_DONE);
+    if (drained)
+        cout << "Consumer (ID: " << consumer_id << "): All producers finished and the partition is drained." << endl;
+    if (bad_ids > 0)
+        cerr << "Consumer (ID: " << consumer_id << "): Warning: dropped " << bad_ids << " record(s) with an ID the dictionary does not hold." << endl;
 
-        // count word frequency
-        wordCounts[string(currentEntry.word)]++;
+    cout << "Consumer (ID: " << consumer_id << "): Shutting down. Total words processed: " << words_processed << endl;
+    if (bench_mode)
+        cout << "Consumer (ID: " << consumer_id << "): Bench words=" << words_processed << " blocks=" << blocks_processed << endl;
+    if (!latency_file.empty()) {
+        ofstream out(latency_file, ios::binary);
+        out.write(reinterpret_cast<const char*>(latencies.data()), latencies.size() * sizeof(uint64_t));
+        if (!out)
+            perror(("Consumer (ID: " + consumer_id + "): Failed to write " + latency_file).c_str());
+    }
 
-        if (running.load()) {
-            usleep(rand() % 70000 + 10000); // Simulate some work (10-80ms)
-        }
+    if (daemon_mode) { // Everything counted so far goes into one last snapshot
+        bool written = snapshots->write();
+        cout << "Consumer (ID: " << consumer_id << "): Counts are in " << job.path(snapshot_run_name(consumer_id)) << " (snapshot " << snapshots->sequence() << ")." << endl;
+        return cleanUp(shm_fd, wordBuffer, sems, !written);
     }
 
-    cout << "Consumer (ID: " << consumer_id << "): Shutting down. Total words processed: " << words_processed << endl;
+    if (sketch) {
+        string sketch_filename = job.path(sketch_file_name(consumer_id));
+        cout << "Consumer (ID: " << consumer_id << "): Writing the sketch to " << sketch_filename << " (" << sketch->top.size()
+             << " heavy hitters, about " << (uint64_t)sketch->distinct.estimate() << " distinct words)" << endl;
+        bool written = save_sketch(sketch_filename, *sketch);
+        if (!written)
+            perror(("Consumer (ID: " + consumer_id + "): Failed to write " + sketch_filename).c_str());
+        return cleanUp(shm_fd, wordBuffer, sems, !written);
+    }
 
-    // Write local word counts to a unique file ---
-    string output_filename = "consumer_output_" + consumer_id + ".txt";
-    ofstream outfile(output_filename);
-    if (!outfile.is_open()) {
-        perror(("Consumer (ID: " + consumer_id + "): Failed to open output file " + output_filename).c_str());
-    } else {
-        cout << "Consumer (ID: " << consumer_id << "): Writing word counts to " << output_filename << endl;
-        for (const auto& [word, count] : wordCounts) {
-            outfile << word << "\t" << count << endl; // Write word and count, tab-separated
+    // A run is sorted by word, so interned counts are turned back into words for it; text output
+    // leaves them to the aggregator, which sums every consumer's array before looking words up
+    if (binary_output) {
+        for (uint32_t i = 0; i < id_counts.size(); ++i) {
+            const char* word;
+            uint8_t length;
+            if (id_counts[i] && dictionary->word(i, word, length))
+                wordCounts.add(word, length, id_counts[i]);
+        }
+    } else if (dictionary != MAP_FAILED) {
+        string ids_filename = job.path(id_counts_file_name(consumer_id));
+        cout << "Consumer (ID: " << consumer_id << "): Writing counts of " << id_counts.size() << " word IDs to " << ids_filename << endl;
+        if (!write_id_counts(ids_filename, dictionary->nonce, id_counts)) {
+            perror(("Consumer (ID: " + consumer_id + "): Failed to write output file " + ids_filename).c_str());
+            return cleanUp(shm_fd, wordBuffer, sems, true);
         }
-        outfile.close();
     }
-    return cleanUp(shm_fd, wordBuffer, sem_empty, sem_full, sem_mutex);
+
+    // Write local word counts to a unique file ---
+    string output_filename = job.path("consumer_output_" + consumer_id + (binary_output ? ".run" : ".txt"));
+    cout << "Consumer (ID: " << consumer_id << "): Writing word counts to " << output_filename << endl;
+    bool written = binary_output ? write_binary_counts(output_filename, consumer_id, wordCounts)
+                                 : write_text_counts(output_filename, consumer_id, partition, wordBuffer->partition_count, wordCounts);
+    return cleanUp(shm_fd, wordBuffer, sems, !written);
 }
\ No newline at end of file
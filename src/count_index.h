@@ -0,0 +1,382 @@
+#ifndef COUNT_INDEX_H
+#define COUNT_INDEX_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <string_view>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hash.h"
+
+// Binary index of the aggregator's merged counts (aggregated_word_counts.idx next to the report),
+// written once by the aggregator and then only ever mapped read-only:
+//   IndexHeader | records | slots[slot_count] | ranks[ranked_count]
+// Every word is a record, [uint64_t count][uint64_t rank + 1, or 0][uint8_t length][bytes],
+// including the words a --top report leaves out. A slot holds (upper 24 bits of the word's hash,
+// record offset), 0 meaning empty, in a linear-probing table kept at most half full, so a point
+// lookup reads one slot and usually one record: a few pages whatever the vocabulary size. The
+// rank array is the report's view: the offsets of its lines' records, most frequent first.
+
+const char INDEX_MAGIC[8] = {'W', 'C', 'I', 'D', 'X', 0, 0, 1};
+const uint32_t INDEX_VERSION = 1;
+const size_t INDEX_RECORD_HEADER = 2 * sizeof(uint64_t) + 1; // Count, rank + 1, key length
+const uint64_t INDEX_MAX_OFFSET = (uint64_t)1 << 40;       // Record offsets share a slot with a 24-bit tag
+const uint64_t INDEX_UNRANKED = UINT64_MAX;
+
+struct IndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t total_size;   // Size of the whole file in bytes
+    uint64_t word_count;   // Records: every unique word
+    uint64_t ranked_count; // Ranks: one per report line, fewer than word_count for a --top report
+    uint64_t total_words;
+    uint64_t slot_count;   // Power of two, at least twice word_count
+    uint64_t records_offset;
+    uint64_t records_end;
+    uint64_t slots_offset;
+    uint64_t ranks_offset;
+};
+
+// Read-only view of an index file. find() and find_batch() answer straight from the mapping.
+// Records are bound-checked as they are read, so a damaged file gives misses, never stray reads.
+class CountIndex {
+public:
+    CountIndex() = default;
+    CountIndex(const CountIndex&) = delete;
+    CountIndex& operator=(const CountIndex&) = delete;
+    ~CountIndex() { close(); }
+
+    // Returns false (with error() set) if the file cannot be mapped or is not a valid index
+    bool open(const char* path) {
+        close();
+        int fd = ::open(path, O_RDONLY);
+        if (fd == -1) {
+            error_ = strerror(errno);
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == -1 || (uint64_t)st.st_size < sizeof(IndexHeader)) {
+            error_ = "not an index file";
+            ::close(fd);
+            return false;
+        }
+        void* mapping = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED) {
+            error_ = std::string("mmap: ") + strerror(errno);
+            return false;
+        }
+        base_ = static_cast<const char*>(mapping);
+        size_ = st.st_size;
+        const IndexHeader* h = header();
+        if (memcmp(h->magic, INDEX_MAGIC, sizeof(h->magic)) != 0 || h->version != INDEX_VERSION) {
+            error_ = "not an index file, or from another version";
+        } else if (h->total_size != size_ || h->slot_count == 0 || (h->slot_count & (h->slot_count - 1)) != 0
+                   || h->slot_count / 2 < h->word_count || h->ranked_count > h->word_count
+                   || h->records_offset != sizeof(IndexHeader) || h->records_end < h->records_offset || h->records_end > h->slots_offset
+                   || h->slots_offset % sizeof(uint64_t) != 0 || h->slots_offset > size_ || h->slot_count > (size_ - h->slots_offset) / sizeof(uint64_t)
+                   || h->ranks_offset != h->slots_offset + h->slot_count * sizeof(uint64_t)
+                   || h->ranked_count != (size_ - h->ranks_offset) / sizeof(uint64_t) || (size_ - h->ranks_offset) % sizeof(uint64_t) != 0) {
+            error_ = "truncated or inconsistent index";
+        } else {
+            madvise(mapping, size_, MADV_RANDOM); // Point lookups: no readahead
+            return true;
+        }
+        close();
+        return false;
+    }
+
+    void close() {
+        if (base_)
+            munmap(const_cast<char*>(base_), size_);
+        base_ = nullptr;
+        size_ = 0;
+    }
+
+    uint64_t size() const { return header()->ranked_count; } // The report's lines, reachable by rank
+    uint64_t unique_words() const { return header()->word_count; }
+    uint64_t total_words() const { return header()->total_words; }
+    const std::string& error() const { return error_; }
+
+    // The word and count at `rank` (0 is the most frequent); empty and 0 for a damaged record
+    std::string_view word(uint64_t rank) const {
+        Record r;
+        return rank < size() && record(ranks()[rank], r) ? r.word : std::string_view();
+    }
+    uint64_t count(uint64_t rank) const {
+        Record r;
+        return rank < size() && record(ranks()[rank], r) ? r.count : 0;
+    }
+
+    // Looks a word up; false if the index does not hold it. `rank` may be null; it is set to
+    // INDEX_UNRANKED for a word the report leaves out.
+    bool find(std::string_view word, uint64_t& count, uint64_t* rank = nullptr) const {
+        return find_hashed(word, hash_word(word.data(), word.size()), count, rank);
+    }
+
+    // Looks up `n` words at once: every slot is prefetched before the first one is probed, so
+    // the misses overlap. Words not in the index get a count of 0. Returns how many were found.
+    size_t find_batch(const std::string_view* words, size_t n, uint64_t* counts) const {
+        const size_t GROUP = 16;
+        uint64_t hashes[GROUP];
+        size_t found = 0;
+        for (size_t first = 0; first < n; first += GROUP) {
+            size_t group = n - first < GROUP ? n - first : GROUP;
+            for (size_t i = 0; i < group; ++i) {
+                hashes[i] = hash_word(words[first + i].data(), words[first + i].size());
+                __builtin_prefetch(slots() + (hashes[i] & (header()->slot_count - 1)));
+            }
+            for (size_t i = 0; i < group; ++i) {
+                if (find_hashed(words[first + i], hashes[i], counts[first + i], nullptr))
+                    found++;
+                else
+                    counts[first + i] = 0;
+            }
+        }
+        return found;
+    }
+
+private:
+    struct Record {
+        uint64_t count;
+        uint64_t rank; // Rank + 1, 0 if unranked
+        std::string_view word;
+    };
+
+    const IndexHeader* header() const { return reinterpret_cast<const IndexHeader*>(base_); }
+    const uint64_t* slots() const { return reinterpret_cast<const uint64_t*>(base_ + header()->slots_offset); }
+    const uint64_t* ranks() const { return reinterpret_cast<const uint64_t*>(base_ + header()->ranks_offset); }
+
+    // False if the record at `offset` does not lie wholly inside the records section
+    bool record(uint64_t offset, Record& out) const {
+        const IndexHeader* h = header();
+        if (offset < h->records_offset || offset > h->records_end || h->records_end - offset < INDEX_RECORD_HEADER)
+            return false;
+        const char* p = base_ + offset;
+        uint8_t length = (uint8_t)p[2 * sizeof(uint64_t)];
+        if (h->records_end - offset - INDEX_RECORD_HEADER < length)
+            return false;
+        memcpy(&out.count, p, sizeof(uint64_t));
+        memcpy(&out.rank, p + sizeof(uint64_t), sizeof(uint64_t));
+        out.word = std::string_view(p + INDEX_RECORD_HEADER, length);
+        return true;
+    }
+
+    bool find_hashed(std::string_view word, uint64_t hash, uint64_t& count, uint64_t* rank) const {
+        uint64_t tag = hash >> 40;
+        uint64_t mask = header()->slot_count - 1;
+        for (uint64_t probe = 0, i = hash & mask; probe <= mask; ++probe, i = (i + 1) & mask) { // Bounded: a damaged table may have no empty slot
+            uint64_t slot = slots()[i];
+            if (slot == 0)
+                return false;
+            if (slot >> 40 != tag)
+                continue;
+            Record r;
+            if (record(slot & (INDEX_MAX_OFFSET - 1), r) && r.word == word) {
+                count = r.count;
+                if (rank)
+                    *rank = r.rank ? r.rank - 1 : INDEX_UNRANKED;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    const char* base_ = nullptr;
+    uint64_t size_ = 0;
+    std::string error_;
+};
+
+// Writes an index from the merged counts as the aggregator produces them, so it holds every word
+// however few lines the report keeps. add() appends each word's record to the new file; seal()
+// (called by the first rank() or by finish()) grows the file by the slot table and rank array,
+// maps it shared and hashes every record; rank() then gives a word the next rank, in report
+// order. Words the merge already emits in report order can instead be added ranked, before any
+// other. finish() writes the header and renames the file into place. Memory use does not grow
+// with the vocabulary. Every call returns false (with error() set) once something fails.
+class CountIndexWriter {
+public:
+    CountIndexWriter() = default;
+    CountIndexWriter(const CountIndexWriter&) = delete;
+    CountIndexWriter& operator=(const CountIndexWriter&) = delete;
+    ~CountIndexWriter() { abandon(); }
+
+    bool open(const std::string& index_path) {
+        abandon();
+        path_ = index_path;
+        tmp_path_ = index_path + ".tmp";
+        file_ = fopen(tmp_path_.c_str(), "w+b");
+        IndexHeader h;
+        memset(&h, 0, sizeof(h)); // Written for real by finish()
+        if (!file_ || fwrite(&h, sizeof(h), 1, file_) != 1)
+            return fail(tmp_path_);
+        records_end_ = sizeof(IndexHeader);
+        return true;
+    }
+
+    bool add(std::string_view word, uint64_t count, bool ranked = false) {
+        if (!file_ || base_)
+            return fail("add() after seal()", false);
+        if (ranked && ranked_ != word_count_)
+            return fail("ranked words must be added before all others", false);
+        if (word.size() > UINT8_MAX)
+            return fail("word longer than 255 bytes", false);
+        char record[INDEX_RECORD_HEADER];
+        uint64_t rank = ranked ? ranked_ + 1 : 0;
+        memcpy(record, &count, sizeof(uint64_t));
+        memcpy(record + sizeof(uint64_t), &rank, sizeof(uint64_t));
+        record[2 * sizeof(uint64_t)] = (char)word.size();
+        if (fwrite(record, sizeof(record), 1, file_) != 1 || fwrite(word.data(), 1, word.size(), file_) != word.size())
+            return fail(tmp_path_);
+        records_end_ += INDEX_RECORD_HEADER + word.size();
+        word_count_++;
+        if (ranked)
+            ranked_++;
+        return true;
+    }
+
+    bool seal() {
+        if (base_)
+            return true;
+        if (!file_ || fflush(file_) != 0)
+            return fail(tmp_path_);
+        if (records_end_ >= INDEX_MAX_OFFSET)
+            return fail("too many words for one index", false);
+        slot_count_ = 1;
+        while (slot_count_ < 2 * word_count_)
+            slot_count_ *= 2;
+        slots_offset_ = (records_end_ + sizeof(uint64_t) - 1) / sizeof(uint64_t) * sizeof(uint64_t);
+        ranks_offset_ = slots_offset_ + slot_count_ * sizeof(uint64_t);
+        mapped_size_ = ranks_offset_ + word_count_ * sizeof(uint64_t);
+        void* mapping;
+        if (ftruncate(fileno(file_), mapped_size_) == -1
+            || (mapping = mmap(0, mapped_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(file_), 0)) == MAP_FAILED)
+            return fail(tmp_path_);
+        base_ = static_cast<char*>(mapping);
+
+        // The slots and ranks are zero-filled by ftruncate
+        uint64_t* ranks = this->ranks();
+        for (uint64_t offset = sizeof(IndexHeader); offset < records_end_;) {
+            const char* p = base_ + offset;
+            uint8_t length = (uint8_t)p[2 * sizeof(uint64_t)];
+            uint64_t rank;
+            memcpy(&rank, p + sizeof(uint64_t), sizeof(uint64_t));
+            if (rank)
+                ranks[rank - 1] = offset;
+            uint64_t hash = hash_word(p + INDEX_RECORD_HEADER, length);
+            uint64_t i = hash & (slot_count_ - 1);
+            while (slots()[i])
+                i = (i + 1) & (slot_count_ - 1);
+            slots()[i] = ((hash >> 40) << 40) | offset;
+            offset += INDEX_RECORD_HEADER + length;
+        }
+        return true;
+    }
+
+    // Gives an added word the next rank; false if it was never added or is already ranked
+    bool rank(std::string_view word) {
+        if (!seal())
+            return false;
+        uint64_t hash = hash_word(word.data(), word.size());
+        for (uint64_t i = hash & (slot_count_ - 1); slots()[i]; i = (i + 1) & (slot_count_ - 1)) {
+            uint64_t slot = slots()[i];
+            uint64_t offset = slot & (INDEX_MAX_OFFSET - 1);
+            char* p = base_ + offset;
+            if (slot >> 40 != hash >> 40 || std::string_view(p + INDEX_RECORD_HEADER, (uint8_t)p[2 * sizeof(uint64_t)]) != word)
+                continue;
+            uint64_t rank;
+            memcpy(&rank, p + sizeof(uint64_t), sizeof(uint64_t));
+            if (rank)
+                break;
+            rank = ranked_ + 1;
+            memcpy(p + sizeof(uint64_t), &rank, sizeof(uint64_t));
+            ranks()[ranked_++] = offset;
+            return true;
+        }
+        return fail("ranked word \"" + std::string(word) + "\" is not indexed or already ranked", false);
+    }
+
+    bool finish(uint64_t total_words) {
+        if (!seal())
+            return false;
+        IndexHeader h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, INDEX_MAGIC, sizeof(h.magic));
+        h.version = INDEX_VERSION;
+        h.word_count = word_count_;
+        h.ranked_count = ranked_;
+        h.total_words = total_words;
+        h.slot_count = slot_count_;
+        h.records_offset = sizeof(IndexHeader);
+        h.records_end = records_end_;
+        h.slots_offset = slots_offset_;
+        h.ranks_offset = ranks_offset_;
+        h.total_size = ranks_offset_ + ranked_ * sizeof(uint64_t); // Ranks never given are cut off
+        memcpy(base_, &h, sizeof(h));
+        bool unmapped = munmap(base_, mapped_size_) == 0;
+        base_ = nullptr;
+        if (!unmapped || ftruncate(fileno(file_), h.total_size) == -1)
+            return fail(tmp_path_);
+        int closed = fclose(file_);
+        file_ = nullptr;
+        if (closed != 0 || rename(tmp_path_.c_str(), path_.c_str()) == -1)
+            return fail(path_);
+        return true;
+    }
+
+    // Drops a half-written index
+    void abandon() {
+        if (base_)
+            munmap(base_, mapped_size_);
+        if (file_) {
+            fclose(file_);
+            unlink(tmp_path_.c_str());
+        }
+        base_ = nullptr;
+        file_ = nullptr;
+    }
+
+    const std::string& error() const { return error_; }
+
+private:
+    uint64_t* slots() { return reinterpret_cast<uint64_t*>(base_ + slots_offset_); }
+    uint64_t* ranks() { return reinterpret_cast<uint64_t*>(base_ + ranks_offset_); }
+
+    bool fail(const std::string& what, bool with_errno = true) {
+        if (error_.empty())
+            error_ = with_errno ? what + ": " + strerror(errno) : what;
+        abandon();
+        return false;
+    }
+
+    std::string path_;
+    std::string tmp_path_;
+    std::string error_;
+    FILE* file_ = nullptr;
+    char* base_ = nullptr;
+    uint64_t mapped_size_ = 0;
+    uint64_t word_count_ = 0;
+    uint64_t ranked_ = 0;
+    uint64_t records_end_ = 0;
+    uint64_t slot_count_ = 0;
+    uint64_t slots_offset_ = 0;
+    uint64_t ranks_offset_ = 0;
+};
+
+// The index kept next to a report: aggregated_word_counts.txt -> aggregated_word_counts.idx
+inline std::string count_index_path(const std::string& report_path) {
+    size_t dot = report_path.rfind('.');
+    size_t slash = report_path.rfind('/');
+    bool has_extension = dot != std::string::npos && (slash == std::string::npos || dot > slash);
+    return (has_extension ? report_path.substr(0, dot) : report_path) + ".idx";
+}
+
+#endif
@@ -0,0 +1,308 @@
+#ifndef COUNT_RUN_H
+#define COUNT_RUN_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "word_block.h"
+
+// A count run is a binary file of (word, count) records, written in one sorted pass:
+//   RunHeader | [uint8_t length][bytes][varint count] ... | RunFooter
+// Consumers write runs sorted by word (bytewise), which is what the aggregator's k-way merge needs;
+// the aggregator's own spills of the final report are sorted in count_order instead.
+// The footer repeats the record count and the sum of all counts and carries an FNV-1a checksum
+// of the record bytes, so a truncated or corrupt run is rejected instead of silently merged.
+// Daemon consumers also use runs for their snapshots and deltas; the header's sequence number
+// says which snapshot interval a run belongs to.
+
+const char RUN_MAGIC[8] = {'W', 'C', 'R', 'U', 'N', 0, 0, 1};
+const char RUN_END_MAGIC[8] = {'W', 'C', 'E', 'N', 'D', 0, 0, 1};
+const uint32_t RUN_VERSION = 1;
+const size_t MAX_RUN_RECORD = 1 + 255 + MAX_VARINT_BYTES;
+
+enum RunOrder : uint32_t {
+    RUN_ORDER_WORD = 0, // Ascending bytewise by word; no word appears twice
+    RUN_ORDER_COUNT = 1 // count_order: count descending, ties by word
+};
+
+struct RunHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t order;    // RunOrder
+    uint64_t sequence; // Snapshot/delta number for daemon consumers, 0 otherwise
+};
+
+struct RunFooter {
+    uint64_t record_count;
+    uint64_t total_count; // Sum of the record counts
+    uint64_t checksum;    // FNV-1a over the record bytes
+    char magic[8];
+};
+
+const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ull;
+
+inline uint64_t fnv1a(uint64_t hash, const char* data, size_t length) {
+    for (size_t i = 0; i < length; ++i)
+        hash = (hash ^ (unsigned char)data[i]) * 1099511628211ull;
+    return hash;
+}
+
+// Buffered writer. Every failing call returns false with errno set.
+class CountRunWriter {
+public:
+    explicit CountRunWriter(size_t buffer_size = 1 << 20) : buffer_(buffer_size < 4096 ? 4096 : buffer_size) {}
+    CountRunWriter(const CountRunWriter&) = delete;
+    CountRunWriter& operator=(const CountRunWriter&) = delete;
+    ~CountRunWriter() {
+        if (fd_ != -1)
+            ::close(fd_);
+    }
+
+    bool open(const char* path, uint32_t order, uint64_t sequence = 0) {
+        fd_ = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (fd_ == -1)
+            return false;
+        RunHeader header;
+        memcpy(header.magic, RUN_MAGIC, sizeof(header.magic));
+        header.version = RUN_VERSION;
+        header.order = order;
+        header.sequence = sequence;
+        memcpy(buffer_.data(), &header, sizeof(header));
+        used_ = sizeof(header);
+        footer_ = RunFooter{0, 0, FNV_OFFSET_BASIS, {}};
+        return true;
+    }
+
+    bool add(const char* word, uint8_t length, uint64_t count) {
+        if (used_ + MAX_RUN_RECORD > buffer_.size() && !flush())
+            return false;
+        char* record = buffer_.data() + used_;
+        record[0] = (char)length;
+        memcpy(record + 1, word, length);
+        char* end = put_varint(record + 1 + length, count);
+        footer_.checksum = fnv1a(footer_.checksum, record, end - record);
+        footer_.record_count++;
+        footer_.total_count += count;
+        used_ = end - buffer_.data();
+        return true;
+    }
+
+    // Writes the footer and closes the file. With `durable` the data is fsync'ed first, so a
+    // rename that follows can never expose a file whose contents did not reach the disk.
+    bool finish(bool durable = false) {
+        memcpy(footer_.magic, RUN_END_MAGIC, sizeof(footer_.magic));
+        if (used_ + sizeof(footer_) > buffer_.size() && !flush())
+            return false;
+        memcpy(buffer_.data() + used_, &footer_, sizeof(footer_));
+        used_ += sizeof(footer_);
+        bool ok = flush() && (!durable || fsync(fd_) == 0);
+        int close_result = ::close(fd_);
+        fd_ = -1;
+        return ok && close_result == 0;
+    }
+
+    uint64_t record_count() const { return footer_.record_count; }
+
+private:
+    bool flush() {
+        size_t done = 0;
+        while (done < used_) {
+            ssize_t written = ::write(fd_, buffer_.data() + done, used_ - done);
+            if (written == -1) {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            done += written;
+        }
+        used_ = 0;
+        return true;
+    }
+
+    std::vector<char> buffer_;
+    size_t used_ = 0;
+    int fd_ = -1;
+    RunFooter footer_{};
+};
+
+// Files a daemon consumer keeps up to date (consumer --daemon) and the aggregator folds (--deltas)
+inline std::string snapshot_run_name(const std::string& consumer_id) {
+    return "consumer_snapshot_" + consumer_id + ".run";
+}
+
+inline std::string delta_run_name(const std::string& consumer_id, uint64_t sequence) {
+    return "consumer_delta_" + consumer_id + "_" + std::to_string(sequence) + ".run";
+}
+
+// Splits a delta run's file name back into consumer ID and sequence; false for any other name
+inline bool parse_delta_run_name(const std::string& name, std::string& consumer_id, uint64_t& sequence) {
+    const std::string prefix = "consumer_delta_", suffix = ".run";
+    if (name.size() <= prefix.size() + suffix.size() || name.compare(0, prefix.size(), prefix) != 0
+        || name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0)
+        return false;
+    std::string stem = name.substr(prefix.size(), name.size() - prefix.size() - suffix.size());
+    size_t underscore = stem.rfind('_');
+    if (underscore == std::string::npos || underscore == 0 || underscore + 1 == stem.size())
+        return false;
+    char* end = nullptr;
+    sequence = strtoull(stem.c_str() + underscore + 1, &end, 10);
+    if (*end != '\0' || !isdigit((unsigned char)stem[underscore + 1]))
+        return false;
+    consumer_id = stem.substr(0, underscore);
+    return true;
+}
+
+// Atomically replaces `path` with the fully written (and fsync'ed) `tmp_path`, then syncs the
+// directory so the rename itself survives a crash. Returns false with errno set.
+inline bool replace_file(const std::string& tmp_path, const std::string& path) {
+    if (rename(tmp_path.c_str(), path.c_str()) == -1)
+        return false;
+    size_t slash = path.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd == -1)
+        return false;
+    int result = fsync(fd);
+    ::close(fd);
+    return result == 0;
+}
+
+// Streams a run through a fixed-size buffer, so memory use does not depend on the run's size.
+// The footer is read up front; the record count and checksum are verified when the last record
+// has been read. On failure error() describes the problem.
+class CountRunReader {
+public:
+    explicit CountRunReader(size_t buffer_size = 256 << 10)
+        : buffer_(buffer_size < 2 * MAX_RUN_RECORD ? 2 * MAX_RUN_RECORD : buffer_size) {}
+    CountRunReader(const CountRunReader&) = delete;
+    CountRunReader& operator=(const CountRunReader&) = delete;
+    ~CountRunReader() { close(); }
+
+    bool open(const char* path) {
+        close();
+        fd_ = ::open(path, O_RDONLY);
+        if (fd_ == -1)
+            return fail(std::string("open: ") + strerror(errno));
+        struct stat st;
+        if (fstat(fd_, &st) == -1)
+            return fail(std::string("fstat: ") + strerror(errno));
+        if ((size_t)st.st_size < sizeof(RunHeader) + sizeof(RunFooter))
+            return fail("file too short to be a count run");
+        if (!read_exact(&header_, sizeof(header_), 0) || !read_exact(&footer_, sizeof(footer_), st.st_size - sizeof(footer_)))
+            return false;
+        if (memcmp(header_.magic, RUN_MAGIC, sizeof(RUN_MAGIC)) != 0 || header_.version != RUN_VERSION)
+            return fail("not a count run (bad header)");
+        if (memcmp(footer_.magic, RUN_END_MAGIC, sizeof(RUN_END_MAGIC)) != 0)
+            return fail("incomplete count run (bad footer)");
+        offset_ = sizeof(RunHeader);
+        data_end_ = st.st_size - sizeof(RunFooter);
+        pos_ = end_ = 0;
+        records_read_ = 0;
+        checksum_ = FNV_OFFSET_BASIS;
+        return true;
+    }
+
+    void close() {
+        if (fd_ != -1)
+            ::close(fd_);
+        fd_ = -1;
+    }
+
+    // `word` stays valid until the next call. Returns false at the end of the run or on error.
+    bool next(const char*& word, uint8_t& length, uint64_t& count) {
+        if (fd_ == -1)
+            return false;
+        if (end_ - pos_ < MAX_RUN_RECORD && offset_ < data_end_ && !refill())
+            return false;
+        if (pos_ == end_) {
+            if (records_read_ != footer_.record_count || checksum_ != footer_.checksum)
+                return fail("checksum or record count mismatch");
+            close();
+            return false;
+        }
+        const char* record = buffer_.data() + pos_;
+        length = (uint8_t)record[0];
+        if (pos_ + 1 + length >= end_)
+            return fail("truncated record");
+        word = record + 1;
+        const char* varint = word + length;
+        const char* limit = buffer_.data() + end_;
+        const char* stop = varint;
+        while (stop < limit && stop - varint < (ptrdiff_t)MAX_VARINT_BYTES && (*stop & 0x80))
+            ++stop;
+        if (stop == limit || stop - varint == (ptrdiff_t)MAX_VARINT_BYTES)
+            return fail("truncated record");
+        const char* record_end = get_varint(varint, count);
+        checksum_ = fnv1a(checksum_, record, record_end - record);
+        records_read_++;
+        pos_ = record_end - buffer_.data();
+        return true;
+    }
+
+    uint32_t order() const { return header_.order; }
+    uint64_t sequence() const { return header_.sequence; }
+    const RunFooter& footer() const { return footer_; }
+    bool failed() const { return !error_.empty(); }
+    const std::string& error() const { return error_; }
+
+private:
+    bool fail(const std::string& message) {
+        error_ = message;
+        close();
+        return false;
+    }
+
+    bool read_exact(void* out, size_t bytes, off_t at) {
+        size_t done = 0;
+        while (done < bytes) {
+            ssize_t got = pread(fd_, static_cast<char*>(out) + done, bytes - done, at + done);
+            if (got == -1 && errno == EINTR)
+                continue;
+            if (got == -1)
+                return fail(std::string("read: ") + strerror(errno));
+            if (got == 0)
+                return fail("unexpected end of file");
+            done += got;
+        }
+        return true;
+    }
+
+    // Moves the unread tail to the front of the buffer and tops it up from the file
+    bool refill() {
+        size_t remaining = end_ - pos_;
+        memmove(buffer_.data(), buffer_.data() + pos_, remaining);
+        pos_ = 0;
+        end_ = remaining;
+        size_t want = buffer_.size() - end_;
+        if (want > data_end_ - offset_)
+            want = data_end_ - offset_;
+        if (!read_exact(buffer_.data() + end_, want, offset_))
+            return false;
+        offset_ += want;
+        end_ += want;
+        return true;
+    }
+
+    std::vector<char> buffer_;
+    size_t pos_ = 0, end_ = 0; // Unread bytes are buffer_[pos_, end_)
+    uint64_t offset_ = 0;      // File offset of the next byte to buffer
+    uint64_t data_end_ = 0;    // File offset where the footer starts
+    int fd_ = -1;
+    RunHeader header_{};
+    RunFooter footer_{};
+    uint64_t records_read_ = 0;
+    uint64_t checksum_ = FNV_OFFSET_BASIS;
+    std::string error_;
+};
+
+#endif
@@ -0,0 +1,379 @@
+#ifndef DECOMPRESS_H
+#define DECOMPRESS_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef WC_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef WC_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "tokenizer.h"
+
+// Compressed input for the producer: a decoder thread inflates the file into two chunk buffers
+// while the tokenizer works through the other one, so decoding and tokenizing overlap and no
+// decompressed copy ever touches the disk. gzip needs zlib (make ZLIB=1, the default), zstd needs
+// libzstd (make ZSTD=1).
+
+const size_t DECOMPRESS_CHUNK_SIZE = 4 << 20; // Decompressed bytes per buffer
+const size_t COMPRESSED_READ_SIZE = 256 << 10;
+
+enum Compression {
+    COMPRESSION_NONE,
+    COMPRESSION_GZIP,
+    COMPRESSION_ZSTD
+};
+
+inline const char* compression_name(Compression kind) {
+    return kind == COMPRESSION_GZIP ? "gzip" : kind == COMPRESSION_ZSTD ? "zstd" : "none";
+}
+
+// Recognizes compressed files by their magic bytes, not their names
+inline Compression detect_compression(const char* path) {
+    unsigned char magic[4] = {0, 0, 0, 0};
+    int fd = ::open(path, O_RDONLY);
+    if (fd == -1)
+        return COMPRESSION_NONE; // Opening it for real reports the error
+    ssize_t got = pread(fd, magic, sizeof(magic), 0);
+    ::close(fd);
+    if (got >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+        return COMPRESSION_GZIP;
+    if (got == 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd)
+        return COMPRESSION_ZSTD;
+    return COMPRESSION_NONE;
+}
+
+inline bool compression_supported(Compression kind) {
+#ifndef WC_HAVE_ZLIB
+    if (kind == COMPRESSION_GZIP)
+        return false;
+#endif
+#ifndef WC_HAVE_ZSTD
+    if (kind == COMPRESSION_ZSTD)
+        return false;
+#endif
+    return true;
+}
+
+// Streaming decoder over a file descriptor. read() returns decompressed bytes, 0 at the end of
+// the input, -1 on error (error() says why).
+class Decoder {
+public:
+    virtual ~Decoder() = default;
+    virtual ssize_t read(char* out, size_t capacity) = 0;
+    const std::string& error() const { return error_; }
+    uint64_t compressed_bytes() const { return compressed_bytes_; }
+
+protected:
+    // Reads the next piece of compressed input; false at the end of the file or on error
+    bool fill(int fd, std::vector<char>& in, size_t& in_size) {
+        for (;;) {
+            ssize_t got = ::read(fd, in.data(), in.size());
+            if (got == -1 && errno == EINTR)
+                continue;
+            if (got == -1)
+                error_ = std::string("read: ") + strerror(errno);
+            in_size = got > 0 ? got : 0;
+            compressed_bytes_ += in_size;
+            return got > 0;
+        }
+    }
+
+    std::string error_;
+    uint64_t compressed_bytes_ = 0;
+};
+
+#ifdef WC_HAVE_ZLIB
+// gzip, including files made of several concatenated members (as pigz and `cat a.gz b.gz` produce)
+class GzipDecoder : public Decoder {
+public:
+    explicit GzipDecoder(int fd) : fd_(fd), in_(COMPRESSED_READ_SIZE) {
+        memset(&stream_, 0, sizeof(stream_));
+        ok_ = inflateInit2(&stream_, 15 + 16) == Z_OK;
+        if (!ok_)
+            error_ = "inflateInit2 failed";
+    }
+    ~GzipDecoder() override {
+        if (ok_)
+            inflateEnd(&stream_);
+    }
+
+    ssize_t read(char* out, size_t capacity) override {
+        if (!ok_)
+            return -1;
+        stream_.next_out = reinterpret_cast<Bytef*>(out);
+        stream_.avail_out = (uInt)capacity;
+        while (stream_.avail_out > 0) {
+            if (stream_.avail_in == 0) {
+                size_t in_size = 0;
+                if (!fill(fd_, in_, in_size)) {
+                    if (!error_.empty())
+                        return -1;
+                    if (in_member_) {
+                        error_ = "truncated gzip stream";
+                        return -1;
+                    }
+                    break;
+                }
+                stream_.next_in = reinterpret_cast<Bytef*>(in_.data());
+                stream_.avail_in = (uInt)in_size;
+            }
+            in_member_ = true;
+            int result = inflate(&stream_, Z_NO_FLUSH);
+            if (result == Z_STREAM_END) {
+                in_member_ = false;
+                inflateReset(&stream_); // Another member may follow
+            } else if (result != Z_OK && result != Z_BUF_ERROR) {
+                error_ = std::string("inflate: ") + (stream_.msg ? stream_.msg : "corrupt data");
+                return -1;
+            }
+        }
+        return capacity - stream_.avail_out;
+    }
+
+private:
+    int fd_;
+    std::vector<char> in_;
+    z_stream stream_;
+    bool ok_ = false;
+    bool in_member_ = false; // Inside a member that has not ended yet
+};
+#endif
+
+#ifdef WC_HAVE_ZSTD
+class ZstdDecoder : public Decoder {
+public:
+    explicit ZstdDecoder(int fd) : fd_(fd), in_(ZSTD_DStreamInSize()), stream_(ZSTD_createDStream()) {
+        if (!stream_)
+            error_ = "ZSTD_createDStream failed";
+    }
+    ~ZstdDecoder() override { ZSTD_freeDStream(stream_); }
+
+    ssize_t read(char* out, size_t capacity) override {
+        if (!stream_)
+            return -1;
+        ZSTD_outBuffer output = {out, capacity, 0};
+        while (output.pos < output.size) {
+            if (input_.pos == input_.size) {
+                size_t in_size = 0;
+                if (!fill(fd_, in_, in_size)) {
+                    if (!error_.empty())
+                        return -1;
+                    if (pending_) {
+                        error_ = "truncated zstd stream";
+                        return -1;
+                    }
+                    break;
+                }
+                input_ = {in_.data(), in_size, 0};
+            }
+            size_t result = ZSTD_decompressStream(stream_, &output, &input_);
+            if (ZSTD_isError(result)) {
+                error_ = std::string("zstd: ") + ZSTD_getErrorName(result);
+                return -1;
+            }
+            pending_ = result != 0; // 0: a frame just ended
+        }
+        return output.pos;
+    }
+
+private:
+    int fd_;
+    std::vector<char> in_;
+    ZSTD_DStream* stream_;
+    ZSTD_inBuffer input_ = {nullptr, 0, 0};
+    bool pending_ = false;
+};
+#endif
+
+// Runs a Decoder on its own thread and hands out its output through two chunk buffers. Each
+// chunk handed to the reader ends at a word boundary: the decoder carries a trailing partial word
+// over to the start of the next buffer (only a word longer than a whole buffer is ever split).
+// The buffers are writable so the tokenizer can lowercase them in place.
+class DecompressingReader {
+public:
+    DecompressingReader() = default;
+    DecompressingReader(const DecompressingReader&) = delete;
+    DecompressingReader& operator=(const DecompressingReader&) = delete;
+    ~DecompressingReader() { close(); }
+
+    // Returns false (with error() set) if the file cannot be opened or its format is not built in
+    bool open(const char* path, Compression kind, size_t chunk_size = DECOMPRESS_CHUNK_SIZE) {
+        fd_ = ::open(path, O_RDONLY);
+        if (fd_ == -1) {
+            error_ = strerror(errno);
+            return false;
+        }
+        posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+#ifdef WC_HAVE_ZLIB
+        if (kind == COMPRESSION_GZIP)
+            decoder_.reset(new GzipDecoder(fd_));
+#endif
+#ifdef WC_HAVE_ZSTD
+        if (kind == COMPRESSION_ZSTD)
+            decoder_.reset(new ZstdDecoder(fd_));
+#endif
+        if (!decoder_) {
+            error_ = std::string(compression_name(kind)) + " support was not built in";
+            return false;
+        }
+        for (Buffer& buffer : buffers_)
+            buffer.data.resize(chunk_size);
+        thread_ = std::thread(&DecompressingReader::decode_loop, this);
+        return true;
+    }
+
+    // Hands out the next chunk, after giving the previous one back to the decoder. Sets size to
+    // 0 at the end of the input. Returns false on a decoding error.
+    bool next(char*& data, size_t& size) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (reading_ != -1) {
+            buffers_[reading_].full = false;
+            next_read_ = (reading_ + 1) % 2;
+            reading_ = -1;
+            changed_.notify_all();
+        }
+        Buffer& buffer = buffers_[next_read_];
+        changed_.wait(lock, [&] { return buffer.full || finished_; });
+        if (!buffer.full) {
+            size = 0;
+            return error_.empty();
+        }
+        reading_ = next_read_;
+        data = buffer.data.data();
+        size = buffer.size;
+        return true;
+    }
+
+    // Stops the decoder thread (if still running) and closes the file
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+            changed_.notify_all();
+        }
+        if (thread_.joinable())
+            thread_.join();
+        if (decoder_)
+            compressed_bytes_ = decoder_->compressed_bytes();
+        decoder_.reset();
+        if (fd_ != -1)
+            ::close(fd_);
+        fd_ = -1;
+    }
+
+    const std::string& error() const { return error_; }
+    // Totals of the decoder thread, valid after close()
+    uint64_t decompressed_bytes() const { return decompressed_bytes_; }
+    uint64_t compressed_bytes() const { return compressed_bytes_; }
+    double decode_seconds() const { return decode_seconds_; }
+
+private:
+    struct Buffer {
+        std::vector<char> data;
+        size_t size = 0;
+        bool full = false; // Handed to the reader and not given back yet
+    };
+
+    void decode_loop() {
+        std::vector<char> carry; // Partial word cut off the end of the previous chunk
+        bool skipping = false;   // Dropping the rest of a word too long for one buffer
+        for (int index = 0;; index = (index + 1) % 2) {
+            Buffer& buffer = buffers_[index];
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                changed_.wait(lock, [&] { return !buffer.full || stopping_; });
+                if (stopping_)
+                    return;
+            }
+            char* out = buffer.data.data();
+            size_t capacity = buffer.data.size();
+            memcpy(out, carry.data(), carry.size());
+            size_t filled = carry.size();
+            bool at_end = false;
+            auto start = std::chrono::steady_clock::now();
+            while (filled < capacity) {
+                ssize_t got = decoder_->read(out + filled, capacity - filled);
+                if (got < 0) {
+                    finish(decoder_->error());
+                    return;
+                }
+                if (got == 0) {
+                    at_end = true;
+                    break;
+                }
+                decompressed_bytes_ += got;
+                if (skipping) {
+                    size_t word_end = 0;
+                    while (word_end < (size_t)got && !is_word_space((unsigned char)out[filled + word_end]))
+                        word_end++;
+                    skipping = word_end == (size_t)got;
+                    memmove(out + filled, out + filled + word_end, got - word_end);
+                    got -= word_end;
+                }
+                filled += got;
+            }
+            decode_seconds_ += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            size_t cut = filled;
+            if (!at_end) {
+                while (cut > 0 && !is_word_space((unsigned char)out[cut - 1]))
+                    cut--;
+                if (cut == 0) {
+                    // One word fills the whole buffer: hand on its start, which the buffer's end
+                    // terminates, and drop the rest, so it counts once, truncated, as when mapped
+                    cut = filled;
+                    skipping = true;
+                }
+            }
+            carry.assign(out + cut, out + filled);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                buffer.size = cut;
+                buffer.full = cut > 0;
+                changed_.notify_all();
+            }
+            if (at_end) {
+                finish("");
+                return;
+            }
+        }
+    }
+
+    void finish(const std::string& error) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        error_ = error;
+        finished_ = true;
+        changed_.notify_all();
+    }
+
+    int fd_ = -1;
+    std::unique_ptr<Decoder> decoder_;
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    Buffer buffers_[2];
+    int reading_ = -1;   // Buffer the reader holds, if any
+    int next_read_ = 0;  // Buffer the reader takes next
+    bool finished_ = false;
+    bool stopping_ = false;
+    std::string error_;
+    uint64_t decompressed_bytes_ = 0;
+    uint64_t compressed_bytes_ = 0;
+    double decode_seconds_ = 0; // Time spent decoding, excluding waits for a free buffer
+};
+
+#endif
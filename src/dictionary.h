@@ -0,0 +1,249 @@
+#ifndef DICTIONARY_H
+#define DICTIONARY_H
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "ring.h"
+#include "hash.h"
+#include "word_block.h"
+
+// Shared word dictionary for interned jobs. The producer that creates the word buffer also
+// creates this segment; every producer then turns each word into a 32-bit ID with one lookup and
+// ships the IDs instead of the bytes, consumers count into dense arrays indexed by ID, and the
+// aggregator sums those arrays and reads each word back from here.
+//
+// The table is insert-only and lock-free: open addressing over 64-bit slots that each hold
+// (upper 32 bits of the word's hash, ID + 1), 0 meaning empty. A producer that meets an empty slot
+// first takes an ID and space in the append-only key arena (a fetch_add each) and copies the key, then
+// CASes its entry into the slot. Slots and keys are never moved or removed, so lookups need no
+// lock. Two producers inserting the same word at once both see the slot CAS decide, and the loser
+// returns the winner's ID; the ID it had taken stays unused.
+//
+// When the IDs or the arena run out the dictionary is full: known words still get their IDs and
+// new words travel as strings, as they do without interning.
+
+const char* DICTIONARY_NAME = "/word_dictionary"; // Plus the job ID, if any
+
+const uint32_t DEFAULT_DICTIONARY_WORDS = 1 << 20;
+const uint32_t MIN_DICTIONARY_WORDS = 1024;
+const uint32_t MAX_DICTIONARY_WORDS = 1 << 26;
+const uint32_t DICTIONARY_ARENA_PER_WORD = 16; // Arena bytes reserved per word: length byte plus an average word
+const uint32_t NO_WORD_ID = UINT32_MAX;
+
+// Header of the dictionary segment. It is followed by the slots, then by one key offset per ID,
+// then by the key arena ([uint8_t length][bytes] per key).
+struct WordDictionary {
+    uint64_t total_size;     // Size of the whole mapping in bytes
+    uint64_t nonce;          // Tells this dictionary's ID counts from those of an earlier job
+    uint32_t slot_count;     // Power of two, at least twice `capacity`, so probes stay short
+    uint32_t capacity;       // Most IDs handed out
+    uint64_t arena_offset;   // Start of the arena, from the start of the segment
+    uint64_t arena_capacity; // Arena bytes
+
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> next_id;
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> arena_used;
+    std::atomic<uint32_t> full; // Set once an ID or key could not be allocated; never cleared
+
+    std::atomic<uint64_t>* slots();
+    uint64_t* key_offsets(); // Key of each ID, from the start of the segment; 0 for an ID never used
+
+    // IDs handed out so far (some may be unused); dense count arrays need this many entries
+    uint32_t id_count() const { return std::min(next_id.load(std::memory_order_relaxed), capacity); }
+
+    // The key of `id`; false for an ID that holds no word
+    bool word(uint32_t id, const char*& key, uint8_t& length) {
+        if (id >= capacity || key_offsets()[id] == 0)
+            return false;
+        const char* entry = reinterpret_cast<const char*>(this) + key_offsets()[id];
+        length = (uint8_t)entry[0];
+        key = entry + 1;
+        return true;
+    }
+
+    // Returns the word's ID, inserting it if absent, or NO_WORD_ID once the dictionary is full
+    // and the word is not in it. `hash` is hash_word(word, length).
+    uint32_t intern(const char* word, uint8_t length, uint64_t hash) {
+        uint32_t tag = (uint32_t)(hash >> 32);
+        uint32_t mask = slot_count - 1;
+        uint32_t id = NO_WORD_ID; // Taken for this word but not yet in a slot
+        std::atomic<uint64_t>* table = slots();
+        for (uint32_t probe = 0, i = (uint32_t)hash & mask; probe < slot_count; ++probe, i = (i + 1) & mask) {
+            uint64_t entry = table[i].load(std::memory_order_acquire);
+            if (entry == 0) {
+                if (id == NO_WORD_ID && (id = allocate(word, length)) == NO_WORD_ID)
+                    return NO_WORD_ID;
+                uint64_t mine = ((uint64_t)tag << 32) | (id + 1);
+                if (table[i].compare_exchange_strong(entry, mine, std::memory_order_release, std::memory_order_acquire))
+                    return id;
+                // Lost the slot; `entry` is the winner's, which may be this very word
+            }
+            if ((uint32_t)(entry >> 32) == tag && matches((uint32_t)entry - 1, word, length))
+                return (uint32_t)entry - 1;
+        }
+        return NO_WORD_ID;
+    }
+
+private:
+    // Takes the next ID and stores the key for it. The slot CAS that follows publishes both.
+    uint32_t allocate(const char* word, uint8_t length) {
+        if (full.load(std::memory_order_relaxed))
+            return NO_WORD_ID;
+        uint32_t id = next_id.fetch_add(1, std::memory_order_relaxed);
+        uint64_t offset = arena_used.fetch_add(1 + length, std::memory_order_relaxed);
+        if (id >= capacity || offset + 1 + length > arena_capacity) {
+            full.store(1, std::memory_order_relaxed);
+            return NO_WORD_ID;
+        }
+        char* key = reinterpret_cast<char*>(this) + arena_offset + offset;
+        key[0] = (char)length;
+        memcpy(key + 1, word, length);
+        key_offsets()[id] = arena_offset + offset;
+        return id;
+    }
+
+    bool matches(uint32_t id, const char* text, uint8_t length) {
+        const char* key;
+        uint8_t key_length;
+        return word(id, key, key_length) && key_length == length && memcmp(key, text, length) == 0;
+    }
+};
+
+inline uint64_t dictionary_header_size() {
+    return (sizeof(WordDictionary) + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+}
+
+inline std::atomic<uint64_t>* WordDictionary::slots() {
+    return reinterpret_cast<std::atomic<uint64_t>*>(reinterpret_cast<char*>(this) + dictionary_header_size());
+}
+
+inline uint64_t* WordDictionary::key_offsets() {
+    return reinterpret_cast<uint64_t*>(reinterpret_cast<char*>(slots()) + (uint64_t)slot_count * sizeof(uint64_t));
+}
+
+inline uint32_t dictionary_slot_count(uint32_t words) {
+    uint32_t slots = 1;
+    while (slots < 2 * (uint64_t)words)
+        slots *= 2;
+    return slots;
+}
+
+inline uint64_t dictionary_size(uint32_t words) {
+    return dictionary_header_size() + (uint64_t)dictionary_slot_count(words) * sizeof(uint64_t)
+           + (uint64_t)words * sizeof(uint64_t) + (uint64_t)words * DICTIONARY_ARENA_PER_WORD;
+}
+
+// Lays out a freshly created (zero-filled) segment of dictionary_size(words) bytes
+inline void init_dictionary(WordDictionary* dictionary, uint32_t words) {
+    dictionary->total_size = dictionary_size(words);
+    uint64_t seed[3] = {monotonic_ns(), (uint64_t)time(nullptr), (uint64_t)getpid()};
+    dictionary->nonce = hash_word(reinterpret_cast<const char*>(seed), sizeof(seed));
+    dictionary->slot_count = dictionary_slot_count(words);
+    dictionary->capacity = words;
+    dictionary->arena_offset = dictionary_header_size() + (uint64_t)dictionary->slot_count * sizeof(uint64_t) + (uint64_t)words * sizeof(uint64_t);
+    dictionary->arena_capacity = (uint64_t)words * DICTIONARY_ARENA_PER_WORD;
+    dictionary->next_id.store(0);
+    dictionary->arena_used.store(0);
+    dictionary->full.store(0);
+}
+
+// Maps the dictionary `name` of the current (or last) interned job, read-only unless `writable`.
+// Returns MAP_FAILED with `error` set if there is none or it cannot be mapped.
+inline WordDictionary* map_dictionary(const std::string& name, bool writable, size_t& mapped_size, std::string& error) {
+    int fd = shm_open(name.c_str(), writable ? O_RDWR : O_RDONLY, 0666);
+    if (fd == -1) {
+        error = "shm_open " + name + ": " + strerror(errno);
+        return (WordDictionary*) MAP_FAILED;
+    }
+    struct stat st;
+    void* mapping = MAP_FAILED;
+    if (fstat(fd, &st) == -1)
+        error = std::string("fstat: ") + strerror(errno);
+    else if ((uint64_t)st.st_size < dictionary_header_size())
+        error = name + " is not laid out";
+    else if ((mapping = mmap(0, st.st_size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+        error = std::string("mmap: ") + strerror(errno);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return (WordDictionary*) MAP_FAILED;
+    WordDictionary* dictionary = static_cast<WordDictionary*>(mapping);
+    if (dictionary->total_size != (uint64_t)st.st_size) {
+        error = name + " has an unexpected size";
+        munmap(mapping, st.st_size);
+        return (WordDictionary*) MAP_FAILED;
+    }
+    mapped_size = st.st_size;
+    return dictionary;
+}
+
+// ID count files: what a consumer of an interned job counted, as one dense array
+// (consumer_output_<id>.ids). The header names the dictionary the IDs belong to.
+const char ID_COUNTS_MAGIC[8] = {'W', 'C', 'I', 'D', 'S', '0', '0', '1'};
+
+struct IdCountsHeader {
+    char magic[8];
+    uint64_t nonce;    // WordDictionary::nonce
+    uint64_t id_count; // uint64_t counts that follow, one per ID
+};
+
+inline std::string id_counts_file_name(const std::string& consumer_id) {
+    return "consumer_output_" + consumer_id + ".ids";
+}
+
+inline bool write_id_counts(const std::string& filename, uint64_t nonce, const std::vector<uint64_t>& counts) {
+    std::ofstream out(filename, std::ios::binary);
+    IdCountsHeader header;
+    memcpy(header.magic, ID_COUNTS_MAGIC, sizeof(header.magic));
+    header.nonce = nonce;
+    header.id_count = counts.size();
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(counts.data()), counts.size() * sizeof(uint64_t));
+    out.close();
+    return !out.fail();
+}
+
+// Adds a file's counts element-wise into `totals`, which grows as needed. Returns false (with
+// `error` set) if the file cannot be read or belongs to another dictionary than `nonce`.
+inline bool add_id_counts(const std::string& filename, uint64_t nonce, std::vector<uint64_t>& totals, std::string& error) {
+    std::ifstream in(filename, std::ios::binary);
+    IdCountsHeader header;
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+        error = "cannot read the header";
+        return false;
+    }
+    if (memcmp(header.magic, ID_COUNTS_MAGIC, sizeof(header.magic)) != 0) {
+        error = "not an ID count file";
+        return false;
+    }
+    if (header.nonce != nonce) {
+        error = "counted against another dictionary (left over from an earlier job?)";
+        return false;
+    }
+    if (totals.size() < header.id_count)
+        totals.resize(header.id_count);
+    std::vector<uint64_t> chunk(64 << 10);
+    for (uint64_t done = 0; done < header.id_count;) {
+        size_t n = (size_t)std::min<uint64_t>(chunk.size(), header.id_count - done);
+        if (!in.read(reinterpret_cast<char*>(chunk.data()), n * sizeof(uint64_t))) {
+            error = "truncated";
+            return false;
+        }
+        for (size_t i = 0; i < n; ++i)
+            totals[done + i] += chunk[i];
+        done += n;
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef FUTEX_H
+#define FUTEX_H
+
+#include <atomic>
+#include <cstdint>
+#include <climits>
+#include <ctime>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+const int CACHE_LINE_SIZE = 64;
+
+// Upper bound on a single futex sleep so blocked processes can re-check their shutdown flag
+const long FUTEX_WAIT_TIMEOUT_NS = 100 * 1000 * 1000; // 100ms
+
+// Shared (non-private) futex ops: the words live in a MAP_SHARED segment used by several processes
+inline int futex_wait(std::atomic<uint32_t>* addr, uint32_t expected, long timeout_ns = FUTEX_WAIT_TIMEOUT_NS) {
+    struct timespec ts;
+    ts.tv_sec = timeout_ns / 1000000000L;
+    ts.tv_nsec = timeout_ns % 1000000000L;
+    return syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAIT, expected, &ts, nullptr, 0);
+}
+
+inline int futex_wake_all(std::atomic<uint32_t>* addr) {
+    return syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+// Event count used to park processes until a condition may have changed.
+// Waiters register before re-checking their condition so a notifier never misses them,
+// and notifiers skip the wake syscall entirely while nobody is parked.
+struct alignas(CACHE_LINE_SIZE) FutexEvent {
+    std::atomic<uint32_t> epoch;
+    std::atomic<uint32_t> waiters;
+
+    uint32_t prepare_wait() {
+        waiters.fetch_add(1);
+        return epoch.load();
+    }
+
+    void cancel_wait() {
+        waiters.fetch_sub(1);
+    }
+
+    void wait(uint32_t observed_epoch, long timeout_ns = FUTEX_WAIT_TIMEOUT_NS) {
+        futex_wait(&epoch, observed_epoch, timeout_ns);
+        waiters.fetch_sub(1);
+    }
+
+    void notify_all() {
+        std::atomic_thread_fence(std::memory_order_seq_cst); // Order the state change before reading waiters
+        if (waiters.load() > 0) {
+            epoch.fetch_add(1);
+            futex_wake_all(&epoch);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+// 64-bit hash for short byte strings: 8 bytes per multiply, murmur3 finalizer.
+// Every process uses the same function, so values may be compared across processes.
+inline uint64_t hash_word(const char* data, size_t length) {
+    const uint64_t m = 0x9e3779b97f4a7c15ull;
+    uint64_t h = length * m;
+    while (length >= 8) {
+        uint64_t chunk;
+        memcpy(&chunk, data, 8);
+        h = (h ^ chunk) * m;
+        h ^= h >> 29;
+        data += 8;
+        length -= 8;
+    }
+    if (length > 0) {
+        uint64_t chunk = 0;
+        memcpy(&chunk, data, length);
+        h = (h ^ chunk) * m;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+// Which partition (and so which consumer) owns a word; the aggregator routes words the same way
+// when it merges per-partition sketches. Routing uses the high half of the hash, like the shards
+// of ShardedWordCounts: the tables a consumer fills pick home slots from the low bits, which
+// would otherwise be the same residue for every word of a partition.
+inline uint32_t partition_for_hash(uint64_t hash, uint32_t partitions) {
+    return partitions == 1 ? 0 : (uint32_t)((hash >> 32) % partitions);
+}
+
+inline uint32_t partition_for(const char* word, size_t length, uint32_t partitions) {
+    return partitions == 1 ? 0 : partition_for_hash(hash_word(word, length), partitions);
+}
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef JOB_H
+#define JOB_H
+
+#include <cerrno>
+#include <string>
+#include <sys/stat.h>
+
+// Job namespaces, so independent jobs can share a host. Every process of a job is started with
+// the same --job ID: the ID is appended to the name of each of the job's shared memory segments
+// and semaphores, and the job's files (consumer outputs, snapshots, the aggregator's report and
+// state) live in the directory job_<ID>. Without an ID a job uses the plain names and the current
+// directory.
+
+const size_t MAX_JOB_ID_LENGTH = 64;
+
+// IDs are limited to [A-Za-z0-9_-] so that they fit IPC names and file names alike
+inline bool valid_job_id(const std::string& id) {
+    if (id.empty() || id.size() > MAX_JOB_ID_LENGTH)
+        return false;
+    for (char c : id) {
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '-'))
+            return false;
+    }
+    return true;
+}
+
+struct JobNames {
+    std::string id;  // Empty for the default job
+    std::string dir; // Where the job's files live: "." or job_<id>
+
+    explicit JobNames(const std::string& job_id = "") : id(job_id), dir(job_id.empty() ? "." : "job_" + job_id) {}
+
+    // Name of one of the job's shared memory segments or semaphores, e.g. /word_shared_memory.<id>
+    std::string ipc(const std::string& base) const {
+        return id.empty() ? base : base + "." + id;
+    }
+
+    // Path of one of the job's files
+    std::string path(const std::string& file) const {
+        return id.empty() ? file : dir + "/" + file;
+    }
+
+    // Creates the job's directory if needed. Returns false with errno set.
+    bool make_dir() const {
+        return id.empty() || mkdir(dir.c_str(), 0777) == 0 || errno == EEXIST;
+    }
+};
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+// Where processes run and where the shared segment's memory lives: CPU pinning, NUMA node
+// preference for a range of the segment, transparent huge pages and pre-faulting. Everything
+// goes through plain syscalls, so there is no libnuma dependency; on kernels or hosts without
+// a feature the calls fail and callers carry on with the default placement.
+
+const uint64_t HUGE_PAGE_SIZE = 2 << 20; // x86-64 / arm64 PMD size
+
+// Parses a CPU list such as "0-3,8,10-11"; returns false if malformed
+inline bool parse_cpu_list(const std::string& text, std::vector<int>& cpus) {
+    cpus.clear();
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t comma = text.find(',', pos);
+        std::string range = text.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos);
+        char* end = nullptr;
+        long first = strtol(range.c_str(), &end, 10);
+        long last = first;
+        if (end != range.c_str() && *end == '-') {
+            const char* second = end + 1;
+            last = strtol(second, &end, 10);
+            if (end == second)
+                return false;
+        }
+        if (end == range.c_str() || *end != '\0' || first < 0 || last < first || last >= CPU_SETSIZE)
+            return false;
+        for (long cpu = first; cpu <= last; ++cpu)
+            cpus.push_back((int)cpu);
+        if (comma == std::string::npos)
+            break;
+        pos = comma + 1;
+    }
+    return !cpus.empty();
+}
+
+// Restricts the calling process (every thread it starts later included) to `cpus`
+inline bool pin_to_cpus(const std::vector<int>& cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus)
+        CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+// NUMA node of the CPU the caller is running on, or -1 if the kernel does not say
+inline int current_numa_node() {
+    unsigned cpu = 0, node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) == -1)
+        return -1;
+    return (int)node;
+}
+
+// Page-aligned [begin, end) inside [addr, addr + size), or an empty range
+inline bool page_range(void* addr, size_t size, char*& begin, char*& end) {
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t first = ((uintptr_t)addr + page - 1) & ~(page - 1);
+    uintptr_t last = ((uintptr_t)addr + size) & ~(page - 1);
+    begin = (char*)first;
+    end = (char*)last;
+    return last > first;
+}
+
+// Sets a preferred-node policy on a range of a shared mapping, so pages not yet faulted in are
+// allocated on `node` by whichever process touches them first, and asks the kernel to move pages
+// already there that only this process maps. For shared memory the policy belongs to the segment,
+// not to this mapping.
+inline bool prefer_node(void* addr, size_t size, int node) {
+    char *begin, *end;
+    if (node < 0 || node >= (int)(8 * sizeof(unsigned long)) || !page_range(addr, size, begin, end))
+        return false;
+    unsigned long nodemask = 1ul << node;
+    return syscall(SYS_mbind, begin, end - begin, MPOL_PREFERRED, &nodemask, 8 * sizeof(nodemask), MPOL_MF_MOVE) == 0;
+}
+
+// Asks for transparent huge pages on a mapping of the shared segment. For shared memory the
+// kernel honours this only if /sys/kernel/mm/transparent_hugepage/shmem_enabled allows it.
+inline bool advise_huge_pages(void* addr, size_t size) {
+    return madvise(addr, size, MADV_HUGEPAGE) == 0;
+}
+
+// The selected value of a THP setting ("always [madvise] never" -> "madvise"), or "" if unknown
+inline std::string thp_setting(const char* name) {
+    std::ifstream file(std::string("/sys/kernel/mm/transparent_hugepage/") + name);
+    std::string text;
+    std::getline(file, text);
+    size_t open = text.find('['), close = text.find(']');
+    return open != std::string::npos && close > open ? text.substr(open + 1, close - open - 1) : "";
+}
+
+// Whether shared memory that was madvise(MADV_HUGEPAGE)'d can get huge pages on this host
+inline bool shmem_huge_pages_available() {
+    std::string setting = thp_setting("shmem_enabled");
+    return setting == "always" || setting == "within_size" || setting == "advise" || setting == "force";
+}
+
+// Faults every page of a range in, writable, so the hot path never takes a page fault. The
+// contents are left as they are: the fallback touches each page with an atomic add of zero.
+inline void prefault(void* addr, size_t size) {
+    char *begin, *end;
+    if (!page_range(addr, size, begin, end))
+        return;
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(begin, end - begin, MADV_POPULATE_WRITE) == 0)
+        return;
+#endif
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    for (char* p = begin; p < end; p += page)
+        __atomic_fetch_add(p, 0, __ATOMIC_RELAXED);
+}
+
+#endif
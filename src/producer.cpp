@@ -8,46 +8,70 @@
 #include <csignal>
 #include <atomic>
 #include <cerrno>
-#include <fstream>      
 #include <cstring>
 #include <algorithm>    
-#include <cctype>       
+#include <getopt.h>
+#include <memory>
+#include <climits>
+#include <poll.h>
+#include <sys/inotify.h>
 
 #include "common.h"
+#include "tokenizer.h"
+#include "combiner.h"
+#include "decompress.h"
+#include "work_queue.h"
 
 using namespace std;
 
 // Flag for graceful shutdown
 atomic_bool running(true);
 
+// Follow mode reads what was appended to the file in pieces of up to this many bytes
+const size_t FOLLOW_READ_SIZE = 4 << 20;
+const int FOLLOW_POLL_MS = 500; // Longest wait for a change before re-checking the file and `running`
+
+size_t mapped_size = 0; // Bytes of the shared segment mapped by this process
+
+JobNames job; // With --job, the namespace of the job's IPC names
+
+// The shared input queue, when reading a directory, glob or manifest
+WorkQueue* workQueue = static_cast<WorkQueue*> MAP_FAILED;
+size_t work_queue_mapped_size = 0;
+
+// The shared word dictionary, when the job interns words
+WordDictionary* dictionary = static_cast<WordDictionary*> MAP_FAILED;
+size_t dictionary_mapped_size = 0;
+
+ProcessStats unpublished_stats;        // Stands in when every shared stats slot is taken
+ProcessStats* stats = &unpublished_stats; // This producer's slot in the shared StatsBlock
+
 void signal_handler(int signum) {
-    cout << "\nProducer: SIGINT received (" << signum << "). Shutting down gracefully..." << endl;
+    cout << "\nProducer: Signal " << signum << " received. Shutting down gracefully..." << endl;
     running.store(false);
 }
 
-string cleanWord(const string& rawWord) {
-    string cleaned;
-    for (char c : rawWord) {
-        if (isalnum(static_cast<unsigned char>(c))) { 
-            cleaned += tolower(static_cast<unsigned char>(c)); 
-        }
-    }
-    return cleaned;
-}
+int cleanUp(int shm_fd, SharedWordBuffer* wordBuffer, vector<QueueSemaphores>& sems, bool isError = false) {
+    for (QueueSemaphores& partSems : sems) {
+        if (partSems.empty != SEM_FAILED && sem_close(partSems.empty) == -1)
+            perror("Producer: sem_close SEM_EMPTY_NAME failed");
 
-int cleanUp(int shm_fd, SharedWordBuffer* wordBuffer, sem_t* sem_empty, sem_t* sem_full, sem_t* sem_mutex, bool isError = false) {
-    if (sem_empty != SEM_FAILED && sem_close(sem_empty) == -1)
-        perror("Producer: sem_close SEM_EMPTY_NAME failed");
+        if (partSems.full != SEM_FAILED && sem_close(partSems.full) == -1)
+            perror("Producer: sem_close SEM_FULL_NAME failed");
 
-    if (sem_full != SEM_FAILED && sem_close(sem_full) == -1)
-        perror("Producer: sem_close SEM_FULL_NAME failed");
-
-    if (sem_mutex != SEM_FAILED && sem_close(sem_mutex) == -1)
-        perror("Producer: sem_close SEM_MUTEX_NAME failed");
+        if (partSems.mutex != SEM_FAILED && sem_close(partSems.mutex) == -1)
+            perror("Producer: sem_close SEM_MUTEX_NAME failed");
+    }
 
-    if (wordBuffer != MAP_FAILED && munmap(wordBuffer, sizeof(SharedWordBuffer)) == -1)
+    if (wordBuffer != MAP_FAILED && munmap(wordBuffer, mapped_size) == -1)
         perror("Producer: munmap failed");
 
+    if (workQueue != MAP_FAILED && munmap(workQueue, work_queue_mapped_size) == -1)
+        perror("Producer: munmap work queue failed");
+
+    if (dictionary != MAP_FAILED && munmap(dictionary, dictionary_mapped_size) == -1)
+        perror("Producer: munmap dictionary failed");
+
     if (shm_fd != -1 && close(shm_fd) == -1)
         perror("Producer: close shm_fd failed");
 
@@ -55,207 +79,939 @@ int cleanUp(int shm_fd, SharedWordBuffer* wordBuffer, sem_t* sem_empty, sem_t* s
 }
 
 
-void send_eof_signal(SharedWordBuffer* wordBuffer, sem_t* sem_empty, sem_t* sem_full, sem_t* sem_mutex) {
-    if (sem_wait(sem_empty) == -1) {
-        if (errno == EINTR && !running.load()) // Interrupted by SIGINT during shutdown
-            return;
-        perror("Producer: sem_wait for EOF signal failed");
-        return;
+// Queue one block using a partition's semaphore-guarded head/tail.
+// Returns 0 on success, 1 if interrupted by shutdown, -1 on a semaphore error.
+int enqueue_semaphore(Partition& part, const char* block, uint32_t bytes, const QueueSemaphores& sems) {
+    if (sem_trywait(sems.empty) == -1) { // No free slot right now: block, and account for the wait
+        uint64_t wait_start = monotonic_ns();
+        while (sem_wait(sems.empty) == -1) {
+            if (errno == EINTR) {
+                if (!running.load()) // Interrupted by SIGINT during shutdown
+                    return 1;
+                continue;
+            }
+            perror("Producer: sem_wait SEM_EMPTY_NAME failed");
+            return -1;
+        }
+        stats->record_queue_wait(monotonic_ns() - wait_start);
     }
 
-    if (sem_wait(sem_mutex) == -1) {
-        if (errno == EINTR && !running.load()) {
-            sem_post(sem_empty); // Release empty slot if interrupted during shutdown
-            return;
+    if (sem_trywait(sems.mutex) == -1) { // Another process holds the queue
+        uint64_t wait_start = monotonic_ns();
+        while (sem_wait(sems.mutex) == -1) {
+            if (errno == EINTR) {
+                if (!running.load()) {
+                    sem_post(sems.empty); // Release previously acquired sem_empty
+                    return 1;
+                }
+                continue;
+            }
+            perror("Producer: sem_wait SEM_MUTEX_NAME failed");
+            sem_post(sems.empty); // If mutex fails, release sem_empty to avoid deadlock
+            return -1;
         }
-        perror("Producer: sem_wait mutex for EOF signal failed");
-        sem_post(sem_empty); // Release empty slot if mutex acquisition fails
-        return;
+        stats->record_lock_wait(monotonic_ns() - wait_start);
     }
 
-    // Write EOF signal
-    WordEntry eofEntry;
-    strncpy(eofEntry.word, EOF_SIGNAL_WORD, MAX_WORD_LENGTH - 1);
-    eofEntry.word[MAX_WORD_LENGTH - 1] = '\0';
+    memcpy(part.ring.slot_data(part.head), block, bytes);
+    part.head = (part.head + 1) % part.ring.capacity;
+    part.queued++;
 
-    wordBuffer->entries[wordBuffer->head] = eofEntry;
-    wordBuffer->head = (wordBuffer->head + 1) % MAX_WORD_ENTRIES;
+    if (sem_post(sems.mutex) == -1)
+        perror("Producer: sem_post SEM_MUTEX_NAME failed");
 
-    if (sem_post(sem_mutex) == -1)
-        perror("Producer: sem_post mutex for EOF signal failed");
+    if (sem_post(sems.full) == -1)
+        perror("Producer: sem_post SEM_FULL_NAME failed");
 
-    // Signal that a new item (EOF) is available
-    if (sem_post(sem_full) == -1)
-        perror("Producer: sem_post full for EOF signal failed");
+    return 0;
 }
 
+// Queue one block on a partition with whichever implementation the shared buffer was initialized with
+int enqueue_block(SharedWordBuffer* wordBuffer, uint32_t partition, const char* block, uint32_t bytes, const vector<QueueSemaphores>& sems) {
+    Partition& part = wordBuffer->partition(partition);
+    if (wordBuffer->queue_kind.load() == QUEUE_LOCKFREE) {
+        bool blocked = false;
+        uint64_t start = monotonic_ns();
+        bool pushed = part.ring.push(block, bytes, running, &blocked);
+        if (blocked)
+            stats->record_queue_wait(monotonic_ns() - start);
+        return pushed ? 0 : 1;
+    }
+    return enqueue_semaphore(part, block, bytes, sems[partition]);
+}
 
-int main(int argc, char* argv[]) {
-    if (argc < 2) {
-        cerr << "Usage: " << argv[0] << " <input_file.txt>" << endl;
-        return 1;
+// Counts this producer out of the job, whether it finished its file or gave up. The last producer
+// the consumers are waiting for closes the job, which wakes every consumer at once; on the semaphore
+// queue it also posts each sem_full once, and consumers pass that post on to one another.
+void leave_job(SharedWordBuffer* wordBuffer, const vector<QueueSemaphores>& sems) {
+    wordBuffer->producers_left++;
+    int remaining_producers = --wordBuffer->active_producers_count;
+    cout << "Producer: Leaving the job. Remaining active producers: " << remaining_producers << endl;
+    if (remaining_producers == 0 && job_complete(wordBuffer)) {
+        if (close_job(wordBuffer))
+            cout << "Producer: I am the last producer. Job closed." << endl;
+        for (const QueueSemaphores& partSems : sems) {
+            if (sem_post(partSems.full) == -1)
+                perror("Producer: sem_post SEM_FULL_NAME failed");
+        }
     }
-    const char* inputFileName = argv[1];
+    stats->state.store(STATS_SLOT_DONE);
+}
 
-    cout << "Word Producer Process Started. Reading from: " << inputFileName << endl;
+// Packs words, or (word, count) records from the combiner, into a local block for one
+// partition and publishes each full block to that partition's ring in one step. An ID publisher
+// packs dictionary IDs instead (add_id).
+class BlockPublisher {
+public:
+    BlockPublisher(SharedWordBuffer* wordBuffer, uint32_t partition, const vector<QueueSemaphores>& sems, bool counted, bool ids = false)
+        : wordBuffer_(wordBuffer), partition_(partition), sems_(sems),
+          buffer_(wordBuffer->partition(partition).ring.slot_size), block_(buffer_.data(), buffer_.size()) {
+        if (counted)
+            block_.set_counted();
+        if (ids)
+            block_.set_ids();
+    }
 
-    // Register signal handler for graceful shutdown
-    if (signal(SIGINT, signal_handler) == SIG_ERR) {
-        perror("Producer: signal failed");
-        return 1;
+    // Returns 0 on success, 1 if interrupted by shutdown, -1 on a queue error
+    int add(const char* word, uint8_t length, uint64_t count = 1) {
+        if (!append(word, length, count)) {
+            int status = publish();
+            if (status != 0)
+                return status;
+            append(word, length, count);
+        }
+        block_words_ += count;
+        return 0;
     }
 
-    int shm_fd = -1;
-    SharedWordBuffer* wordBuffer = static_cast<SharedWordBuffer*> MAP_FAILED;
-    sem_t* sem_empty = SEM_FAILED;
-    sem_t* sem_full = SEM_FAILED;
-    sem_t* sem_mutex = SEM_FAILED;
-    bool expected_initialized = false; // For atomic_bool compare_exchange_strong
-
-    // Open Shared Memory
-    shm_fd = shm_open(SHARED_MEM_NAME, O_CREAT | O_RDWR, 0666);
-    if (shm_fd == -1) {
-        perror("Producer: shm_open failed");
-        return cleanUp(shm_fd, wordBuffer, sem_empty, sem_full, sem_mutex, true);
+    int add_id(uint32_t id, uint64_t count = 1) {
+        if (!block_.append_id(id, count)) {
+            int status = publish();
+            if (status != 0)
+                return status;
+            block_.append_id(id, count);
+        }
+        block_words_ += count;
+        return 0;
     }
 
-    // Configure Shared Memory Size
-    if (ftruncate(shm_fd, sizeof(SharedWordBuffer)) == -1) {
-        perror("Producer: ftruncate failed");
-        return cleanUp(shm_fd, wordBuffer, sem_empty, sem_full, sem_mutex, true);
+    // Publishes the partially filled block, if any; the publisher can keep adding afterwards
+    int finish() {
+        return block_.empty() ? 0 : publish();
     }
 
-    // Map Shared Memory to Process Address Space
-    wordBuffer = (SharedWordBuffer*) mmap(0, sizeof(SharedWordBuffer), PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
-    if (wordBuffer == MAP_FAILED) {
-        perror("Producer: mmap failed");
-        return cleanUp(shm_fd, wordBuffer, sem_empty, sem_full, sem_mutex, true);
+    int blocks_published() const { return blocks_published_; }
+
+private:
+    bool append(const char* word, uint8_t length, uint64_t count) {
+        return block_.counted() ? block_.append_counted(word, length, count) : block_.append(word, length);
     }
 
-    // Open Semaphores
-    sem_empty = sem_open(SEM_EMPTY_NAME, O_CREAT, 0666, MAX_WORD_ENTRIES);
-    if (sem_empty == SEM_FAILED) {
-        perror("Producer: sem_open SEM_EMPTY_NAME failed");
-        return cleanUp(shm_fd, wordBuffer, sem_empty, sem_full, sem_mutex, true);
+    int publish() {
+        block_.set_publish_time(monotonic_ns());
+        int status = enqueue_block(wordBuffer_, partition_, block_.data(), block_.bytes_used(), sems_);
+        if (status == 0) {
+            Partition& part = wordBuffer_->partition(partition_);
+            const QueueSemaphores* sems = sems_.empty() ? nullptr : &sems_[partition_];
+            stats->record_handoff(block_words_, block_.bytes_used(), partition_occupancy(part, wordBuffer_->queue_kind.load(), sems), part.ring.capacity);
+            blocks_published_++;
+            block_words_ = 0;
+            block_.reset();
+        }
+        return status;
     }
 
-    sem_full = sem_open(SEM_FULL_NAME, O_CREAT, 0666, 0);
-    if (sem_full == SEM_FAILED) {
-        perror("Producer: sem_open SEM_FULL_NAME failed");
-        return cleanUp(shm_fd, wordBuffer, sem_empty, sem_full, sem_mutex, true);
+    SharedWordBuffer* wordBuffer_;
+    uint32_t partition_;
+    const vector<QueueSemaphores>& sems_;
+    vector<char> buffer_;
+    BlockWriter block_;
+    uint64_t block_words_ = 0; // Word occurrences in the open block
+    int blocks_published_ = 0;
+};
+
+void print_usage(const char* prog) {
+    cerr << "Usage: " << prog << " [--queue lockfree|semaphore] [--slot-size BYTES] [--ring-depth N] [--partitions N] [--combine[=BYTES]] [--intern[=WORDS]] [--part I/N | --follow [--offset-file PATH]] [--chunk-size BYTES] [--huge-pages] [--prefault] [--cpus LIST] [--normalize ascii|ascii-punct|utf8] [--job ID] [--bench] <input_file.txt[.gz|.zst] | directory | 'glob'>" << endl;
+    cerr << "       " << prog << " [options] --manifest FILE" << endl;
+}
+
+// Creates the dictionary of an interned job, replacing any left by an earlier one. Only the
+// producer creating the word buffer calls this, before publishing the buffer, so everyone who
+// sees SEGMENT_INTERNED finds the dictionary ready. Returns false (after reporting) on failure.
+bool create_dictionary(uint32_t words) {
+    string name = job.ipc(DICTIONARY_NAME);
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0666);
+    if (fd == -1) {
+        perror("Producer: shm_open dictionary failed");
+        return false;
     }
+    uint64_t size = dictionary_size(words);
+    if (ftruncate(fd, size) == -1 || (dictionary = (WordDictionary*) mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        perror("Producer: Creating the dictionary failed");
+        shm_unlink(name.c_str());
+        close(fd);
+        return false;
+    }
+    close(fd);
+    dictionary_mapped_size = size;
+    init_dictionary(dictionary, words);
+    return true;
+}
 
-    sem_mutex = sem_open(SEM_MUTEX_NAME, O_CREAT, 0666, 1);
-    if (sem_mutex == SEM_FAILED) {
-        perror("Producer: sem_open SEM_MUTEX_NAME failed");
-        return cleanUp(shm_fd, wordBuffer, sem_empty, sem_full, sem_mutex, true);
+// Joins the pool's shared work queue, building it from `source` (a directory, glob or manifest)
+// if this is the first producer to get here. Returns false (after reporting) if the queue could
+// not be built or mapped; workQueue is then left unmapped.
+bool open_work_queue(const string& source, bool manifest, uint64_t chunk_size) {
+    string name = job.ipc(WORK_QUEUE_NAME);
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0666);
+    if (fd == -1 && errno == EEXIST) {
+        fd = shm_open(name.c_str(), O_RDWR, 0666);
+        if (fd == -1) {
+            perror("Producer: shm_open work queue failed");
+            return false;
+        }
+        string error;
+        workQueue = map_work_queue(fd, running, work_queue_mapped_size, error);
+        close(fd);
+        if (workQueue == MAP_FAILED) {
+            if (!error.empty())
+                cerr << "Producer: Cannot use the work queue: " << error << "." << endl;
+            return false;
+        }
+        if (strncmp(workQueue->source, source.c_str(), WORK_QUEUE_SOURCE_LENGTH - 1) != 0)
+            cout << "Producer: Using the existing work queue built from " << workQueue->source << "." << endl;
+        return true;
+    }
+    if (fd == -1) {
+        perror("Producer: shm_open work queue failed");
+        return false;
     }
 
-    // Robust Shared Memory Initialization
-    if (wordBuffer->initialized.compare_exchange_strong(expected_initialized, true)) {
-        cout << "Producer: Initializing shared word buffer for the first time." << endl;
-        wordBuffer->head = 0;
-        wordBuffer->tail = 0;
-        wordBuffer->active_producers_count.store(0); // Initialize count
-        wordBuffer->eof_signals_received.store(0); // Initialize EOF count
-    } else {
-        cout << "Producer: Shared word buffer already initialized by another process." << endl;
+    // Size the header first so that other producers can wait on its state while we expand the source
+    WorkQueue* header = static_cast<WorkQueue*> MAP_FAILED;
+    if (ftruncate(fd, work_queue_header_size()) == -1
+        || (header = (WorkQueue*) mmap(0, work_queue_header_size(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        perror("Producer: Creating the work queue failed");
+        shm_unlink(name.c_str());
+        close(fd);
+        return false;
+    }
+    vector<WorkInput> inputs;
+    string error;
+    bool expanded = expand_work_source(source, manifest, inputs, error);
+    if (expanded && inputs.empty()) {
+        error = source + ": no input files";
+        expanded = false;
+    }
+    uint64_t item_count = 0;
+    uint64_t total_size = expanded ? work_queue_size(inputs, chunk_size, item_count) : 0;
+    if (expanded && ftruncate(fd, total_size) == -1) {
+        error = string("ftruncate: ") + strerror(errno);
+        expanded = false;
+    }
+    if (expanded && (workQueue = (WorkQueue*) mmap(0, total_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        error = string("mmap: ") + strerror(errno);
+        expanded = false;
+    }
+    if (!expanded) { // Let the waiting producers give up too; the next attempt starts from scratch
+        cerr << "Producer: Cannot build the work queue: " << error << "." << endl;
+        shm_unlink(name.c_str());
+        header->state.store(WORK_QUEUE_FAILED);
+        futex_wake_all(&header->state);
+        munmap(header, work_queue_header_size());
+        close(fd);
+        return false;
     }
+    munmap(header, work_queue_header_size());
+    close(fd);
+    work_queue_mapped_size = total_size;
+    init_work_queue(workQueue, source, inputs, chunk_size);
+    cout << "Producer: Built the work queue from " << source << ": " << inputs.size() << " file(s), " << workQueue->total_bytes
+         << " bytes in " << workQueue->item_count << " item(s)." << endl;
+    return true;
+}
 
-    wordBuffer->active_producers_count++;
-    cout << "Producer: Active producers count: " << wordBuffer->active_producers_count.load() << endl;
+// Reads the offset saved by an earlier --follow run; a missing file means start from 0.
+// Returns false (after reporting) if the file exists but cannot be read.
+bool load_offset(const string& path, uint64_t& offset) {
+    offset = 0;
+    FILE* file = fopen(path.c_str(), "r");
+    if (!file) {
+        if (errno == ENOENT)
+            return true;
+        perror(("Producer: Failed to open offset file " + path).c_str());
+        return false;
+    }
+    unsigned long long value = 0;
+    bool ok = fscanf(file, "%llu", &value) == 1;
+    fclose(file);
+    if (!ok) {
+        cerr << "Producer: Offset file " << path << " is corrupt; remove it to start from the beginning." << endl;
+        return false;
+    }
+    offset = value;
+    return true;
+}
 
+// Replaces the offset file through a temporary file and a rename, so a crash leaves the old or the new offset
+bool save_offset(const string& path, uint64_t offset) {
+    string tmp = path + ".tmp";
+    string text = to_string(offset) + "\n";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    bool ok = fd != -1 && write(fd, text.data(), text.size()) == (ssize_t)text.size() && fsync(fd) == 0;
+    if (fd != -1 && close(fd) == -1)
+        ok = false;
+    if (!ok || rename(tmp.c_str(), path.c_str()) == -1) {
+        perror(("Producer: Failed to save offset file " + path).c_str());
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
 
-    // Open input file
-    ifstream inputFile(inputFileName);
-    if (!inputFile.is_open()) {
-        perror(("Producer: Failed to open input file: " + string(inputFileName)).c_str());
-        // Decrement count if file can't be opened, as this producer won't contribute words
-        wordBuffer->active_producers_count--;
-        return cleanUp(shm_fd, wordBuffer, sem_empty, sem_full, sem_mutex, true);
+// Tails a growing file from the offset saved in `offset_path` until `running` is cleared. Each
+// piece of new text, cut after its last whitespace byte so a word still being written is held back,
+// goes to process(char* data, size_t size), which must have published every word of it when it
+// returns 0; only then is the offset advanced and saved. Words are therefore delivered at least
+// once: a crash between publishing and saving sends that piece again. A file that shrinks below the
+// offset is taken to have been truncated and is read again from the start.
+// Returns 0 once stopped, otherwise the status process() or a failed read returned.
+template <typename Process>
+int follow_file(const char* path, const string& offset_path, Process&& process) {
+    uint64_t offset = 0;
+    if (!load_offset(offset_path, offset))
+        return -1;
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        perror(("Producer: Failed to open input file: " + string(path)).c_str());
+        return -1;
+    }
+    // inotify saves waiting out the poll timeout after each write; without it we just poll
+    int inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd != -1 && inotify_add_watch(inotify_fd, path, IN_MODIFY | IN_ATTRIB) == -1) {
+        close(inotify_fd);
+        inotify_fd = -1;
     }
+    cout << "Producer: Following " << path << " from offset " << offset << " (saved in " << offset_path << ")." << endl;
+
+    vector<char> buffer(FOLLOW_READ_SIZE);
+    int status = 0;
+    while (status == 0 && running.load()) {
+        struct stat st;
+        if (fstat(fd, &st) == -1) {
+            perror("Producer: fstat input file failed");
+            status = -1;
+            break;
+        }
+        uint64_t size = st.st_size;
+        if (size < offset) {
+            cout << "Producer: " << path << " shrank below offset " << offset << "; reading it again from the start." << endl;
+            offset = 0;
+            save_offset(offset_path, offset);
+        }
+        if (size > offset) {
+            ssize_t got = pread(fd, buffer.data(), min<uint64_t>(buffer.size(), size - offset), offset);
+            if (got == -1 && errno == EINTR)
+                continue;
+            if (got == -1) {
+                perror("Producer: read input file failed");
+                status = -1;
+                break;
+            }
+            // Hold back a trailing partial word, unless it fills the whole buffer on its own
+            size_t usable = got;
+            while (usable > 0 && !is_word_space((unsigned char)buffer[usable - 1]))
+                usable--;
+            if (usable == 0 && (size_t)got == buffer.size())
+                usable = got;
+            if (usable > 0) {
+                status = process(buffer.data(), usable);
+                if (status != 0 || !running.load())
+                    break; // Not all of the piece may have been published: leave the offset before it
+                offset += usable;
+                save_offset(offset_path, offset);
+                continue;
+            }
+        }
+        if (inotify_fd == -1) {
+            usleep(FOLLOW_POLL_MS * 1000);
+            continue;
+        }
+        struct pollfd pfd = {inotify_fd, POLLIN, 0};
+        if (poll(&pfd, 1, FOLLOW_POLL_MS) > 0) {
+            char events[4096];
+            while (read(inotify_fd, events, sizeof(events)) > 0) {
+            }
+        }
+    }
+    if (inotify_fd != -1)
+        close(inotify_fd);
+    close(fd);
+    return status;
+}
 
-    string rawWord;
-    int words_produced = 0;
+// Parses a positive integer option within [min_value, max_value]; returns false if out of range
+bool parse_uint_option(const char* name, const char* text, uint32_t min_value, uint32_t max_value, uint32_t& out) {
+    char* end = nullptr;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (end == text || *end != '\0' || value < min_value || value > max_value) {
+        cerr << "Error: --" << name << " must be between " << min_value << " and " << max_value << "." << endl;
+        return false;
+    }
+    out = (uint32_t)value;
+    return true;
+}
 
-    // Read from file and Write Words to Shared Memory
-    while (running.load() && (inputFile >> rawWord)) {
-        string cleaned = cleanWord(rawWord);
+// Parses --part "I/N" (1 <= I <= N); returns false if malformed
+bool parse_part_option(const char* text, uint32_t& index, uint32_t& parts) {
+    char* slash = nullptr;
+    unsigned long long i = strtoull(text, &slash, 10);
+    char* end = nullptr;
+    unsigned long long n = (slash != text && *slash == '/') ? strtoull(slash + 1, &end, 10) : 0;
+    if (!end || end == slash + 1 || *end != '\0' || n < 1 || n > UINT32_MAX || i < 1 || i > n) {
+        cerr << "Error: --part expects I/N with 1 <= I <= N, e.g. --part 2/8." << endl;
+        return false;
+    }
+    index = (uint32_t)i - 1;
+    parts = (uint32_t)n;
+    return true;
+}
 
-        if (cleaned.empty()) { // Skip empty strings after cleaning
-            continue;
+int main(int argc, char* argv[]) {
+    int requested_queue_kind = QUEUE_LOCKFREE;
+    uint32_t slot_size = DEFAULT_SLOT_SIZE;
+    uint32_t ring_depth = DEFAULT_RING_DEPTH;
+    uint32_t partitions = DEFAULT_PARTITIONS;
+    uint32_t combiner_memory = 0; // 0 disables the combiner
+    bool bench_mode = false;      // No simulated work and no per-word logging
+    uint32_t part_index = 0;      // With --part, this producer reads only slice part_index of part_count
+    uint32_t part_count = 1;
+    bool follow_mode = false;     // Tail the file instead of reading it once
+    string offset_path;           // Where follow mode keeps its position; <input_file>.offset by default
+    string manifest_path;         // With --manifest, the pool claims the files listed there
+    uint32_t work_chunk_size = DEFAULT_WORK_CHUNK_SIZE; // Work queue slice size for large files
+    bool chunk_size_set = false;
+    uint32_t segment_flags = 0;   // SegmentFlags for a buffer this producer creates
+    bool prefault_segment = false; // Fault the whole buffer in when creating it
+    string cpu_list;              // With --cpus, run only on these CPUs
+    Normalization normalization = NORMALIZE_ASCII; // Which bytes words keep and how they are folded
+    uint32_t dictionary_words = 0; // With --intern, the capacity of the dictionary this producer creates
+
+    static const struct option long_options[] = {
+        {"queue", required_argument, nullptr, 'q'},
+        {"slot-size", required_argument, nullptr, 's'},
+        {"ring-depth", required_argument, nullptr, 'd'},
+        {"partitions", required_argument, nullptr, 'p'},
+        {"combine", optional_argument, nullptr, 'c'},
+        {"bench", no_argument, nullptr, 'b'},
+        {"part", required_argument, nullptr, 'P'},
+        {"follow", no_argument, nullptr, 'f'},
+        {"offset-file", required_argument, nullptr, 'O'},
+        {"manifest", required_argument, nullptr, 'm'},
+        {"chunk-size", required_argument, nullptr, 'k'},
+        {"huge-pages", no_argument, nullptr, 'H'},
+        {"prefault", no_argument, nullptr, 'F'},
+        {"cpus", required_argument, nullptr, 'C'},
+        {"normalize", required_argument, nullptr, 'n'},
+        {"intern", optional_argument, nullptr, 'I'},
+        {"job", required_argument, nullptr, 'j'},
+        {nullptr, 0, nullptr, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "q:s:d:p:", long_options, nullptr)) != -1) {
+        switch (opt) {
+        case 'q':
+            requested_queue_kind = parse_queue_kind(optarg);
+            if (requested_queue_kind == -1) {
+                cerr << "Error: unknown queue implementation '" << optarg << "'." << endl;
+                return 1;
+            }
+            break;
+        case 's':
+            if (!parse_uint_option("slot-size", optarg, MIN_SLOT_SIZE, MAX_SLOT_SIZE, slot_size))
+                return 1;
+            break;
+        case 'd':
+            if (!parse_uint_option("ring-depth", optarg, MIN_RING_DEPTH, MAX_RING_DEPTH, ring_depth))
+                return 1;
+            break;
+        case 'p':
+            if (!parse_uint_option("partitions", optarg, 1, MAX_PARTITIONS, partitions))
+                return 1;
+            break;
+        case 'c':
+            combiner_memory = DEFAULT_COMBINER_MEMORY;
+            if (optarg && !parse_uint_option("combine", optarg, MIN_COMBINER_MEMORY, UINT32_MAX, combiner_memory))
+                return 1;
+            break;
+        case 'b':
+            bench_mode = true;
+            break;
+        case 'P':
+            if (!parse_part_option(optarg, part_index, part_count))
+                return 1;
+            break;
+        case 'f':
+            follow_mode = true;
+            break;
+        case 'O':
+            offset_path = optarg;
+            break;
+        case 'm':
+            manifest_path = optarg;
+            break;
+        case 'k':
+            if (!parse_uint_option("chunk-size", optarg, MIN_WORK_CHUNK_SIZE, UINT32_MAX, work_chunk_size))
+                return 1;
+            chunk_size_set = true;
+            break;
+        case 'H':
+            segment_flags |= SEGMENT_HUGE_PAGES;
+            break;
+        case 'F':
+            prefault_segment = true;
+            break;
+        case 'C':
+            cpu_list = optarg;
+            break;
+        case 'n':
+            if (!parse_normalization(optarg, normalization)) {
+                cerr << "Error: --normalize must be ascii, ascii-punct or utf8." << endl;
+                return 1;
+            }
+            break;
+        case 'I':
+            dictionary_words = DEFAULT_DICTIONARY_WORDS;
+            if (optarg && !parse_uint_option("intern", optarg, MIN_DICTIONARY_WORDS, MAX_DICTIONARY_WORDS, dictionary_words))
+                return 1;
+            segment_flags |= SEGMENT_INTERNED;
+            break;
+        case 'j':
+            if (!valid_job_id(optarg)) {
+                cerr << "Error: --job expects an ID of up to " << MAX_JOB_ID_LENGTH << " letters, digits, '_' or '-'." << endl;
+                return 1;
+            }
+            job = JobNames(optarg);
+            break;
+        default:
+            print_usage(argv[0]);
+            return 1;
         }
+    }
+    if ((optind >= argc) == manifest_path.empty()) { // Exactly one of an input and a manifest
+        print_usage(argv[0]);
+        return 1;
+    }
+    const char* inputFileName = manifest_path.empty() ? argv[optind] : manifest_path.c_str();
+    // A directory, glob or manifest is shared out to the whole pool through the work queue
+    bool queue_mode = !manifest_path.empty() || is_work_source(inputFileName);
+    if (queue_mode && (follow_mode || part_count > 1)) {
+        cerr << "Error: --follow and --part apply to a single input file, not to a directory, glob or manifest." << endl;
+        return 1;
+    }
+    if (chunk_size_set && !queue_mode) {
+        cerr << "Error: --chunk-size only applies to a directory, glob or manifest." << endl;
+        return 1;
+    }
+    if (follow_mode && part_count > 1) {
+        cerr << "Error: --follow reads the whole file; it cannot be combined with --part." << endl;
+        return 1;
+    }
+    if (!offset_path.empty() && !follow_mode) {
+        cerr << "Error: --offset-file only applies with --follow." << endl;
+        return 1;
+    }
+    if (follow_mode && offset_path.empty())
+        offset_path = string(inputFileName) + ".offset";
+    // gzip and zstd inputs are recognized by their magic bytes and decompressed on the fly
+    Compression compression = queue_mode ? COMPRESSION_NONE : detect_compression(inputFileName);
+    if (compression != COMPRESSION_NONE && (follow_mode || part_count > 1)) {
+        cerr << "Error: " << inputFileName << " is " << compression_name(compression) << "-compressed; --follow and --part need an uncompressed file." << endl;
+        return 1;
+    }
+    if (!compression_supported(compression)) {
+        cerr << "Error: " << inputFileName << " is " << compression_name(compression) << "-compressed, but this producer was built without "
+             << compression_name(compression) << " support (rebuild with make ZLIB=1 / ZSTD=1)." << endl;
+        return 1;
+    }
 
-        if (sem_wait(sem_empty) == -1) {
-            if (errno == EINTR) {
-                if (!running.load()) 
-                    break;
-                continue;
+    cout << "Word Producer Process Started. Reading from: " << inputFileName;
+    if (part_count > 1)
+        cout << " (part " << part_index + 1 << " of " << part_count << ")";
+    if (follow_mode)
+        cout << " (following)";
+    if (compression != COMPRESSION_NONE)
+        cout << " (" << compression_name(compression) << ")";
+    if (queue_mode)
+        cout << (manifest_path.empty() ? " (work queue)" : " (work queue, manifest)");
+    if (normalization != NORMALIZE_ASCII)
+        cout << " (normalization: " << normalization_name(normalization) << ")";
+    if (!job.id.empty())
+        cout << " (job " << job.id << ")";
+    cout << endl;
+
+    // Register signal handler for graceful shutdown; a follower runs until stopped, usually with SIGTERM
+    if (signal(SIGINT, signal_handler) == SIG_ERR || (follow_mode && signal(SIGTERM, signal_handler) == SIG_ERR)) {
+        perror("Producer: signal failed");
+        return 1;
+    }
+
+    // Pin before touching shared memory, so pages this producer faults in come from its own node
+    if (!cpu_list.empty()) {
+        vector<int> cpus;
+        if (!parse_cpu_list(cpu_list, cpus)) {
+            cerr << "Error: --cpus expects a CPU list such as 0-3,8." << endl;
+            return 1;
+        }
+        if (!pin_to_cpus(cpus)) {
+            perror("Producer: sched_setaffinity failed");
+            return 1;
+        }
+        cout << "Producer: Pinned to CPUs " << cpu_list << " (NUMA node " << current_numa_node() << ")." << endl;
+    }
+
+    int shm_fd = -1;
+    SharedWordBuffer* wordBuffer = static_cast<SharedWordBuffer*> MAP_FAILED;
+    vector<QueueSemaphores> sems; // One set per partition, semaphore queue only
+
+    // Open Shared Memory. Exactly one producer creates it and chooses the queue and geometry; a
+    // segment that no running process holds is left over from an earlier job and is replaced.
+    string shm_name = job.ipc(SHARED_MEM_NAME);
+    bool attached = false;
+    for (;;) {
+        shm_fd = create_job_segment(shm_name);
+        if (shm_fd != -1 || errno != EEXIST)
+            break;
+        bool reclaimed = false;
+        shm_fd = attach_job_segment(shm_name, O_RDWR, reclaimed);
+        if (shm_fd != -1 || errno != ENOENT) {
+            attached = true;
+            break;
+        }
+        if (reclaimed)
+            cout << "Producer: Removed the shared word buffer of an earlier job that finished or crashed." << endl;
+    }
+    if (shm_fd != -1 && !attached) {
+        cout << "Producer: Initializing shared word buffer for the first time (queue: " << queue_kind_name(requested_queue_kind)
+             << ", " << partitions << " partition(s) of " << ring_depth << " blocks of " << slot_size << " bytes)." << endl;
+
+        // Configure Shared Memory Size
+        mapped_size = shared_segment_size(partitions, ring_depth, slot_size, segment_flags);
+        if (ftruncate(shm_fd, mapped_size) == -1) {
+            perror("Producer: ftruncate failed");
+            return cleanUp(shm_fd, wordBuffer, sems, true);
+        }
+
+        // Map Shared Memory to Process Address Space
+        wordBuffer = (SharedWordBuffer*) mmap(0, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+        if (wordBuffer == MAP_FAILED) {
+            perror("Producer: mmap failed");
+            return cleanUp(shm_fd, wordBuffer, sems, true);
+        }
+
+        // Huge pages cut TLB misses on large rings; without them the segment simply uses normal pages
+        if (segment_flags & SEGMENT_HUGE_PAGES) {
+            if (!advise_huge_pages(wordBuffer, mapped_size))
+                perror("Producer: madvise(MADV_HUGEPAGE) failed; using normal pages");
+            else if (!shmem_huge_pages_available())
+                cout << "Producer: Huge pages requested, but shared memory THP is set to '" << thp_setting("shmem_enabled")
+                     << "' (/sys/kernel/mm/transparent_hugepage/shmem_enabled); using normal pages." << endl;
+        }
+        if (prefault_segment) {
+            prefault(wordBuffer, mapped_size);
+            cout << "Producer: Pre-faulted " << mapped_size << " bytes of shared memory." << endl;
+        }
+
+        // Semaphores are created before the buffer is published as initialized
+        if (requested_queue_kind == QUEUE_SEMAPHORE) {
+            sems.resize(partitions);
+            for (uint32_t p = 0; p < partitions; ++p) {
+                if (!open_queue_semaphores(job, p, true, ring_depth, sems[p])) {
+                    perror("Producer: sem_open failed");
+                    return cleanUp(shm_fd, wordBuffer, sems, true);
+                }
             }
-            perror("Producer: sem_wait SEM_EMPTY_NAME failed");
-            inputFile.close();
-            return cleanUp(shm_fd, wordBuffer, sem_empty, sem_full, sem_mutex, true);
         }
 
-        if (sem_wait(sem_mutex) == -1) {
-            if (errno == EINTR) {
-                if (!running.load()) {
-                    sem_post(sem_empty); // Release previously acquired sem_empty
-                    break;
+        // A work queue left by an earlier job would hand out its inputs, or none; nobody can be
+        // using it before the buffer is published
+        shm_unlink(job.ipc(WORK_QUEUE_NAME).c_str());
+
+        if (dictionary_words > 0) {
+            if (!create_dictionary(dictionary_words))
+                return cleanUp(shm_fd, wordBuffer, sems, true);
+            cout << "Producer: Interning words in a shared dictionary of up to " << dictionary_words << " words." << endl;
+        }
+
+        init_shared_buffer(wordBuffer, requested_queue_kind, partitions, ring_depth, slot_size, segment_flags);
+    } else if (shm_fd != -1) {
+        cout << "Producer: Shared word buffer already initialized by another process." << endl;
+        wordBuffer = map_initialized_buffer(shm_fd, running, 1000, mapped_size);
+        if (wordBuffer == MAP_FAILED)
+            return cleanUp(shm_fd, wordBuffer, sems, true);
+
+        BlockRing& ring = wordBuffer->partition(0).ring;
+        if (wordBuffer->queue_kind.load() != requested_queue_kind || wordBuffer->partition_count != partitions
+            || ring.capacity != ring_depth || ring.slot_size != slot_size) {
+            cout << "Producer: Using the existing " << queue_kind_name(wordBuffer->queue_kind.load()) << " queue ("
+                 << wordBuffer->partition_count << " partition(s) of " << ring.capacity << " blocks of " << ring.slot_size << " bytes)." << endl;
+        }
+        if ((segment_flags & SEGMENT_HUGE_PAGES) || prefault_segment)
+            cout << "Producer: --huge-pages and --prefault only apply to the producer that creates the buffer." << endl;
+
+        // Whether words are interned is the creator's choice, like the queue
+        if (wordBuffer->segment_flags & SEGMENT_INTERNED) {
+            string error;
+            dictionary = map_dictionary(job.ipc(DICTIONARY_NAME), true, dictionary_mapped_size, error);
+            if (dictionary == MAP_FAILED) {
+                cerr << "Producer: Cannot use the job's dictionary: " << error << endl;
+                return cleanUp(shm_fd, wordBuffer, sems, true);
+            }
+            cout << "Producer: Interning words in the job's shared dictionary." << endl;
+        } else if (dictionary_words > 0) {
+            cout << "Producer: --intern only applies to the producer that creates the buffer; this job ships words." << endl;
+        }
+
+        if (wordBuffer->queue_kind.load() == QUEUE_SEMAPHORE) {
+            sems.resize(wordBuffer->partition_count);
+            for (uint32_t p = 0; p < wordBuffer->partition_count; ++p) {
+                if (!open_queue_semaphores(job, p, false, 0, sems[p])) {
+                    perror("Producer: sem_open failed");
+                    return cleanUp(shm_fd, wordBuffer, sems, true);
                 }
-                continue;
             }
-            perror("Producer: sem_wait SEM_MUTEX_NAME failed");
-            sem_post(sem_empty); // If mutex fails, release sem_empty to avoid deadlock
-            inputFile.close();
-            return cleanUp(shm_fd, wordBuffer, sem_empty, sem_full, sem_mutex, true);
         }
+    } else {
+        perror("Producer: shm_open failed");
+        return cleanUp(shm_fd, wordBuffer, sems, true);
+    }
 
-        WordEntry newEntry;
-        strncpy(newEntry.word, cleaned.c_str(), MAX_WORD_LENGTH  - 1);
-        newEntry.word[MAX_WORD_LENGTH - 1] = '\0';
+    StatsBlock& sharedStats = wordBuffer->stats();
+    stats = claim_stats_slot(sharedStats.producer_slots, sharedStats.producers, &unpublished_stats, getpid());
+    wordBuffer->active_producers_count++;
+    cout << "Producer: Active producers count: " << wordBuffer->active_producers_count.load() << endl;
+    if (wordBuffer->state.load() == JOB_CLOSED) { // Every producer the consumers waited for has already left
+        cerr << "Producer: The job in shared memory has already finished; start new producers once its consumers have exited, or use another --job." << endl;
+        wordBuffer->active_producers_count--;
+        stats->state.store(STATS_SLOT_DONE);
+        return cleanUp(shm_fd, wordBuffer, sems, true);
+    }
 
-        wordBuffer->entries[wordBuffer->head] = newEntry;
-        wordBuffer->head = (wordBuffer->head + 1) % MAX_WORD_ENTRIES;
 
-        cout << "Producer: Wrote word [" << newEntry.word << "]" << endl;
-        words_produced++;
+    // Map input file; the tokenizer lowercases and compacts words in this private mapping.
+    // Follow mode reads the file piece by piece instead, as it grows, a compressed file is
+    // decompressed into chunk buffers by a decoder thread, and in queue mode each claimed file is
+    // opened in turn.
+    MappedFile inputFile;
+    DecompressingReader decompressed;
+    if (queue_mode && !open_work_queue(inputFileName, !manifest_path.empty(), work_chunk_size)) {
+        leave_job(wordBuffer, sems);
+        return cleanUp(shm_fd, wordBuffer, sems, true);
+    }
+    bool opened = follow_mode || queue_mode ? true
+                  : compression != COMPRESSION_NONE ? decompressed.open(inputFileName, compression) : inputFile.open(inputFileName);
+    if (!opened) {
+        if (compression != COMPRESSION_NONE)
+            cerr << "Producer: Failed to open input file: " << inputFileName << ": " << decompressed.error() << endl;
+        else
+            perror(("Producer: Failed to open input file: " + string(inputFileName)).c_str());
+        // This producer won't contribute words, but the job must not wait for it either
+        leave_job(wordBuffer, sems);
+        return cleanUp(shm_fd, wordBuffer, sems, true);
+    }
 
-        if (sem_post(sem_mutex) == -1)
-            perror("Producer: sem_post SEM_MUTEX_NAME failed");
+    uint64_t words_produced = 0;
+    int status = 0;
 
-        if (sem_post(sem_full) == -1) {
-            perror("Producer: sem_post SEM_FULL_NAME failed");
+    // One open block per partition; every word goes to the partition that owns its hash
+    uint32_t partition_count = wordBuffer->partition_count;
+    vector<BlockPublisher> publishers;
+    publishers.reserve(partition_count);
+    for (uint32_t p = 0; p < partition_count; ++p) {
+        publishers.emplace_back(wordBuffer, p, sems, combiner_memory > 0);
+    }
+    // An interned job ships IDs; words the full dictionary cannot take still go out as words
+    vector<BlockPublisher> id_publishers;
+    uint64_t words_not_interned = 0;
+    if (dictionary != MAP_FAILED) {
+        id_publishers.reserve(partition_count);
+        for (uint32_t p = 0; p < partition_count; ++p)
+            id_publishers.emplace_back(wordBuffer, p, sems, combiner_memory > 0, true);
+    }
+    auto add_record = [&](const char* word, uint8_t length, uint64_t count) {
+        uint64_t hash = hash_word(word, length);
+        uint32_t partition = partition_for_hash(hash, partition_count);
+        if (dictionary != MAP_FAILED) {
+            uint32_t id = dictionary->intern(word, length, hash);
+            if (id != NO_WORD_ID)
+                return id_publishers[partition].add_id(id, count);
+            words_not_interned += count;
+        }
+        return publishers[partition].add(word, length, count);
+    };
+
+    // Optional pre-aggregation: repeated words are counted locally and shipped as (word, count) records
+    unique_ptr<WordCombiner> combiner;
+    if (combiner_memory > 0) {
+        combiner.reset(new WordCombiner(combiner_memory));
+        cout << "Producer: Combining word counts locally (" << combiner_memory << " bytes)." << endl;
+    }
+    auto flush_combiner = [&]() {
+        combiner->flush([&](const char* word, uint8_t length, uint64_t count) {
+            status = add_record(word, length, count);
+            return status == 0;
+        });
+        return status;
+    };
+
+    // Pack words into blocks and publish each full block to Shared Memory
+    auto publish_word = [&](const char* word, size_t length) {
+        length = truncate_word(word, length, MAX_WORD_LENGTH - 1);
+
+        if (combiner) {
+            if (!combiner->add(word, (uint8_t)length)) { // Table full: ship its counts and start over
+                if (flush_combiner() != 0)
+                    return false;
+                combiner->add(word, (uint8_t)length);
+            }
+        } else {
+            status = add_record(word, (uint8_t)length, 1);
+            if (status != 0) // Interrupted by SIGINT, or a semaphore error
+                return false;
         }
 
+        words_produced++;
+        if (bench_mode)
+            return running.load();
+
+        cout << "Producer: Wrote word [" << string_view(word, length) << "]" << endl;
+
         // Simulate some work, allowing consumer to run
         if (running.load()) {
             usleep(rand() % 50000 + 10000); // Sleep for 10-60ms
         }
+        return running.load();
+    };
+
+    // Ship whatever the combiner still holds, then the partially filled blocks
+    auto flush_all = [&]() {
+        if (status == 0 && running.load() && combiner)
+            flush_combiner();
+        for (vector<BlockPublisher>* group : {&publishers, &id_publishers}) {
+            for (BlockPublisher& publisher : *group) {
+                if (status == 0 && running.load())
+                    status = publisher.finish();
+            }
+        }
+        return status;
+    };
+
+    // Tokenize each chunk while the decoder thread fills the other buffer. Returns false on a decoding error.
+    auto read_decompressed = [&](DecompressingReader& reader, const char* name) {
+        char* data;
+        size_t size;
+        bool decoded;
+        while ((decoded = reader.next(data, size)) && size > 0) {
+            if (!tokenize_normalized(normalization, data, size, publish_word))
+                break;
+        }
+        reader.close();
+        if (!decoded) {
+            cerr << "Producer: Failed to decompress " << name << ": " << reader.error() << endl;
+            return false;
+        }
+        cout << "Producer: Decompressed " << reader.compressed_bytes() << " bytes into " << reader.decompressed_bytes()
+             << " (" << reader.decode_seconds() << " s decoding)." << endl;
+        return true;
+    };
+
+    // With several parts only slice `index`; words crossing a slice edge go to the part they start in
+    auto read_mapped = [&](MappedFile& file, uint32_t index, uint32_t parts) {
+        size_t range_begin = 0, range_end = file.size();
+        if (parts > 1) {
+            word_aligned_part(file.data(), file.size(), index, parts, range_begin, range_end);
+            cout << "Producer: Reading bytes [" << range_begin << ", " << range_end << ") of " << file.size() << "." << endl;
+        }
+        tokenize_mapped(normalization, file, range_begin, range_end, publish_word);
+        file.close();
+    };
+
+    if (follow_mode) {
+        // Every piece is flushed completely before its offset is saved
+        status = follow_file(inputFileName, offset_path, [&](char* data, size_t size) {
+            tokenize_normalized(normalization, data, size, publish_word);
+            return flush_all();
+        });
+    } else if (queue_mode) {
+        // Claim items until the queue runs dry; a file that cannot be read is reported and skipped
+        WorkItem item;
+        uint64_t index;
+        uint64_t items_read = 0, items_failed = 0;
+        while (status == 0 && running.load() && workQueue->claim(item, index)) {
+            const char* path = workQueue->path(item);
+            cout << "Producer: Claimed item " << index + 1 << " of " << workQueue->item_count << ": " << path;
+            if (item.part_count > 1)
+                cout << " (part " << item.part_index + 1 << " of " << item.part_count << ")";
+            cout << endl;
+
+            Compression kind = detect_compression(path);
+            bool read = false;
+            if (!compression_supported(kind)) {
+                cerr << "Producer: Skipping " << path << ": " << compression_name(kind) << " support was not built in." << endl;
+            } else if (kind != COMPRESSION_NONE) {
+                DecompressingReader reader;
+                if (reader.open(path, kind))
+                    read = read_decompressed(reader, path);
+                else
+                    cerr << "Producer: Failed to open input file: " << path << ": " << reader.error() << endl;
+            } else {
+                MappedFile file;
+                if (file.open(path)) {
+                    read_mapped(file, item.part_index, item.part_count);
+                    read = true;
+                } else {
+                    perror(("Producer: Failed to open input file: " + string(path)).c_str());
+                }
+            }
+            if (read)
+                items_read++;
+            else
+                items_failed++;
+        }
+        flush_all();
+        cout << "Producer: Read " << items_read << " work item(s)";
+        if (items_failed > 0)
+            cout << "; " << items_failed << " could not be read";
+        cout << "." << endl;
+        if (items_failed > 0 && status == 0)
+            status = -1;
+    } else if (compression != COMPRESSION_NONE) {
+        if (!read_decompressed(decompressed, inputFileName))
+            status = -1;
+        flush_all();
+    } else {
+        read_mapped(inputFile, part_index, part_count);
+        flush_all();
     }
-
-    inputFile.close();
-
-    // Send this producer's EOF signal
-    if (running.load()) { // Only send if not interrupted by SIGINT
-        cout << "Producer: Finished reading file. Sending my EOF signal..." << endl;
-        send_eof_signal(wordBuffer, sem_empty, sem_full, sem_mutex);
+    int blocks_published = 0;
+    for (vector<BlockPublisher>* group : {&publishers, &id_publishers}) {
+        for (BlockPublisher& publisher : *group)
+            blocks_published += publisher.blocks_published();
     }
-
-    int remaining_producers = --wordBuffer->active_producers_count;
-    cout << "Producer: My file is done. Remaining active producers: " << remaining_producers << endl;
-
-    // If this is the last producer, send multiple EOF signals to unblock all consumers
-    if (running.load() && remaining_producers == 0) {
-        cout << "Producer: I am the last producer. Sending multiple EOF signals to unblock consumers." << endl;
-        for (int i = 0; i < MAX_WORD_ENTRIES; ++i) { // Send enough EOFs to fill the buffer
-            send_eof_signal(wordBuffer, sem_empty, sem_full, sem_mutex);
-            // Small delay to allow consumers to pick up if they are very fast
-            usleep(10000);
-        }
+    if (dictionary != MAP_FAILED) {
+        cout << "Producer: The dictionary has handed out " << dictionary->id_count() << " of " << dictionary->capacity << " word IDs";
+        if (words_not_interned > 0)
+            cout << "; it was full for " << words_not_interned << " word(s), sent as words";
+        cout << "." << endl;
     }
 
+    if (status == 0 && running.load())
+        cout << "Producer: Finished reading file." << endl;
+    leave_job(wordBuffer, sems);
+    if (status == -1)
+        return cleanUp(shm_fd, wordBuffer, sems, true);
 
-    cout << "Producer Process Shutting Down. Total words produced: " << words_produced << endl;
-    return cleanUp(shm_fd, wordBuffer, sem_empty, sem_full, sem_mutex);
-}
\ No newline at end of file
+    cout << "Producer Process Shutting Down. Total words produced: " << words_produced << " in " << blocks_published << " blocks" << endl;
+    return cleanUp(shm_fd, wordBuffer, sems);
+}
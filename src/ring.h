@@ -0,0 +1,192 @@
+#ifndef RING_H
+#define RING_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+#include "futex.h"
+#include "word_block.h"
+
+// Spin iterations before a blocked push/pop parks on its futex
+const int RING_SPIN_LIMIT = 128;
+
+// Each slot starts with its own cache line holding the sequence number, followed by the block bytes
+struct alignas(CACHE_LINE_SIZE) RingSlotHeader {
+    std::atomic<uint64_t> sequence;
+};
+
+// Bounded multi-producer/multi-consumer ring of fixed-size byte blocks (Vyukov-style).
+// Every slot carries a sequence number that tells a producer or consumer whether the slot
+// is ready for it, so head and tail are claimed with a single CAS and no lock is ever taken.
+// Lives directly in shared memory; the slots follow at `slots_offset` bytes from the ring itself,
+// so depth and block size are chosen at startup rather than compiled in.
+struct BlockRing {
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> enqueue_pos; // Next position a producer will claim
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> dequeue_pos; // Next position a consumer will claim
+    FutexEvent not_empty; // Consumers park here when the ring is empty
+    FutexEvent not_full;  // Producers park here when the ring is full
+
+    // Geometry, written once by init() before the buffer is marked ready
+    alignas(CACHE_LINE_SIZE) uint32_t capacity; // Number of slots
+    uint32_t slot_size;    // Usable bytes per slot
+    uint64_t slot_stride;  // Distance between consecutive slots
+    uint64_t slots_offset; // Offset of slot 0 from the start of this struct
+    std::atomic<uint32_t> closed; // Set once no producer will push again; consumers then drain and stop
+
+    static uint64_t stride_for(uint32_t slot_size) {
+        uint64_t raw = sizeof(RingSlotHeader) + slot_size;
+        return (raw + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+    }
+
+    static uint64_t slots_bytes(uint32_t capacity, uint32_t slot_size) {
+        return (uint64_t)capacity * stride_for(slot_size);
+    }
+
+    void init(uint32_t ring_capacity, uint32_t ring_slot_size, uint64_t ring_slots_offset) {
+        capacity = ring_capacity;
+        slot_size = ring_slot_size;
+        slot_stride = stride_for(ring_slot_size);
+        slots_offset = ring_slots_offset;
+        for (uint32_t i = 0; i < capacity; ++i) {
+            slot(i)->sequence.store(i, std::memory_order_relaxed);
+        }
+        enqueue_pos.store(0, std::memory_order_relaxed);
+        dequeue_pos.store(0, std::memory_order_relaxed);
+        closed.store(0, std::memory_order_relaxed);
+        not_empty.epoch.store(0);
+        not_empty.waiters.store(0);
+        not_full.epoch.store(0);
+        not_full.waiters.store(0);
+    }
+
+    RingSlotHeader* slot(uint64_t index) {
+        return reinterpret_cast<RingSlotHeader*>(reinterpret_cast<char*>(this) + slots_offset + index * slot_stride);
+    }
+
+    char* slot_data(uint64_t index) {
+        return reinterpret_cast<char*>(slot(index)) + sizeof(RingSlotHeader);
+    }
+
+    // Copies `bytes` (<= slot_size) into the next free slot
+    bool try_push(const char* block, uint32_t bytes) {
+        uint64_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        for (;;) {
+            uint64_t index = pos % capacity;
+            uint64_t seq = slot(index)->sequence.load(std::memory_order_acquire);
+            int64_t diff = (int64_t)seq - (int64_t)pos;
+            if (diff == 0) {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    memcpy(slot_data(index), block, bytes);
+                    slot(index)->sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false; // Full: the slot still holds a block from the previous lap
+            } else {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Claims the next filled slot for reading in place. The slot stays owned by the caller
+    // (and is not reused by producers) until pop_end(pos) is called.
+    char* try_pop_begin(uint64_t& claimed_pos) {
+        uint64_t pos = dequeue_pos.load(std::memory_order_relaxed);
+        for (;;) {
+            uint64_t index = pos % capacity;
+            uint64_t seq = slot(index)->sequence.load(std::memory_order_acquire);
+            int64_t diff = (int64_t)seq - (int64_t)(pos + 1);
+            if (diff == 0) {
+                if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    claimed_pos = pos;
+                    return slot_data(index);
+                }
+            } else if (diff < 0) {
+                return nullptr; // Empty: no producer has published this position yet
+            } else {
+                pos = dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void pop_end(uint64_t claimed_pos) {
+        slot(claimed_pos % capacity)->sequence.store(claimed_pos + capacity, std::memory_order_release);
+        not_full.notify_all();
+    }
+
+    // Called once every producer is gone: consumers parked on the empty ring wake up and, finding
+    // it closed, return instead of waiting for blocks that will never come
+    void close() {
+        closed.store(1);
+        not_empty.notify_all();
+    }
+
+    // Blocking push. Spins briefly, then sleeps on the not_full futex.
+    // Returns false only if `running` was cleared before the block could be queued.
+    // `blocked` (if given) is set when the ring was full on the first attempt.
+    bool push(const char* block, uint32_t bytes, const std::atomic_bool& running, bool* blocked = nullptr) {
+        for (int spins = 0;; ++spins) {
+            if (try_push(block, bytes)) {
+                not_empty.notify_all();
+                return true;
+            }
+            if (blocked)
+                *blocked = true;
+            if (!running.load())
+                return false;
+            if (spins < RING_SPIN_LIMIT) {
+                cpu_relax();
+                continue;
+            }
+            uint32_t observed = not_full.prepare_wait();
+            if (try_push(block, bytes)) {
+                not_full.cancel_wait();
+                not_empty.notify_all();
+                return true;
+            }
+            not_full.wait(observed);
+        }
+    }
+
+    // Blocking pop_begin, mirror image of push(). Returns nullptr on shutdown, once the ring is
+    // closed and empty, or when the ring is still empty at `deadline_ns` (a monotonic_ns() time;
+    // 0 waits without a deadline). `closed` is read before each attempt, so a block pushed before
+    // the close is always seen by the attempt that follows.
+    char* pop_begin(uint64_t& claimed_pos, const std::atomic_bool& running, bool* blocked = nullptr, uint64_t deadline_ns = 0) {
+        for (int spins = 0;; ++spins) {
+            bool was_closed = closed.load();
+            char* data = try_pop_begin(claimed_pos);
+            if (data)
+                return data;
+            if (was_closed)
+                return nullptr;
+            if (blocked)
+                *blocked = true;
+            if (!running.load())
+                return nullptr;
+            if (spins < RING_SPIN_LIMIT) {
+                cpu_relax();
+                continue;
+            }
+            long timeout_ns = FUTEX_WAIT_TIMEOUT_NS;
+            if (deadline_ns) {
+                uint64_t now = monotonic_ns();
+                if (now >= deadline_ns)
+                    return nullptr;
+                if (deadline_ns - now < (uint64_t)timeout_ns)
+                    timeout_ns = (long)(deadline_ns - now);
+            }
+            uint32_t observed = not_empty.prepare_wait();
+            was_closed = closed.load();
+            data = try_pop_begin(claimed_pos);
+            if (data || was_closed) {
+                not_empty.cancel_wait();
+                return data;
+            }
+            not_empty.wait(observed, timeout_ns);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,397 @@
+#ifndef SKETCH_H
+#define SKETCH_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "hash.h"
+#include "count_run.h"
+#include "tokenizer.h"
+
+// Fixed-size summaries for the approximate mode (consumer --approx, aggregator --approx): the
+// heaviest words with bounded overcounts, and the number of distinct words. Memory depends only on
+// the chosen sizes, never on the vocabulary, and summaries from several consumers can be merged.
+
+const uint32_t DEFAULT_SKETCH_COUNTERS = 16384;
+const uint32_t MIN_SKETCH_COUNTERS = 16;
+const uint32_t MAX_SKETCH_COUNTERS = 1 << 24;
+const uint32_t DEFAULT_HLL_PRECISION = 14; // 16384 registers: about 0.8% standard error
+const uint32_t MIN_HLL_PRECISION = 4;
+const uint32_t MAX_HLL_PRECISION = 18;
+
+// HyperLogLog distinct counter: 2^precision one-byte registers, each keeping the longest run of
+// leading zeros seen among the hashes routed to it. Merging is a register-wise max.
+class HyperLogLog {
+public:
+    explicit HyperLogLog(uint32_t precision = DEFAULT_HLL_PRECISION) : precision_(precision), registers_(size_t(1) << precision, 0) {}
+
+    void add_hash(uint64_t hash) {
+        size_t index = hash >> (64 - precision_);
+        uint64_t rest = (hash << precision_) | (uint64_t(1) << (precision_ - 1)); // Sentinel bit caps the rank
+        uint8_t rank = (uint8_t)(__builtin_clzll(rest) + 1);
+        if (rank > registers_[index])
+            registers_[index] = rank;
+    }
+
+    // Returns false if the two counters have different precisions
+    bool merge(const HyperLogLog& other) {
+        if (other.precision_ != precision_)
+            return false;
+        for (size_t i = 0; i < registers_.size(); ++i)
+            registers_[i] = std::max(registers_[i], other.registers_[i]);
+        return true;
+    }
+
+    // Raw HyperLogLog estimate, with linear counting while many registers are still empty
+    double estimate() const {
+        double m = (double)registers_.size();
+        double sum = 0;
+        size_t zeros = 0;
+        for (uint8_t r : registers_) {
+            sum += std::ldexp(1.0, -r);
+            zeros += r == 0;
+        }
+        double alpha = 0.7213 / (1 + 1.079 / m);
+        double raw = alpha * m * m / sum;
+        if (raw <= 2.5 * m && zeros)
+            return m * std::log(m / zeros);
+        return raw;
+    }
+
+    // Relative standard error of estimate()
+    double standard_error() const { return 1.04 / std::sqrt((double)registers_.size()); }
+
+    uint32_t precision() const { return precision_; }
+    std::vector<uint8_t>& registers() { return registers_; }
+    const std::vector<uint8_t>& registers() const { return registers_; }
+
+private:
+    uint32_t precision_;
+    std::vector<uint8_t> registers_;
+};
+
+// Space-Saving heavy hitters with a fixed number of counters. A word without a counter takes over
+// the one with the smallest count, inheriting that count as its possible overcount (`error`), so
+// every monitored word's true count lies in [count - error, count], and any word occurring more
+// than total / capacity times is guaranteed to be monitored. Counters sit in a min-heap on count;
+// a hash index maps each monitored word to its counter.
+class SpaceSaving {
+public:
+    struct Counter {
+        uint64_t count;
+        uint64_t error;
+        uint32_t heap_pos;
+        uint8_t length;
+        char word[255];
+
+        std::string_view view() const { return std::string_view(word, length); }
+    };
+
+    explicit SpaceSaving(uint32_t capacity = DEFAULT_SKETCH_COUNTERS) : capacity_(capacity) {
+        counters_.reserve(capacity);
+        heap_.reserve(capacity);
+        index_.reserve(capacity);
+    }
+    SpaceSaving(const SpaceSaving&) = delete; // index_ points into counters_
+    SpaceSaving& operator=(const SpaceSaving&) = delete;
+    SpaceSaving(SpaceSaving&&) = default;
+    SpaceSaving& operator=(SpaceSaving&&) = default;
+
+    void add(const char* word, uint8_t length, uint64_t count = 1) {
+        total_ += count;
+        auto found = index_.find(std::string_view(word, length));
+        if (found != index_.end()) {
+            Counter& counter = counters_[found->second];
+            counter.count += count;
+            sift_down(counter.heap_pos);
+            return;
+        }
+        if (counters_.size() < capacity_) {
+            counters_.push_back(Counter());
+            set(counters_.size() - 1, word, length, count, 0);
+            heap_.push_back((uint32_t)counters_.size() - 1);
+            counters_.back().heap_pos = (uint32_t)heap_.size() - 1;
+            sift_up(heap_.size() - 1);
+            return;
+        }
+        uint32_t victim = heap_[0];
+        uint64_t floor = counters_[victim].count;
+        index_.erase(counters_[victim].view());
+        set(victim, word, length, floor + count, floor);
+        sift_down(0);
+    }
+
+    // Restores a counter read back from a saved sketch; the sketch must not be full yet
+    void restore(const char* word, uint8_t length, uint64_t count, uint64_t error) {
+        if (counters_.size() >= capacity_ || index_.count(std::string_view(word, length)))
+            return;
+        counters_.push_back(Counter());
+        set(counters_.size() - 1, word, length, count, error);
+        heap_.push_back((uint32_t)counters_.size() - 1);
+        counters_.back().heap_pos = (uint32_t)heap_.size() - 1;
+        sift_up(heap_.size() - 1);
+    }
+
+    // The most a word without a counter can have been seen: 0 until every counter is in use
+    uint64_t min_count() const { return counters_.size() < capacity_ || heap_.empty() ? 0 : counters_[heap_[0]].count; }
+
+    uint32_t capacity() const { return capacity_; }
+    size_t size() const { return counters_.size(); }
+    uint64_t total() const { return total_; }
+    void set_total(uint64_t total) { total_ = total; }
+    const std::vector<Counter>& counters() const { return counters_; }
+
+private:
+    struct ViewHash {
+        size_t operator()(std::string_view word) const { return hash_word(word.data(), word.size()); }
+    };
+
+    void set(size_t i, const char* word, uint8_t length, uint64_t count, uint64_t error) {
+        Counter& counter = counters_[i];
+        memcpy(counter.word, word, length);
+        counter.length = length;
+        counter.count = count;
+        counter.error = error;
+        index_[counter.view()] = (uint32_t)i;
+    }
+
+    void swap_heap(size_t a, size_t b) {
+        std::swap(heap_[a], heap_[b]);
+        counters_[heap_[a]].heap_pos = (uint32_t)a;
+        counters_[heap_[b]].heap_pos = (uint32_t)b;
+    }
+
+    void sift_up(size_t pos) {
+        while (pos > 0) {
+            size_t parent = (pos - 1) / 2;
+            if (counters_[heap_[parent]].count <= counters_[heap_[pos]].count)
+                return;
+            swap_heap(pos, parent);
+            pos = parent;
+        }
+    }
+
+    void sift_down(size_t pos) {
+        for (;;) {
+            size_t smallest = pos, left = 2 * pos + 1, right = left + 1;
+            if (left < heap_.size() && counters_[heap_[left]].count < counters_[heap_[smallest]].count)
+                smallest = left;
+            if (right < heap_.size() && counters_[heap_[right]].count < counters_[heap_[smallest]].count)
+                smallest = right;
+            if (smallest == pos)
+                return;
+            swap_heap(pos, smallest);
+            pos = smallest;
+        }
+    }
+
+    uint32_t capacity_;
+    uint64_t total_ = 0; // Sum of every count added, monitored or not
+    std::vector<Counter> counters_; // Never reallocated past `capacity_`, so index_ keys stay valid
+    std::vector<uint32_t> heap_;    // Counter indices, min-heap on count
+    std::unordered_map<std::string_view, uint32_t, ViewHash> index_;
+};
+
+// One consumer's approximate counts: heavy hitters plus distinct words. A consumer of a hash
+// partition only ever sees the words of its partition, which the merge uses to tighten the bounds.
+struct WordSketch {
+    SpaceSaving top;
+    HyperLogLog distinct;
+    uint32_t partition = 0;
+    uint32_t partition_count = 1;
+
+    explicit WordSketch(uint32_t counters = DEFAULT_SKETCH_COUNTERS, uint32_t precision = DEFAULT_HLL_PRECISION)
+        : top(counters), distinct(precision) {}
+
+    void add(const char* word, uint8_t length, uint64_t count = 1) {
+        top.add(word, length, count);
+        distinct.add_hash(hash_word(word, length));
+    }
+
+    // The most this sketch can have undercounted a word it does not monitor
+    uint64_t missing_bound(std::string_view word) const {
+        if (partition_for(word.data(), word.size(), partition_count) != partition)
+            return 0; // Never routed to this consumer
+        return top.min_count();
+    }
+};
+
+// Sketch file: SketchHeader | [uint8_t length][bytes][varint count][varint error] ... |
+// 2^precision HyperLogLog registers | uint64_t FNV-1a checksum of everything before it
+const char SKETCH_MAGIC[8] = {'W', 'C', 'S', 'K', 'E', 'T', 'C', 'H'};
+const uint32_t SKETCH_VERSION = 1;
+
+struct SketchHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t precision;    // HyperLogLog precision
+    uint32_t capacity;     // Space-Saving counters
+    uint32_t partition;
+    uint32_t partition_count;
+    uint32_t reserved;
+    uint64_t total;        // Sum of all counts added
+    uint64_t entry_count;  // Counters that follow
+};
+
+inline std::string sketch_file_name(const std::string& consumer_id) {
+    return "consumer_sketch_" + consumer_id + ".sk";
+}
+
+// Returns false with errno set
+inline bool save_sketch(const std::string& path, const WordSketch& sketch) {
+    std::string out(sizeof(SketchHeader), '\0');
+    SketchHeader header{};
+    memcpy(header.magic, SKETCH_MAGIC, sizeof(header.magic));
+    header.version = SKETCH_VERSION;
+    header.precision = sketch.distinct.precision();
+    header.capacity = sketch.top.capacity();
+    header.partition = sketch.partition;
+    header.partition_count = sketch.partition_count;
+    header.total = sketch.top.total();
+    header.entry_count = sketch.top.size();
+    memcpy(&out[0], &header, sizeof(header));
+    char record[MAX_RUN_RECORD + MAX_VARINT_BYTES];
+    for (const SpaceSaving::Counter& counter : sketch.top.counters()) {
+        record[0] = (char)counter.length;
+        memcpy(record + 1, counter.word, counter.length);
+        char* end = put_varint(put_varint(record + 1 + counter.length, counter.count), counter.error);
+        out.append(record, end - record);
+    }
+    out.append(reinterpret_cast<const char*>(sketch.distinct.registers().data()), sketch.distinct.registers().size());
+    uint64_t checksum = fnv1a(FNV_OFFSET_BASIS, out.data(), out.size());
+    out.append(reinterpret_cast<const char*>(&checksum), sizeof(checksum));
+
+    std::string tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd == -1)
+        return false;
+    size_t done = 0;
+    while (done < out.size()) {
+        ssize_t written = ::write(fd, out.data() + done, out.size() - done);
+        if (written == -1 && errno == EINTR)
+            continue;
+        if (written == -1) {
+            ::close(fd);
+            return false;
+        }
+        done += written;
+    }
+    if (::close(fd) == -1)
+        return false;
+    return rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+// Returns false with a description in `error`
+inline bool load_sketch(const std::string& path, WordSketch& sketch, std::string& error) {
+    MappedFile file;
+    if (!file.open(path.c_str())) {
+        error = strerror(errno);
+        return false;
+    }
+    const char* data = file.data();
+    size_t size = file.size();
+    SketchHeader header;
+    if (size < sizeof(header) + sizeof(uint64_t)) {
+        error = "file too short to be a sketch";
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, SKETCH_MAGIC, sizeof(SKETCH_MAGIC)) != 0 || header.version != SKETCH_VERSION
+        || header.precision < MIN_HLL_PRECISION || header.precision > MAX_HLL_PRECISION
+        || header.capacity < MIN_SKETCH_COUNTERS || header.capacity > MAX_SKETCH_COUNTERS || header.entry_count > header.capacity
+        || header.partition_count == 0 || header.partition >= header.partition_count) {
+        error = "not a word sketch (bad header)";
+        return false;
+    }
+    uint64_t checksum;
+    memcpy(&checksum, data + size - sizeof(checksum), sizeof(checksum));
+    if (fnv1a(FNV_OFFSET_BASIS, data, size - sizeof(checksum)) != checksum) {
+        error = "checksum mismatch";
+        return false;
+    }
+
+    WordSketch loaded(header.capacity, header.precision);
+    loaded.partition = header.partition;
+    loaded.partition_count = header.partition_count;
+    const char* p = data + sizeof(header);
+    const char* end = data + size - sizeof(checksum) - loaded.distinct.registers().size();
+    for (uint64_t i = 0; i < header.entry_count; ++i) {
+        if (p >= end || p + 1 + (uint8_t)*p + 2 > end) {
+            error = "truncated counter";
+            return false;
+        }
+        uint8_t length = (uint8_t)*p;
+        const char* word = p + 1;
+        uint64_t count, counted_error;
+        p = get_varint(get_varint(word + length, count), counted_error);
+        if (p > end) {
+            error = "truncated counter";
+            return false;
+        }
+        loaded.top.restore(word, length, count, counted_error);
+    }
+    if (p != end) {
+        error = "size does not match the header";
+        return false;
+    }
+    memcpy(loaded.distinct.registers().data(), end, loaded.distinct.registers().size());
+    loaded.top.set_total(header.total);
+    sketch = std::move(loaded);
+    return true;
+}
+
+// One line of the approximate report: the true count lies in [count - error, count]
+struct HeavyHitter {
+    std::string word;
+    uint64_t count;
+    uint64_t error;
+};
+
+// Merges the heavy hitters of several sketches. A word's estimate is the sum over all sketches of
+// its counter there, or, where it has none, of the most that sketch can have missed (its minimum
+// count, or 0 for a partition the word does not hash to). The result is sorted by estimate
+// (descending, ties by word) and cut to `keep` entries.
+inline std::vector<HeavyHitter> merge_heavy_hitters(const std::vector<WordSketch>& sketches, size_t keep) {
+    std::unordered_map<std::string, std::vector<const SpaceSaving::Counter*>> seen;
+    for (size_t s = 0; s < sketches.size(); ++s) {
+        for (const SpaceSaving::Counter& counter : sketches[s].top.counters()) {
+            std::vector<const SpaceSaving::Counter*>& slots = seen[std::string(counter.view())];
+            slots.resize(sketches.size(), nullptr);
+            slots[s] = &counter;
+        }
+    }
+    std::vector<HeavyHitter> merged;
+    merged.reserve(seen.size());
+    for (const auto& word : seen) {
+        HeavyHitter hit{word.first, 0, 0};
+        for (size_t s = 0; s < sketches.size(); ++s) {
+            if (const SpaceSaving::Counter* counter = word.second[s]) {
+                hit.count += counter->count;
+                hit.error += counter->error;
+            } else {
+                uint64_t bound = sketches[s].missing_bound(word.first);
+                hit.count += bound;
+                hit.error += bound;
+            }
+        }
+        merged.push_back(std::move(hit));
+    }
+    auto by_estimate = [](const HeavyHitter& a, const HeavyHitter& b) {
+        return a.count != b.count ? a.count > b.count : a.word < b.word;
+    };
+    if (keep && keep < merged.size()) {
+        std::partial_sort(merged.begin(), merged.begin() + keep, merged.end(), by_estimate);
+        merged.resize(keep);
+    } else {
+        std::sort(merged.begin(), merged.end(), by_estimate);
+    }
+    return merged;
+}
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <atomic>
+#include <cstdint>
+
+#include "futex.h"
+
+// Live counters kept in the shared segment so `wcstat` can watch a running job.
+// Every producer and consumer owns one cache-line-aligned slot and is its only writer, so
+// updates are plain relaxed load + store pairs: no locked instructions, no sharing of lines
+// between processes, and readers just see values that are a moment old.
+
+const uint32_t MAX_STATS_SLOTS = 64;  // Per role; processes beyond this run without published stats
+const uint32_t OCCUPANCY_BUCKETS = 8; // Ring fill histogram resolution (eighths of capacity)
+
+enum StatsSlotState : uint32_t {
+    STATS_SLOT_FREE = 0,
+    STATS_SLOT_ACTIVE = 1,
+    STATS_SLOT_DONE = 2
+};
+
+struct alignas(CACHE_LINE_SIZE) ProcessStats {
+    std::atomic<uint32_t> state; // StatsSlotState
+    std::atomic<int32_t> pid;
+    std::atomic<uint64_t> words;  // Word occurrences handed over (a combined record counts as its count)
+    std::atomic<uint64_t> bytes;  // Block bytes handed over
+    std::atomic<uint64_t> blocks;
+    std::atomic<uint64_t> queue_waits;   // Handoffs that blocked: ring full / sem_empty for producers, empty / sem_full for consumers
+    std::atomic<uint64_t> queue_wait_ns;
+    std::atomic<uint64_t> lock_waits;    // Semaphore queue only: sem_mutex was already held
+    std::atomic<uint64_t> lock_wait_ns;
+    std::atomic<uint64_t> occupancy[OCCUPANCY_BUCKETS]; // Ring fill seen at each handoff
+
+    static void bump(std::atomic<uint64_t>& counter, uint64_t delta) {
+        counter.store(counter.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+
+    void record_handoff(uint64_t block_words, uint32_t block_bytes, uint64_t occupied, uint32_t capacity) {
+        bump(words, block_words);
+        bump(bytes, block_bytes);
+        bump(blocks, 1);
+        uint64_t bucket = capacity ? occupied * OCCUPANCY_BUCKETS / capacity : 0;
+        bump(occupancy[bucket < OCCUPANCY_BUCKETS ? bucket : OCCUPANCY_BUCKETS - 1], 1);
+    }
+
+    void record_queue_wait(uint64_t ns) {
+        bump(queue_waits, 1);
+        bump(queue_wait_ns, ns);
+    }
+
+    void record_lock_wait(uint64_t ns) {
+        bump(lock_waits, 1);
+        bump(lock_wait_ns, ns);
+    }
+};
+
+struct StatsBlock {
+    std::atomic<uint32_t> producer_slots; // Slots handed out so far; may run past MAX_STATS_SLOTS
+    std::atomic<uint32_t> consumer_slots;
+    ProcessStats producers[MAX_STATS_SLOTS];
+    ProcessStats consumers[MAX_STATS_SLOTS];
+};
+
+// Takes the next free slot of one role, or returns `fallback` (a process-local slot nobody
+// reads) once all of them are in use, so callers never need a null check on the hot path
+inline ProcessStats* claim_stats_slot(std::atomic<uint32_t>& next_slot, ProcessStats* slots, ProcessStats* fallback, int32_t pid) {
+    uint32_t index = next_slot.fetch_add(1);
+    ProcessStats* slot = index < MAX_STATS_SLOTS ? &slots[index] : fallback;
+    slot->pid.store(pid, std::memory_order_relaxed);
+    slot->state.store(STATS_SLOT_ACTIVE, std::memory_order_release);
+    return slot;
+}
+
+#endif
@@ -0,0 +1,548 @@
+#ifndef TOKENIZER_H
+#define TOKENIZER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TOKENIZER_X86 1
+#endif
+
+// Word splitting rules (by default the same as the original ifstream >> + cleanWord path):
+// words are separated by ASCII whitespace, every byte that is not [A-Za-z0-9] is dropped,
+// and letters are lowercased. A token made only of dropped bytes yields no word.
+// The normalization policies below change which bytes are kept and how they are folded, but
+// never where words end, so every way of cutting the input at whitespace works for all of them.
+
+// Read-only view of an input file mapped copy-on-write, so the tokenizer can
+// lowercase and compact words in place without touching the file on disk. Every page it writes
+// becomes a private anonymous copy; tokenize_mapped() releases them as it goes.
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+
+    // Returns false (with errno set) if the file cannot be opened or mapped
+    bool open(const char* path) {
+        close();
+        int fd = ::open(path, O_RDONLY);
+        if (fd == -1)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) == -1) {
+            ::close(fd);
+            return false;
+        }
+        size_ = st.st_size;
+        if (size_ > 0) {
+            void* addr = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+            if (addr == MAP_FAILED) {
+                ::close(fd);
+                size_ = 0;
+                return false;
+            }
+            data_ = static_cast<char*>(addr);
+            madvise(data_, size_, MADV_SEQUENTIAL);
+        }
+        ::close(fd); // The mapping keeps the file alive
+        return true;
+    }
+
+    // Drops the private copies of the whole pages within [begin, end); the pages read back from
+    // the file if touched again. Returns where the released pages end, or `begin` if there were none.
+    size_t release(size_t begin, size_t end) {
+        static const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        size_t first = (begin + page - 1) / page * page;
+        size_t last = std::min(end, size_) / page * page;
+        if (!data_ || first >= last)
+            return begin;
+        madvise(data_ + first, last - first, MADV_DONTNEED);
+        return last;
+    }
+
+    void close() {
+        if (data_)
+            munmap(data_, size_);
+        data_ = nullptr;
+        size_ = 0;
+    }
+
+    char* data() { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    char* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// Per-64-byte classification, one bit per byte
+struct ByteMasks {
+    uint64_t space; // ASCII whitespace: word separators
+    uint64_t alnum; // Bytes kept in words
+};
+
+constexpr bool is_word_space(unsigned char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+constexpr bool is_word_alnum(unsigned char c) { return (unsigned char)((c | 0x20) - 'a') < 26 || (unsigned char)(c - '0') < 10; }
+
+// Classifies 64 bytes and lowercases any ASCII capitals in place
+inline void classify_fold_scalar(char* p, ByteMasks& m) {
+    m.space = 0;
+    m.alnum = 0;
+    for (int i = 0; i < 64; ++i) {
+        unsigned char c = (unsigned char)p[i];
+        if (is_word_space(c))
+            m.space |= 1ull << i;
+        if (is_word_alnum(c))
+            m.alnum |= 1ull << i;
+        if ((unsigned char)(c - 'A') < 26)
+            p[i] = (char)(c | 0x20);
+    }
+}
+
+#ifdef TOKENIZER_X86
+// Unsigned "x - lo <= span" test for every byte lane
+inline __m128i in_range_sse2(__m128i x, char lo, char span) {
+    __m128i shifted = _mm_sub_epi8(x, _mm_set1_epi8(lo));
+    return _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8(span)), shifted);
+}
+
+inline void classify_fold_sse2(char* p, ByteMasks& m) {
+    m.space = 0;
+    m.alnum = 0;
+    for (int i = 0; i < 4; ++i) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16 * i));
+        __m128i space = _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')), in_range_sse2(x, '\t', '\r' - '\t'));
+        __m128i upper = in_range_sse2(x, 'A', 25);
+        __m128i alnum = _mm_or_si128(_mm_or_si128(upper, in_range_sse2(x, 'a', 25)), in_range_sse2(x, '0', 9));
+        m.space |= (uint64_t)(uint16_t)_mm_movemask_epi8(space) << (16 * i);
+        m.alnum |= (uint64_t)(uint16_t)_mm_movemask_epi8(alnum) << (16 * i);
+        if (_mm_movemask_epi8(upper))
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(p + 16 * i), _mm_or_si128(x, _mm_and_si128(upper, _mm_set1_epi8(0x20))));
+    }
+}
+
+__attribute__((target("avx2"))) inline __m256i in_range_avx2(__m256i x, char lo, char span) {
+    __m256i shifted = _mm256_sub_epi8(x, _mm256_set1_epi8(lo));
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, _mm256_set1_epi8(span)), shifted);
+}
+
+__attribute__((target("avx2"))) inline void classify_fold_avx2(char* p, ByteMasks& m) {
+    m.space = 0;
+    m.alnum = 0;
+    for (int i = 0; i < 2; ++i) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 32 * i));
+        __m256i space = _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')), in_range_avx2(x, '\t', '\r' - '\t'));
+        __m256i upper = in_range_avx2(x, 'A', 25);
+        __m256i alnum = _mm256_or_si256(_mm256_or_si256(upper, in_range_avx2(x, 'a', 25)), in_range_avx2(x, '0', 9));
+        m.space |= (uint64_t)(uint32_t)_mm256_movemask_epi8(space) << (32 * i);
+        m.alnum |= (uint64_t)(uint32_t)_mm256_movemask_epi8(alnum) << (32 * i);
+        if (_mm256_movemask_epi8(upper))
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(p + 32 * i), _mm256_or_si256(x, _mm256_and_si256(upper, _mm256_set1_epi8(0x20))));
+    }
+}
+#endif
+
+typedef void (*ClassifyFoldFn)(char*, ByteMasks&);
+
+// Picks the widest classifier the CPU supports; resolved once per process
+inline ClassifyFoldFn select_classifier() {
+#ifdef TOKENIZER_X86
+    if (__builtin_cpu_supports("avx2"))
+        return classify_fold_avx2;
+    return classify_fold_sse2;
+#else
+    return classify_fold_scalar;
+#endif
+}
+
+inline const char* classifier_name(ClassifyFoldFn fn) {
+#ifdef TOKENIZER_X86
+    if (fn == classify_fold_avx2)
+        return "avx2";
+    if (fn == classify_fold_sse2)
+        return "sse2";
+#endif
+    (void)fn;
+    return "scalar";
+}
+
+// Normalization policies. The SIMD classifier above only tells whitespace and clean words
+// ([a-z0-9] after folding) apart; a word holding any other byte is handed to the policy's
+// compact(), which rewrites it in place from a constexpr 256-entry byte table. Words never grow,
+// so compaction always fits in place. tokenize_words is instantiated per policy, so the check
+// is inlined into the hot loop; the policy is picked once, at startup.
+
+enum Normalization {
+    NORMALIZE_ASCII,       // Keep [a-z0-9]
+    NORMALIZE_ASCII_PUNCT, // Also keep apostrophes and hyphens inside words ("don't", "x-ray")
+    NORMALIZE_UTF8         // Keep letters and digits of any script, validated and case folded
+};
+
+enum ByteClass : uint8_t {
+    BYTE_DROP = 0,  // Removed from words
+    BYTE_KEEP = 1,  // Kept, after folding
+    BYTE_SPACE = 2, // Word separator
+    BYTE_INNER = 3, // Kept only between kept bytes
+    BYTE_CONT = 4,  // UTF-8 continuation byte; dropped unless a lead byte claims it
+    BYTE_LEAD2 = 5, // First byte of a 2-, 3- or 4-byte UTF-8 sequence
+    BYTE_LEAD3 = 6,
+    BYTE_LEAD4 = 7
+};
+
+struct ByteTable {
+    uint8_t cls[256]; // ByteClass
+    uint8_t fold[256];
+};
+
+constexpr ByteTable make_byte_table(Normalization normalization) {
+    ByteTable table{};
+    for (int c = 0; c < 256; ++c) {
+        table.fold[c] = (uint8_t)(c >= 'A' && c <= 'Z' ? c | 0x20 : c);
+        if (c == ' ' || (c >= '\t' && c <= '\r'))
+            table.cls[c] = BYTE_SPACE;
+        else if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9'))
+            table.cls[c] = BYTE_KEEP;
+        else if (normalization == NORMALIZE_ASCII_PUNCT && (c == '\'' || c == '-'))
+            table.cls[c] = BYTE_INNER;
+        else if (normalization == NORMALIZE_UTF8 && c >= 0x80 && c < 0xc0)
+            table.cls[c] = BYTE_CONT;
+        else if (normalization == NORMALIZE_UTF8 && c >= 0xc2 && c < 0xe0) // 0xc0 and 0xc1 only start overlong forms
+            table.cls[c] = BYTE_LEAD2;
+        else if (normalization == NORMALIZE_UTF8 && c >= 0xe0 && c < 0xf0)
+            table.cls[c] = BYTE_LEAD3;
+        else if (normalization == NORMALIZE_UTF8 && c >= 0xf0 && c < 0xf5)
+            table.cls[c] = BYTE_LEAD4;
+        else
+            table.cls[c] = BYTE_DROP;
+    }
+    return table;
+}
+
+// [a-z0-9] only: the original rule
+struct AsciiPolicy {
+    static constexpr ByteTable table = make_byte_table(NORMALIZE_ASCII);
+
+    static size_t compact(char* begin, char* end) {
+        char* out = begin;
+        for (char* in = begin; in < end; ++in) {
+            unsigned char c = (unsigned char)*in;
+            *out = (char)table.fold[c];
+            out += table.cls[c] == BYTE_KEEP;
+        }
+        return out - begin;
+    }
+};
+
+// Apostrophes and hyphens survive between kept bytes; leading and trailing ones are trimmed
+struct AsciiPunctPolicy {
+    static constexpr ByteTable table = make_byte_table(NORMALIZE_ASCII_PUNCT);
+
+    static size_t compact(char* begin, char* end) {
+        char* out = begin;
+        char* kept_end = begin; // Just past the last BYTE_KEEP written
+        for (char* in = begin; in < end; ++in) {
+            unsigned char c = (unsigned char)*in;
+            uint8_t cls = table.cls[c];
+            if (cls == BYTE_KEEP) {
+                *out++ = (char)table.fold[c];
+                kept_end = out;
+            } else if (cls == BYTE_INNER && out != begin) {
+                *out++ = (char)c;
+            }
+        }
+        return kept_end - begin;
+    }
+};
+
+// Simple case folding (one code point to one code point) for Latin-1, Latin Extended-A, Greek,
+// Cyrillic, Armenian and fullwidth Latin; other scripts have no case or are left as they are.
+constexpr uint32_t fold_code_point(uint32_t cp) {
+    if ((cp >= 0xc0 && cp <= 0xde && cp != 0xd7) || (cp >= 0x391 && cp <= 0x3ab && cp != 0x3a2) || (cp >= 0x410 && cp <= 0x42f)
+        || (cp >= 0xff21 && cp <= 0xff3a))
+        return cp + 0x20;
+    if ((cp >= 0x100 && cp <= 0x12f) || (cp >= 0x132 && cp <= 0x137) || (cp >= 0x14a && cp <= 0x177))
+        return cp | 1;
+    if ((cp >= 0x139 && cp <= 0x148) || (cp >= 0x179 && cp <= 0x17e))
+        return cp + (cp & 1);
+    if (cp >= 0x400 && cp <= 0x40f)
+        return cp + 0x50;
+    if (cp >= 0x531 && cp <= 0x556)
+        return cp + 0x30;
+    switch (cp) {
+    case 0xb5: return 0x3bc;   // Micro sign -> mu
+    case 0x178: return 0xff;   // Y with diaeresis
+    case 0x17f: return 's';    // Long s
+    case 0x386: return 0x3ac;
+    case 0x388: case 0x389: case 0x38a: return cp + 0x25;
+    case 0x38c: return 0x3cc;
+    case 0x38e: case 0x38f: return cp + 0x3f;
+    case 0x3c2: return 0x3c3;  // Final sigma
+    default: return cp;
+    }
+}
+
+// Whether a (folded) non-ASCII code point belongs in a word: letters, digits and marks of every
+// script do; Latin-1 punctuation, general punctuation and symbol blocks, CJK punctuation,
+// fullwidth punctuation, emoji and the byte order mark do not.
+constexpr bool keep_code_point(uint32_t cp) {
+    if (cp < 0x80) // Only folding can lead here (long s -> s)
+        return is_word_alnum((unsigned char)cp);
+    if (cp < 0xc0)
+        return cp == 0xaa || cp == 0xba; // Ordinal indicators (the micro sign is folded to mu first)
+    return !(cp == 0xd7 || cp == 0xf7 || (cp >= 0x2000 && cp <= 0x2bff) || (cp >= 0x2e00 && cp <= 0x2e7f) || (cp >= 0x3000 && cp <= 0x303f)
+             || (cp >= 0xfe30 && cp <= 0xfe6f) || cp == 0xfeff || (cp >= 0xff01 && cp <= 0xff0f) || (cp >= 0xff1a && cp <= 0xff20)
+             || (cp >= 0xff3b && cp <= 0xff40) || (cp >= 0xff5b && cp <= 0xff65) || (cp >= 0x1f000 && cp <= 0x1faff));
+}
+
+// Folded form of every code point below U+0800 (the 2-byte sequences, which cover Latin, Greek,
+// Cyrillic, Armenian, Hebrew and Arabic), or 0 for one that is dropped
+struct TwoByteFoldTable {
+    uint16_t folded[0x800];
+};
+
+constexpr TwoByteFoldTable make_two_byte_fold_table() {
+    TwoByteFoldTable table{};
+    for (uint32_t cp = 0x80; cp < 0x800; ++cp) {
+        uint32_t folded = fold_code_point(cp);
+        table.folded[cp] = keep_code_point(folded) ? (uint16_t)folded : 0;
+    }
+    return table;
+}
+
+// UTF-8: ASCII bytes go through the byte table as in AsciiPolicy; each multi-byte sequence is
+// validated (no overlong forms, surrogates or code points past U+10FFFF), folded and kept or
+// dropped as a whole, 2-byte ones through a table. Invalid bytes are dropped. Folding never
+// lengthens a sequence.
+struct Utf8Policy {
+    static constexpr ByteTable table = make_byte_table(NORMALIZE_UTF8);
+    static constexpr TwoByteFoldTable two_byte = make_two_byte_fold_table();
+
+    static size_t compact(char* begin, char* end) {
+        unsigned char* in = reinterpret_cast<unsigned char*>(begin);
+        unsigned char* last = reinterpret_cast<unsigned char*>(end);
+        unsigned char* out = in;
+        while (in < last) {
+            unsigned char c = *in;
+            uint8_t cls = table.cls[c];
+            if (cls < BYTE_LEAD2) { // ASCII, or a byte that cannot start a sequence
+                *out = table.fold[c];
+                out += cls == BYTE_KEEP;
+                in++;
+                continue;
+            }
+            if (cls == BYTE_LEAD2 && in + 1 < last && (in[1] & 0xc0) == 0x80) { // The common case
+                uint32_t folded = two_byte.folded[((c & 0x1f) << 6) | (in[1] & 0x3f)];
+                in += 2;
+                if (folded)
+                    out += encode(folded, out);
+                continue;
+            }
+            size_t length = cls - BYTE_LEAD2 + 2;
+            uint32_t cp = 0;
+            if (!decode(in, last, length, cp)) {
+                in++; // Drop the lead byte; the continuation bytes after it are dropped in turn
+                continue;
+            }
+            in += length;
+            cp = fold_code_point(cp);
+            if (keep_code_point(cp))
+                out += encode(cp, out);
+        }
+        return reinterpret_cast<char*>(out) - begin;
+    }
+
+private:
+    static bool decode(const unsigned char* in, const unsigned char* last, size_t length, uint32_t& cp) {
+        if ((size_t)(last - in) < length)
+            return false;
+        cp = in[0] & (0x7f >> length);
+        for (size_t i = 1; i < length; ++i) {
+            if ((in[i] & 0xc0) != 0x80)
+                return false;
+            cp = (cp << 6) | (in[i] & 0x3f);
+        }
+        if (length == 3)
+            return cp >= 0x800 && (cp < 0xd800 || cp > 0xdfff);
+        if (length == 4)
+            return cp >= 0x10000 && cp <= 0x10ffff;
+        return true;
+    }
+
+    static size_t encode(uint32_t cp, unsigned char* out) {
+        if (cp < 0x80) {
+            out[0] = (unsigned char)cp;
+            return 1;
+        }
+        if (cp < 0x800) {
+            out[0] = (unsigned char)(0xc0 | (cp >> 6));
+            out[1] = (unsigned char)(0x80 | (cp & 0x3f));
+            return 2;
+        }
+        if (cp < 0x10000) {
+            out[0] = (unsigned char)(0xe0 | (cp >> 12));
+            out[1] = (unsigned char)(0x80 | ((cp >> 6) & 0x3f));
+            out[2] = (unsigned char)(0x80 | (cp & 0x3f));
+            return 3;
+        }
+        out[0] = (unsigned char)(0xf0 | (cp >> 18));
+        out[1] = (unsigned char)(0x80 | ((cp >> 12) & 0x3f));
+        out[2] = (unsigned char)(0x80 | ((cp >> 6) & 0x3f));
+        out[3] = (unsigned char)(0x80 | (cp & 0x3f));
+        return 4;
+    }
+};
+
+inline const char* normalization_name(Normalization normalization) {
+    return normalization == NORMALIZE_UTF8 ? "utf8" : normalization == NORMALIZE_ASCII_PUNCT ? "ascii-punct" : "ascii";
+}
+
+// Returns false for an unrecognised name
+inline bool parse_normalization(const std::string& name, Normalization& normalization) {
+    if (name == "ascii")
+        normalization = NORMALIZE_ASCII;
+    else if (name == "ascii-punct")
+        normalization = NORMALIZE_ASCII_PUNCT;
+    else if (name == "utf8")
+        normalization = NORMALIZE_UTF8;
+    else
+        return false;
+    return true;
+}
+
+// Shortens a word to at most `max_length` bytes without splitting a UTF-8 sequence
+inline size_t truncate_word(const char* word, size_t length, size_t max_length) {
+    if (length <= max_length)
+        return length;
+    while (max_length > 0 && ((unsigned char)word[max_length] & 0xc0) == 0x80)
+        max_length--;
+    return max_length;
+}
+
+// Moves `pos` forward to the nearest offset in [pos, size] that does not fall inside a word, so
+// buffers cut at such offsets tokenize exactly like the whole buffer would
+inline size_t align_to_word_boundary(const char* data, size_t size, size_t pos) {
+    while (pos > 0 && pos < size && !is_word_space((unsigned char)data[pos - 1]))
+        pos++;
+    return pos;
+}
+
+// Byte range of part `index` (0-based) of `parts` equal slices of a buffer. Both ends are moved
+// to word boundaries, so a word cut by a slice boundary belongs to the part holding its first
+// byte: that part finishes it past its nominal end and the next part skips what is left of it.
+inline void word_aligned_part(const char* data, size_t size, uint32_t index, uint32_t parts, size_t& begin, size_t& end) {
+    begin = align_to_word_boundary(data, size, (size_t)((unsigned __int128)size * index / parts));
+    end = align_to_word_boundary(data, size, (size_t)((unsigned __int128)size * (index + 1) / parts));
+}
+
+// Splits a writable buffer into words, lowercasing and compacting them in place under Policy.
+// Calls on_word(const char* word, size_t length) for every non-empty word, pointing into
+// the buffer; stops early if on_word returns false. Returns false if it was stopped early.
+template <typename Policy = AsciiPolicy, typename OnWord>
+bool tokenize_words(char* data, size_t size, OnWord&& on_word, ClassifyFoldFn classify = nullptr) {
+    static const ClassifyFoldFn best = select_classifier();
+    if (!classify)
+        classify = best;
+    if (size == 0)
+        return true;
+
+    char* token = nullptr;      // Start of the word currently open, if any
+    bool token_dirty = false;   // Whether the open word contains bytes that must be dropped
+    uint64_t prev_nonspace = 0; // Bit 0: last byte of the previous block was inside a word
+    char tail[64];
+
+    for (size_t offset = 0; offset < size + 1; offset += 64) {
+        // The final block is staged in a space-padded copy, which also terminates the last word
+        size_t valid = size - offset < 64 ? size - offset : 64;
+        char* p = data + offset;
+        ByteMasks m;
+        if (valid < 64) {
+            memcpy(tail, p, valid);
+            memset(tail + valid, ' ', 64 - valid);
+            classify(tail, m);
+            if (memcmp(p, tail, valid) != 0) // Stores into a mapped file dirty the page
+                memcpy(p, tail, valid);
+        } else {
+            classify(p, m);
+        }
+
+        uint64_t nonspace = ~m.space;
+        uint64_t shifted = (nonspace << 1) | prev_nonspace;
+        uint64_t starts = nonspace & ~shifted;
+        uint64_t ends = m.space & shifted;
+        uint64_t dirty = nonspace & ~m.alnum;
+        prev_nonspace = nonspace >> 63;
+
+        uint64_t open_from = token ? 0 : 64; // Bit where the open word entered this block
+        uint64_t events = starts | ends;
+        while (events) {
+            int bit = __builtin_ctzll(events);
+            uint64_t here = 1ull << bit;
+            events &= events - 1;
+            if (starts & here) {
+                token = p + bit;
+                token_dirty = false;
+                open_from = bit;
+            } else {
+                uint64_t span = (here - 1) & ~((1ull << open_from) - 1);
+                char* word_end = p + bit;
+                size_t length = (token_dirty || (dirty & span)) ? Policy::compact(token, word_end) : (size_t)(word_end - token);
+                char* word = token;
+                token = nullptr;
+                open_from = 64;
+                if (length > 0 && !on_word((const char*)word, length))
+                    return false;
+            }
+        }
+        if (token && open_from < 64)
+            token_dirty = token_dirty || (dirty >> open_from) != 0;
+        else if (token)
+            token_dirty = token_dirty || dirty != 0;
+    }
+    return true;
+}
+
+// tokenize_words under a policy chosen at run time; the switch runs once per buffer, not per byte
+template <typename OnWord>
+bool tokenize_normalized(Normalization normalization, char* data, size_t size, OnWord&& on_word) {
+    switch (normalization) {
+    case NORMALIZE_ASCII_PUNCT:
+        return tokenize_words<AsciiPunctPolicy>(data, size, on_word);
+    case NORMALIZE_UTF8:
+        return tokenize_words<Utf8Policy>(data, size, on_word);
+    default:
+        return tokenize_words<AsciiPolicy>(data, size, on_word);
+    }
+}
+
+const size_t MAPPED_RELEASE_WINDOW = 4 << 20; // Bytes tokenized between releases of a mapped file's pages
+
+// tokenize_normalized over bytes [begin, end) of a mapped file, in windows cut at word boundaries.
+// The pages behind each window are released once its words have been handed on, so the private
+// copies made by folding in place stay within a window instead of growing to the size of the
+// input. Only whole pages inside [begin, end) are released: threads tokenizing neighbouring
+// ranges of one mapping never drop each other's pages. Words are valid only during on_word.
+template <typename OnWord>
+bool tokenize_mapped(Normalization normalization, MappedFile& file, size_t begin, size_t end, OnWord&& on_word) {
+    size_t released = begin;
+    for (size_t window = begin; window < end;) {
+        size_t window_end = align_to_word_boundary(file.data(), end, std::min(end, window + MAPPED_RELEASE_WINDOW));
+        if (!tokenize_normalized(normalization, file.data() + window, window_end - window, on_word))
+            return false;
+        released = file.release(released, window_end);
+        window = window_end;
+    }
+    return true;
+}
+
+#endif
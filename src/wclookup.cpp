@@ -0,0 +1,121 @@
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+
+#include "count_index.h"
+#include "job.h"
+
+using namespace std;
+
+// Answers count queries from the aggregator's index (aggregated_word_counts.idx) without reading
+// the report: point lookups of the words on the command line, batch lookups of one word per line
+// on stdin, and the top N words. The index holds every counted word, even those a --top report
+// leaves out; only the report's lines have ranks. Words are matched exactly as the report spells
+// them, i.e. already normalized (lowercased) by the producers.
+
+const size_t BATCH_SIZE = 4096; // stdin words looked up per find_batch() call
+
+void print_usage(const char* prog) {
+    cerr << "Usage: " << prog << " [--index FILE | --job ID] WORD...       counts (and ranks) of the given words" << endl;
+    cerr << "       " << prog << " [--index FILE | --job ID] --batch       one word per line on stdin, \"word\\tcount\" per line on stdout" << endl;
+    cerr << "       " << prog << " [--index FILE | --job ID] --top N       the N most frequent words" << endl;
+    cerr << "       " << prog << " [--index FILE | --job ID] --stats       what the index holds" << endl;
+}
+
+int main(int argc, char* argv[]) {
+    string index_path = count_index_path("aggregated_word_counts.txt");
+    bool batch = false;
+    bool show_stats = false;
+    unsigned long long top_n = 0;
+    vector<string_view> words;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--index" && i + 1 < argc) {
+            index_path = argv[++i];
+        } else if (arg == "--job" && i + 1 < argc && valid_job_id(argv[i + 1])) {
+            index_path = count_index_path(JobNames(argv[++i]).path("aggregated_word_counts.txt"));
+        } else if (arg == "--batch") {
+            batch = true;
+        } else if (arg == "--stats") {
+            show_stats = true;
+        } else if (arg == "--top" && i + 1 < argc) {
+            char* end = nullptr;
+            top_n = strtoull(argv[++i], &end, 10);
+            if (end == argv[i] || *end != '\0' || top_n == 0) {
+                cerr << "Error: --top expects a positive integer." << endl;
+                return 2;
+            }
+        } else if (arg == "--") {
+            words.insert(words.end(), argv + i + 1, argv + argc);
+            break;
+        } else if (arg.rfind("--", 0) == 0) {
+            print_usage(argv[0]);
+            return 2;
+        } else {
+            words.push_back(argv[i]);
+        }
+    }
+    if ((int)batch + (top_n > 0) + show_stats + !words.empty() != 1) {
+        print_usage(argv[0]);
+        return 2;
+    }
+
+    CountIndex index;
+    if (!index.open(index_path.c_str())) {
+        cerr << "wclookup: " << index_path << ": " << index.error() << endl;
+        return 2;
+    }
+
+    if (show_stats) {
+        cout << "Words indexed: " << index.unique_words() << "\n"
+             << "Words ranked (the report's lines): " << index.size() << "\n"
+             << "Total words: " << index.total_words() << endl;
+        return 0;
+    }
+
+    if (top_n > 0) {
+        for (uint64_t rank = 0; rank < top_n && rank < index.size(); ++rank)
+            cout << rank + 1 << "\t" << index.word(rank) << "\t" << index.count(rank) << "\n";
+        return 0;
+    }
+
+    if (batch) {
+        // Lines are collected into batches so find_batch() can overlap the page misses
+        vector<string> lines;
+        vector<string_view> batch_words;
+        vector<uint64_t> counts(BATCH_SIZE);
+        string line;
+        bool more = true;
+        while (more) {
+            lines.clear();
+            while (lines.size() < BATCH_SIZE && (more = (bool)getline(cin, line))) {
+                if (!line.empty() && line.back() == '\r')
+                    line.pop_back();
+                lines.push_back(line);
+            }
+            batch_words.assign(lines.begin(), lines.end());
+            index.find_batch(batch_words.data(), batch_words.size(), counts.data());
+            for (size_t i = 0; i < lines.size(); ++i)
+                cout << lines[i] << "\t" << counts[i] << "\n";
+        }
+        return 0;
+    }
+
+    // Exit status 1 if any word is missing, like grep
+    int status = 0;
+    for (string_view word : words) {
+        uint64_t count = 0, rank = 0;
+        if (!index.find(word, count, &rank)) {
+            cout << word << ": 0 (not found)\n";
+            status = 1;
+        } else if (rank == INDEX_UNRANKED) {
+            cout << word << ": " << count << " (not in the report's top " << index.size() << ")\n";
+        } else {
+            cout << word << ": " << count << " (rank " << rank + 1 << ")\n";
+        }
+    }
+    return status;
+}
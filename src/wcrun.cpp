@@ -0,0 +1,571 @@
+// Runs a whole job from one command: starts a pool of producers and consumers sized to the input
+// set and the CPUs this process may use, grows the pool while the job runs, runs the aggregator
+// once every consumer has finished and removes the job's shared memory and semaphores afterwards.
+//
+// The inputs are expanded into a manifest in the job's directory, so every producer claims work
+// items from the same shared work queue and a producer started later simply joins the pool. The
+// supervisor holds a shared lock on the job's segment like any participant, and counts as an
+// active producer until it has stopped starting producers: the job cannot close under it.
+//
+// Every --interval seconds the supervisor reads how full each ring is. A ring that stays at least
+// FULL_RING_PERCENT full for SCALE_PATIENCE samples means its consumers cannot keep up, and gets
+// another consumer. Rings that stay empty that long mean the producers are the bottleneck, and
+// the pool gets another producer, but only while the work queue still holds unclaimed items: once
+// every item is claimed no producer is started any more, and when the last one exits the job is
+// closed. Each process's output goes to its own log under wcrun_logs/ in the job's directory.
+// With --aggregator-opt --partitioned the pool keeps exactly one consumer per partition instead:
+// that merge relies on no two consumer outputs sharing a partition.
+//
+// A child killed by a signal, a consumer that fails or a SIGINT/SIGTERM to the supervisor stops
+// the job: the remaining children are interrupted (and killed if they do not exit), and the job's
+// segments and semaphores are removed without aggregating.
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <cerrno>
+#include <csignal>
+#include <filesystem>
+#include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sched.h>
+
+#include "common.h"
+#include "work_queue.h"
+
+using namespace std;
+
+atomic_bool running(true);  // Cleared by SIGINT/SIGTERM
+atomic_bool waiting(true);  // Cleared by SIGINT/SIGTERM and by SIGCHLD, to stop waiting for the segment
+
+const double DEFAULT_SAMPLE_INTERVAL = 0.1; // Seconds between ring occupancy samples
+const uint32_t SCALE_PATIENCE = 10;         // Samples a ring must stay full (or the rings empty) before the pool grows
+const uint64_t FULL_RING_PERCENT = 75;
+const int STOP_GRACE_SECONDS = 5;           // How long interrupted children get to exit before they are killed
+const char* INPUT_MANIFEST = "wcrun_inputs.list";
+const char* LOG_DIR = "wcrun_logs";
+
+struct Child {
+    pid_t pid;
+    string role; // "producer" or "consumer"
+    string id;
+    bool running = true;
+    int status = 0;
+};
+
+void signal_handler(int signum) {
+    running.store(false);
+    waiting.store(false);
+}
+
+void child_handler(int signum) {
+    waiting.store(false);
+}
+
+void print_usage(const char* prog) {
+    cerr << "Usage: " << prog << " [--producers N] [--consumers N] [--max-producers N] [--max-consumers N] [--interval SECONDS] [--chunk-size BYTES] [--job ID] [--bench]"
+         << " [--producer-opt OPT]... [--consumer-opt OPT]... [--aggregator-opt OPT]... <input_file | directory | 'glob'>..." << endl;
+}
+
+bool parse_count(const char* name, const char* text, uint32_t& value) {
+    char* end = nullptr;
+    errno = 0;
+    unsigned long parsed = strtoul(text, &end, 10);
+    if (end == text || *end != '\0' || errno != 0 || parsed == 0 || parsed > MAX_STATS_SLOTS) {
+        cerr << "Error: --" << name << " expects an integer from 1 to " << MAX_STATS_SLOTS << "." << endl;
+        return false;
+    }
+    value = (uint32_t)parsed;
+    return true;
+}
+
+// CPUs this process may run on
+uint32_t usable_cpus() {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+        return max(1, CPU_COUNT(&allowed));
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    return online > 0 ? (uint32_t)online : 1;
+}
+
+// Absolute path of a sibling binary
+string sibling_binary(const char* argv0, const string& name) {
+    char resolved[PATH_MAX];
+    string self = realpath(argv0, resolved) ? resolved : argv0;
+    size_t slash = self.rfind('/');
+    return (slash == string::npos ? string(".") : self.substr(0, slash)) + "/" + name;
+}
+
+// Starts a child, with stdout/stderr redirected to `log` unless it is empty; returns -1 on failure
+pid_t spawn(const vector<string>& args, const string& log) {
+    pid_t pid = fork();
+    if (pid != 0)
+        return pid;
+    signal(SIGCHLD, SIG_DFL);
+    int fd = log.empty() ? -1 : open(log.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd != -1) {
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        close(fd);
+    }
+    vector<char*> argv;
+    for (const string& arg : args)
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    argv.push_back(nullptr);
+    execv(argv[0], argv.data());
+    perror(("wcrun: exec " + args[0] + " failed").c_str());
+    _exit(127);
+}
+
+// Collects children that have exited. Returns false if one of them died or failed in a way that
+// stops the job: killed by a signal, or a consumer (or a child that could not be started) exiting
+// with an error. A producer that exits with an error has left the job cleanly; it is reported and
+// remembered in `producer_failed`.
+bool reap_exited(vector<Child>& children, const JobNames& job, bool& producer_failed) {
+    bool ok = true;
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        for (Child& child : children) {
+            if (child.pid != pid || !child.running)
+                continue;
+            child.running = false;
+            child.status = status;
+            string log = job.path(string(LOG_DIR) + "/" + child.role + "_" + child.id + ".log");
+            if (WIFSIGNALED(status)) {
+                cerr << "wcrun: " << child.role << " " << child.id << " was killed by signal " << WTERMSIG(status) << " (see " << log << ")." << endl;
+                ok = false;
+            } else if (WEXITSTATUS(status) != 0) {
+                cerr << "wcrun: " << child.role << " " << child.id << " exited with status " << WEXITSTATUS(status) << " (see " << log << ")." << endl;
+                if (child.role == "producer" && WEXITSTATUS(status) != 127)
+                    producer_failed = true;
+                else
+                    ok = false;
+            }
+        }
+    }
+    return ok;
+}
+
+uint32_t count_running(const vector<Child>& children, const string& role) {
+    uint32_t count = 0;
+    for (const Child& child : children)
+        count += child.running && child.role == role;
+    return count;
+}
+
+// Interrupts every running child and waits for them, killing those still running after STOP_GRACE_SECONDS
+void stop_children(vector<Child>& children) {
+    for (const Child& child : children) {
+        if (child.running)
+            kill(child.pid, SIGINT);
+    }
+    time_t deadline = time(nullptr) + STOP_GRACE_SECONDS;
+    bool killed = false;
+    for (;;) {
+        bool any = false;
+        for (Child& child : children) {
+            if (child.running && waitpid(child.pid, &child.status, WNOHANG) == child.pid)
+                child.running = false;
+            any |= child.running;
+        }
+        if (!any)
+            return;
+        if (!killed && time(nullptr) >= deadline) {
+            for (const Child& child : children) {
+                if (child.running)
+                    kill(child.pid, SIGKILL);
+            }
+            killed = true;
+        }
+        usleep(10000);
+    }
+}
+
+// Removes the job's shared memory and semaphores; every participant must be gone
+void unlink_job_ipc(const JobNames& job, uint32_t partitions, bool keep_dictionary) {
+    shm_unlink(job.ipc(SHARED_MEM_NAME).c_str());
+    shm_unlink(job.ipc(WORK_QUEUE_NAME).c_str());
+    if (!keep_dictionary)
+        shm_unlink(job.ipc(DICTIONARY_NAME).c_str());
+    for (uint32_t p = 0; p < partitions; ++p) {
+        sem_unlink(partition_sem_name(job, SEM_EMPTY_NAME, p).c_str());
+        sem_unlink(partition_sem_name(job, SEM_FULL_NAME, p).c_str());
+        sem_unlink(partition_sem_name(job, SEM_MUTEX_NAME, p).c_str());
+    }
+}
+
+int main(int argc, char* argv[]) {
+    uint32_t initial_producers = 0, initial_consumers = 0; // 0: sized from the inputs and the CPUs
+    uint32_t max_producers = 0, max_consumers = 0;
+    double sample_interval = DEFAULT_SAMPLE_INTERVAL;
+    uint64_t chunk_size = DEFAULT_WORK_CHUNK_SIZE; // Passed on to the producers, whose work queue cuts large files the same way
+    bool bench = false;
+    JobNames job;
+    vector<string> producer_opts, consumer_opts, aggregator_opts;
+    static const struct option long_options[] = {
+        {"producers", required_argument, nullptr, 'p'},
+        {"consumers", required_argument, nullptr, 'c'},
+        {"max-producers", required_argument, nullptr, 'P'},
+        {"max-consumers", required_argument, nullptr, 'C'},
+        {"interval", required_argument, nullptr, 'i'},
+        {"chunk-size", required_argument, nullptr, 'k'},
+        {"job", required_argument, nullptr, 'j'},
+        {"bench", no_argument, nullptr, 'b'},
+        {"producer-opt", required_argument, nullptr, 'x'},
+        {"consumer-opt", required_argument, nullptr, 'y'},
+        {"aggregator-opt", required_argument, nullptr, 'z'},
+        {nullptr, 0, nullptr, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, nullptr)) != -1) {
+        switch (opt) {
+        case 'p':
+            if (!parse_count("producers", optarg, initial_producers))
+                return 1;
+            break;
+        case 'c':
+            if (!parse_count("consumers", optarg, initial_consumers))
+                return 1;
+            break;
+        case 'P':
+            if (!parse_count("max-producers", optarg, max_producers))
+                return 1;
+            break;
+        case 'C':
+            if (!parse_count("max-consumers", optarg, max_consumers))
+                return 1;
+            break;
+        case 'i':
+            sample_interval = atof(optarg);
+            if (sample_interval < 0.001 || sample_interval > 60) {
+                cerr << "Error: --interval expects seconds between 0.001 and 60." << endl;
+                return 1;
+            }
+            break;
+        case 'k': {
+            char* end = nullptr;
+            chunk_size = strtoull(optarg, &end, 10);
+            if (end == optarg || *end != '\0' || chunk_size < MIN_WORK_CHUNK_SIZE || chunk_size > UINT32_MAX) {
+                cerr << "Error: --chunk-size expects bytes from " << MIN_WORK_CHUNK_SIZE << " to " << UINT32_MAX << "." << endl;
+                return 1;
+            }
+            break;
+        }
+        case 'j':
+            if (!valid_job_id(optarg)) {
+                cerr << "Error: a job ID is 1 to " << MAX_JOB_ID_LENGTH << " letters, digits, '_' or '-'." << endl;
+                return 1;
+            }
+            job = JobNames(optarg);
+            break;
+        case 'b': bench = true; break;
+        case 'x': producer_opts.push_back(optarg); break;
+        case 'y': consumer_opts.push_back(optarg); break;
+        case 'z': aggregator_opts.push_back(optarg); break;
+        default:
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    // A live job under the same name would take our producers and consumers in; a stale one is reclaimed here
+    string segment_name = job.ipc(SHARED_MEM_NAME);
+    bool reclaimed = false;
+    int probe = attach_job_segment(segment_name, O_RDONLY, reclaimed);
+    if (probe != -1) {
+        close(probe);
+        cerr << "Error: job " << (job.id.empty() ? "(default)" : job.id) << " is already running, or its consumers have yet to drain it." << endl;
+        return 1;
+    }
+    if (reclaimed)
+        cout << "wcrun: Removed the shared word buffer of an earlier job that finished or crashed." << endl;
+
+    // Expand the inputs into the pool's manifest, and size the pool from the work items
+    vector<WorkInput> inputs;
+    for (int i = optind; i < argc; ++i) {
+        string error;
+        if (!expand_work_source(argv[i], false, inputs, error)) {
+            cerr << "Error: " << error << endl;
+            return 1;
+        }
+    }
+    uint64_t item_count = 0, input_bytes = 0;
+    work_queue_size(inputs, chunk_size, item_count);
+    for (const WorkInput& input : inputs)
+        input_bytes += input.size;
+    if (item_count == 0) {
+        cerr << "Error: the inputs hold no non-empty files." << endl;
+        return 1;
+    }
+    string log_dir = job.path(LOG_DIR);
+    if (!job.make_dir() || (mkdir(log_dir.c_str(), 0777) == -1 && errno != EEXIST)) {
+        perror(("wcrun: cannot create " + log_dir).c_str());
+        return 1;
+    }
+    string manifest_path = job.path(INPUT_MANIFEST);
+    {
+        ofstream manifest(manifest_path);
+        for (const WorkInput& input : inputs)
+            manifest << input.path << "\n";
+        manifest.close();
+        if (manifest.fail()) {
+            cerr << "Error: cannot write " << manifest_path << endl;
+            return 1;
+        }
+    }
+    // Outputs of an earlier run with more consumers would be aggregated with ours
+    for (const auto& entry : filesystem::directory_iterator(job.dir)) {
+        string name = entry.path().filename().string();
+        if (name.rfind("consumer_output_", 0) == 0 || name.rfind("consumer_sketch_", 0) == 0)
+            filesystem::remove(entry.path());
+    }
+    for (const auto& entry : filesystem::directory_iterator(log_dir))
+        filesystem::remove(entry.path());
+
+    // About half the CPUs tokenize and the rest count; never more producers than work items.
+    // Consumers start level with the producers and are added where a ring backs up.
+    uint32_t cpus = usable_cpus();
+    if (initial_producers == 0)
+        initial_producers = (uint32_t)max<uint64_t>(1, min<uint64_t>(item_count, (cpus + 1) / 2));
+    if (initial_consumers == 0)
+        initial_consumers = max(1u, min(initial_producers, cpus > initial_producers ? cpus - initial_producers : 1));
+    if (max_producers == 0)
+        max_producers = (uint32_t)min<uint64_t>(item_count, cpus);
+    if (max_consumers == 0)
+        max_consumers = cpus;
+    max_producers = max(max_producers, initial_producers);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = signal_handler;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    action.sa_handler = child_handler;
+    action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigaction(SIGCHLD, &action, nullptr);
+
+    string producer_bin = sibling_binary(argv[0], "producer");
+    string consumer_bin = sibling_binary(argv[0], "consumer");
+    string aggregator_bin = sibling_binary(argv[0], "aggregator");
+    vector<string> job_args;
+    if (!job.id.empty())
+        job_args = {"--job", job.id};
+
+    vector<Child> children;
+    uint32_t producers_started = 0;
+    auto start_producer = [&]() {
+        string id = to_string(++producers_started);
+        vector<string> args = {producer_bin};
+        args.insert(args.end(), job_args.begin(), job_args.end());
+        if (bench)
+            args.push_back("--bench");
+        args.insert(args.end(), producer_opts.begin(), producer_opts.end());
+        args.insert(args.end(), {"--chunk-size", to_string(chunk_size), "--manifest", manifest_path});
+        pid_t pid = spawn(args, log_dir + "/producer_" + id + ".log");
+        if (pid > 0)
+            children.push_back({pid, "producer", id});
+        return pid > 0;
+    };
+    auto start_consumer = [&](uint32_t id) {
+        vector<string> args = {consumer_bin};
+        args.insert(args.end(), job_args.begin(), job_args.end());
+        if (bench)
+            args.push_back("--bench");
+        args.insert(args.end(), consumer_opts.begin(), consumer_opts.end());
+        args.insert(args.end(), {to_string(initial_producers), to_string(id)});
+        pid_t pid = spawn(args, log_dir + "/consumer_" + to_string(id) + ".log");
+        if (pid > 0)
+            children.push_back({pid, "consumer", to_string(id)});
+        return pid > 0;
+    };
+
+    cout << "wcrun: Job " << (job.id.empty() ? "(default)" : job.id) << ": " << inputs.size() << " files, " << item_count << " work items, "
+         << input_bytes << " bytes on " << cpus << " CPUs. Starting " << initial_producers << " producers (up to " << max_producers << ")." << endl;
+
+    bool producer_failed = false;
+    bool ok = true;
+    uint32_t partitions = MAX_PARTITIONS; // Until the segment tells: whose semaphores to remove on failure
+    for (uint32_t i = 0; ok && i < initial_producers; ++i)
+        ok = start_producer();
+
+    // Wait for the producers to lay out the segment, then take a producer's place in it
+    int shm_fd = -1;
+    SharedWordBuffer* wordBuffer = (SharedWordBuffer*) MAP_FAILED;
+    size_t mapped_size = 0;
+    while (ok && running.load() && wordBuffer == MAP_FAILED) {
+        waiting.store(running.load());
+        ok = reap_exited(children, job, producer_failed);
+        if (!ok)
+            break;
+        // Producers of a small input may all be done already; then the segment must be laid out by now
+        bool producers_running = count_running(children, "producer") > 0;
+        if (!producers_running)
+            waiting.store(false);
+        if (shm_fd == -1 && (shm_fd = attach_job_segment(segment_name, O_RDWR, reclaimed)) == -1) {
+            if (errno != ENOENT) {
+                perror("wcrun: shm_open failed");
+                ok = false;
+            } else if (!producers_running) {
+                cerr << "wcrun: Every producer exited without creating the shared word buffer." << endl;
+                ok = false;
+            }
+            usleep(1000);
+            continue;
+        }
+        // A child exiting interrupts the wait, to see whether the segment's creator died
+        wordBuffer = map_initialized_buffer(shm_fd, waiting, 1000, mapped_size);
+        if (wordBuffer == MAP_FAILED && !producers_running)
+            cerr << "wcrun: Every producer exited before the shared word buffer was laid out." << endl;
+        if (wordBuffer == MAP_FAILED && (waiting.load() || !producers_running)) // Rejected, or never laid out
+            ok = false;
+    }
+    if (wordBuffer != MAP_FAILED) {
+        wordBuffer->active_producers_count++;
+        partitions = wordBuffer->partition_count;
+    }
+
+    // The semaphore queue's occupancy is read from sem_full, which the producers created
+    vector<QueueSemaphores> sems(wordBuffer != MAP_FAILED && wordBuffer->queue_kind.load() == QUEUE_SEMAPHORE ? partitions : 0);
+    for (uint32_t p = 0; ok && p < sems.size(); ++p) {
+        if (!open_queue_semaphores(job, p, false, 0, sems[p])) {
+            perror("wcrun: sem_open failed");
+            ok = false;
+        }
+    }
+
+    // Every partition needs a consumer; consumer N drains partition (N - 1) mod partitions
+    vector<uint32_t> consumers_on(wordBuffer != MAP_FAILED ? partitions : 0);
+    auto start_partition_consumer = [&](uint32_t p) {
+        return start_consumer(p + 1 + consumers_on[p]++ * partitions);
+    };
+    bool one_consumer_per_partition = find(aggregator_opts.begin(), aggregator_opts.end(), "--partitioned") != aggregator_opts.end();
+    if (ok && running.load()) {
+        initial_consumers = max(initial_consumers, partitions);
+        max_consumers = max(max_consumers, initial_consumers);
+        if (one_consumer_per_partition && max_consumers > partitions) {
+            cout << "wcrun: The aggregator merges partitions: keeping one consumer per partition." << endl;
+            initial_consumers = max_consumers = partitions;
+        }
+        cout << "wcrun: " << partitions << " partitions (" << queue_kind_name(wordBuffer->queue_kind.load()) << " queue). Starting "
+             << initial_consumers << " consumers (up to " << max_consumers << ")." << endl;
+        for (uint32_t i = 0; ok && i < initial_consumers; ++i)
+            ok = start_partition_consumer(i % partitions);
+    }
+
+    // Grow the pool while producers run; close the job once the last one has left
+    WorkQueue* workQueue = (WorkQueue*) MAP_FAILED;
+    size_t work_queue_mapped_size = 0;
+    bool holding_job = wordBuffer != MAP_FAILED;
+    vector<uint32_t> full_samples(consumers_on.size());
+    uint32_t empty_samples = 0;
+    useconds_t interval_us = (useconds_t)(sample_interval * 1e6);
+    while (ok && running.load()) {
+        ok = reap_exited(children, job, producer_failed);
+        if (!ok)
+            break;
+        uint32_t producers_running = count_running(children, "producer");
+        uint32_t consumers_running = count_running(children, "consumer");
+        if (holding_job && producers_running == 0) {
+            holding_job = false;
+            if (--wordBuffer->active_producers_count == 0 && close_job(wordBuffer)) {
+                for (QueueSemaphores& s : sems)
+                    sem_post(s.full);
+            }
+            cout << "wcrun: All " << producers_started << " producers finished. Waiting for " << consumers_running << " consumers." << endl;
+        }
+        if (consumers_running == 0) {
+            if (holding_job) {
+                cerr << "wcrun: Every consumer exited while producers were still running." << endl;
+                ok = false;
+            }
+            break;
+        }
+
+        if (holding_job) {
+            if (workQueue == MAP_FAILED) { // Built by the first producer to claim work
+                int fd = shm_open(job.ipc(WORK_QUEUE_NAME).c_str(), O_RDWR, 0666);
+                if (fd != -1) {
+                    string error;
+                    workQueue = map_work_queue(fd, running, work_queue_mapped_size, error);
+                    close(fd);
+                }
+            }
+            uint64_t queued = 0;
+            for (uint32_t p = 0; p < partitions; ++p) {
+                Partition& part = wordBuffer->partition(p);
+                uint64_t occupancy = partition_occupancy(part, wordBuffer->queue_kind.load(), sems.empty() ? nullptr : &sems[p]);
+                queued += occupancy;
+                full_samples[p] = occupancy * 100 >= part.ring.capacity * FULL_RING_PERCENT ? full_samples[p] + 1 : 0;
+                if (full_samples[p] >= SCALE_PATIENCE && consumers_running < max_consumers && !one_consumer_per_partition) {
+                    cout << "wcrun: The ring of partition " << p << " stayed full: starting another consumer." << endl;
+                    ok = ok && start_partition_consumer(p);
+                    consumers_running++;
+                    full_samples[p] = 0;
+                }
+            }
+            empty_samples = queued == 0 ? empty_samples + 1 : 0;
+            uint64_t unclaimed = workQueue == MAP_FAILED ? 0 : workQueue->item_count - min(workQueue->next_item.load(), workQueue->item_count);
+            if (empty_samples >= SCALE_PATIENCE && unclaimed > 0 && producers_running < max_producers) {
+                cout << "wcrun: The rings stayed empty with " << unclaimed << " work items unclaimed: starting another producer." << endl;
+                ok = ok && start_producer();
+                empty_samples = 0;
+            }
+        }
+        usleep(interval_us);
+    }
+    if (workQueue != MAP_FAILED)
+        munmap(workQueue, work_queue_mapped_size);
+
+    if (!ok || !running.load()) {
+        if (running.load())
+            cerr << "wcrun: Stopping the job." << endl;
+        stop_children(children);
+        if (wordBuffer != MAP_FAILED)
+            munmap(wordBuffer, mapped_size);
+        if (shm_fd != -1)
+            close(shm_fd);
+        unlink_job_ipc(job, partitions, false);
+        unlink(manifest_path.c_str());
+        cerr << "wcrun: Removed the job's shared memory and semaphores; no report was written." << endl;
+        return 1;
+    }
+
+    // Every consumer has written its output: the segment can go, the dictionary once the aggregator has read it
+    munmap(wordBuffer, mapped_size);
+    close(shm_fd);
+    signal(SIGCHLD, SIG_DFL);
+    unlink_job_ipc(job, partitions, true);
+    unlink(manifest_path.c_str());
+
+    cout << "wcrun: Running the aggregator." << endl;
+    vector<string> args = {aggregator_bin};
+    args.insert(args.end(), job_args.begin(), job_args.end());
+    args.insert(args.end(), aggregator_opts.begin(), aggregator_opts.end());
+    pid_t pid = spawn(args, "");
+    int status = 0;
+    while (pid > 0 && waitpid(pid, &status, 0) == -1 && errno == EINTR) {
+    }
+    shm_unlink(job.ipc(DICTIONARY_NAME).c_str());
+    if (pid <= 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        cerr << "wcrun: The aggregator failed." << endl;
+        return 1;
+    }
+    if (producer_failed) {
+        cerr << "wcrun: A producer failed; the report may be missing some of its input (see " << log_dir << ")." << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,185 @@
+#include <iostream>
+#include <iomanip>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <string>
+
+#include "common.h"
+
+using namespace std;
+
+// vmstat-style monitor: attaches read-only to the shared segment and prints, once per interval,
+// the rates at which producers hand blocks in and consumers take them out, how often and how long
+// each side blocks on the queue (and, for the semaphore queue, on sem_mutex), and how full the rings are.
+
+atomic_bool running(true);
+
+size_t mapped_size = 0;
+
+void signal_handler(int) {
+    running.store(false);
+}
+
+// Sum of one role's counters at one instant
+struct RoleTotals {
+    uint32_t registered = 0;
+    uint32_t active = 0;
+    uint64_t words = 0, bytes = 0, blocks = 0;
+    uint64_t queue_waits = 0, queue_wait_ns = 0;
+    uint64_t lock_waits = 0, lock_wait_ns = 0;
+    uint64_t occupancy[OCCUPANCY_BUCKETS] = {};
+};
+
+void add_slot(RoleTotals& totals, const ProcessStats& slot) {
+    totals.words += slot.words.load(memory_order_relaxed);
+    totals.bytes += slot.bytes.load(memory_order_relaxed);
+    totals.blocks += slot.blocks.load(memory_order_relaxed);
+    totals.queue_waits += slot.queue_waits.load(memory_order_relaxed);
+    totals.queue_wait_ns += slot.queue_wait_ns.load(memory_order_relaxed);
+    totals.lock_waits += slot.lock_waits.load(memory_order_relaxed);
+    totals.lock_wait_ns += slot.lock_wait_ns.load(memory_order_relaxed);
+    for (uint32_t b = 0; b < OCCUPANCY_BUCKETS; ++b)
+        totals.occupancy[b] += slot.occupancy[b].load(memory_order_relaxed);
+}
+
+RoleTotals snapshot(const atomic<uint32_t>& claimed, const ProcessStats* slots) {
+    RoleTotals totals;
+    totals.registered = min(claimed.load(), MAX_STATS_SLOTS);
+    for (uint32_t i = 0; i < totals.registered; ++i) {
+        if (slots[i].state.load(memory_order_acquire) == STATS_SLOT_ACTIVE)
+            totals.active++;
+        add_slot(totals, slots[i]);
+    }
+    return totals;
+}
+
+// Mean ring fill (percent) over the samples taken since the previous snapshot, from bucket midpoints
+double mean_fill(const RoleTotals& now, const RoleTotals& before) {
+    uint64_t samples = 0;
+    double weighted = 0;
+    for (uint32_t b = 0; b < OCCUPANCY_BUCKETS; ++b) {
+        uint64_t delta = now.occupancy[b] - before.occupancy[b];
+        samples += delta;
+        weighted += delta * (b + 0.5) / OCCUPANCY_BUCKETS;
+    }
+    return samples ? 100.0 * weighted / samples : 0.0;
+}
+
+void print_header() {
+    cout << "-prod-cons- ---------producers (in)---------- ---------consumers (out)--------- ---sem_mutex--- ring" << endl;
+    cout << "  act  act    words/s     MB/s  waits/s wait%    words/s     MB/s  waits/s wait%  waits/s wait%  fill%" << endl;
+}
+
+void print_role(const RoleTotals& now, const RoleTotals& before, double seconds) {
+    double busy = seconds * 1e9 * max<uint32_t>(now.active, 1); // Process-nanoseconds in the interval
+    cout << setw(11) << (uint64_t)((now.words - before.words) / seconds)
+         << setw(9) << fixed << setprecision(1) << (now.bytes - before.bytes) / seconds / 1e6
+         << setw(9) << (uint64_t)((now.queue_waits - before.queue_waits) / seconds)
+         << setw(6) << setprecision(0) << min(100.0, 100.0 * (now.queue_wait_ns - before.queue_wait_ns) / busy);
+}
+
+void print_process(const char* role, uint32_t index, const ProcessStats& slot) {
+    static const char* states[] = {"free", "active", "done"};
+    uint32_t state = slot.state.load(memory_order_acquire);
+    cout << "  " << role << " " << setw(2) << index << " pid " << setw(7) << slot.pid.load(memory_order_relaxed)
+         << " " << setw(6) << (state <= STATS_SLOT_DONE ? states[state] : "?")
+         << "  words " << setw(12) << slot.words.load(memory_order_relaxed)
+         << "  blocks " << setw(8) << slot.blocks.load(memory_order_relaxed)
+         << "  queue waits " << setw(7) << slot.queue_waits.load(memory_order_relaxed)
+         << " (" << setprecision(1) << fixed << slot.queue_wait_ns.load(memory_order_relaxed) / 1e6 << " ms)"
+         << "  lock waits " << setw(7) << slot.lock_waits.load(memory_order_relaxed)
+         << "  fill";
+    for (uint32_t b = 0; b < OCCUPANCY_BUCKETS; ++b)
+        cout << " " << slot.occupancy[b].load(memory_order_relaxed);
+    cout << endl;
+}
+
+int main(int argc, char* argv[]) {
+    bool per_process = false;
+    double interval = 1.0;
+    long count = 0; // 0: until interrupted or the job ends
+    int positional = 0;
+    JobNames job;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "-p" || arg == "--per-process") {
+            per_process = true;
+        } else if (arg == "--job" && i + 1 < argc && valid_job_id(argv[i + 1])) {
+            job = JobNames(argv[++i]);
+        } else if (positional == 0 && atof(argv[i]) > 0) {
+            interval = atof(argv[i]);
+            positional++;
+        } else if (positional == 1 && atol(argv[i]) > 0) {
+            count = atol(argv[i]);
+            positional++;
+        } else {
+            cerr << "Usage: " << argv[0] << " [--per-process] [--job ID] [interval_seconds [count]]" << endl;
+            return 1;
+        }
+    }
+
+    if (signal(SIGINT, signal_handler) == SIG_ERR) {
+        perror("wcstat: signal failed");
+        return 1;
+    }
+
+    int shm_fd = shm_open(job.ipc(SHARED_MEM_NAME).c_str(), O_RDONLY, 0); // Watching does not keep the job alive, so no lock
+    if (shm_fd == -1) {
+        perror("wcstat: shm_open failed (is a producer running?)");
+        return 1;
+    }
+    SharedWordBuffer* wordBuffer = map_initialized_buffer(shm_fd, running, 100000, mapped_size, PROT_READ);
+    close(shm_fd);
+    if (wordBuffer == MAP_FAILED)
+        return 1;
+
+    StatsBlock& stats = wordBuffer->stats();
+    BlockRing& ring = wordBuffer->partition(0).ring;
+    cout << "wcstat: " << queue_kind_name(wordBuffer->queue_kind.load()) << " queue, " << wordBuffer->partition_count
+         << " partition(s) of " << ring.capacity << " blocks of " << ring.slot_size << " bytes" << endl;
+
+    RoleTotals producers = snapshot(stats.producer_slots, stats.producers);
+    RoleTotals consumers = snapshot(stats.consumer_slots, stats.consumers);
+    uint64_t last = monotonic_ns();
+    for (long line = 0; running.load() && (count == 0 || line < count); ++line) {
+        usleep((useconds_t)(interval * 1e6));
+        uint64_t now = monotonic_ns();
+        double seconds = (now - last) / 1e9;
+        last = now;
+        RoleTotals next_producers = snapshot(stats.producer_slots, stats.producers);
+        RoleTotals next_consumers = snapshot(stats.consumer_slots, stats.consumers);
+
+        if (per_process || line % 20 == 0)
+            print_header();
+        cout << setw(5) << next_producers.active << setw(5) << next_consumers.active;
+        print_role(next_producers, producers, seconds);
+        print_role(next_consumers, consumers, seconds);
+        uint64_t lock_waits = (next_producers.lock_waits - producers.lock_waits) + (next_consumers.lock_waits - consumers.lock_waits);
+        uint64_t lock_ns = (next_producers.lock_wait_ns - producers.lock_wait_ns) + (next_consumers.lock_wait_ns - consumers.lock_wait_ns);
+        double busy = seconds * 1e9 * max<uint32_t>(next_producers.active + next_consumers.active, 1);
+        cout << setw(9) << (uint64_t)(lock_waits / seconds) << setw(6) << setprecision(0) << min(100.0, 100.0 * lock_ns / busy)
+             << setw(7) << mean_fill(next_producers, producers) << endl;
+        if (per_process) {
+            for (uint32_t i = 0; i < next_producers.registered; ++i)
+                print_process("producer", i, stats.producers[i]);
+            for (uint32_t i = 0; i < next_consumers.registered; ++i)
+                print_process("consumer", i, stats.consumers[i]);
+        }
+        producers = next_producers;
+        consumers = next_consumers;
+
+        // Stop once everybody who registered has finished
+        if (producers.registered + consumers.registered > 0 && producers.active + consumers.active == 0) {
+            cout << "wcstat: all producers and consumers have finished." << endl;
+            break;
+        }
+    }
+
+    munmap(wordBuffer, mapped_size);
+    return 0;
+}
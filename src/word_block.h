@@ -0,0 +1,185 @@
+#ifndef WORD_BLOCK_H
+#define WORD_BLOCK_H
+
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+
+// A block is one ring slot's worth of words: a small header followed by
+// length-prefixed words packed back to back ([uint8_t length][bytes]...).
+// Blocks from a combining producer carry counted records instead: [uint8_t length][bytes][varint count].
+// Blocks of an interned job carry 32-bit dictionary IDs in place of the words ([uint32_t id] or
+// [uint32_t id][varint count]).
+// Producers fill a whole block locally and publish it in one step.
+
+const uint32_t BLOCK_FLAG_COUNTED = 1u << 1; // Every record carries a LEB128 occurrence count
+const uint32_t BLOCK_FLAG_IDS = 1u << 2;     // Records are word IDs (see dictionary.h), not words
+const uint32_t MAX_VARINT_BYTES = 10;
+
+// LEB128: 7 bits per byte, low groups first, high bit set on every byte but the last.
+// Writes at most MAX_VARINT_BYTES bytes and returns the position after the varint.
+inline char* put_varint(char* out, uint64_t value) {
+    do {
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        *out++ = (char)(value ? byte | 0x80 : byte);
+    } while (value);
+    return out;
+}
+
+inline const char* get_varint(const char* in, uint64_t& value) {
+    value = 0;
+    for (int shift = 0;; shift += 7) {
+        uint8_t byte = (uint8_t)*in++;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return in;
+    }
+}
+
+struct BlockHeader {
+    uint32_t bytes_used;   // Header plus packed records
+    uint32_t record_count; // Number of words in the block
+    uint32_t flags;
+    uint32_t reserved;
+    uint64_t publish_ns;   // monotonic_ns() when the producer handed the block to the queue
+};
+
+// CLOCK_MONOTONIC is system-wide, so a consumer can subtract a producer's timestamp
+inline uint64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Appends words into a caller-owned buffer of `capacity` bytes
+class BlockWriter {
+public:
+    BlockWriter(char* buffer, uint32_t capacity) : buffer_(buffer), capacity_(capacity) {
+        header()->flags = 0;
+        reset();
+    }
+
+    // Empties the block; a counted or ID block stays one
+    void reset() {
+        header()->bytes_used = sizeof(BlockHeader);
+        header()->record_count = 0;
+        header()->flags &= BLOCK_FLAG_COUNTED | BLOCK_FLAG_IDS;
+        header()->reserved = 0;
+        header()->publish_ns = 0;
+    }
+
+    // Switches an empty block to counted records
+    void set_counted() {
+        header()->flags |= BLOCK_FLAG_COUNTED;
+    }
+
+    // Switches an empty block to ID records
+    void set_ids() {
+        header()->flags |= BLOCK_FLAG_IDS;
+    }
+
+    bool counted() const { return (header()->flags & BLOCK_FLAG_COUNTED) != 0; }
+    bool ids() const { return (header()->flags & BLOCK_FLAG_IDS) != 0; }
+
+    void set_publish_time(uint64_t ns) { header()->publish_ns = ns; }
+
+    // Returns false when the block has no room left for this word
+    bool append(const char* word, uint8_t length) {
+        uint32_t used = header()->bytes_used;
+        if (used + 1 + length > capacity_)
+            return false;
+        buffer_[used] = (char)length;
+        memcpy(buffer_ + used + 1, word, length);
+        header()->bytes_used = used + 1 + length;
+        header()->record_count++;
+        return true;
+    }
+
+    // Appends a (word, count) record to a counted block; returns false when it does not fit
+    bool append_counted(const char* word, uint8_t length, uint64_t count) {
+        uint32_t used = header()->bytes_used;
+        if (used + 1 + length + MAX_VARINT_BYTES > capacity_)
+            return false;
+        buffer_[used] = (char)length;
+        memcpy(buffer_ + used + 1, word, length);
+        header()->bytes_used = (uint32_t)(put_varint(buffer_ + used + 1 + length, count) - buffer_);
+        header()->record_count++;
+        return true;
+    }
+
+    // Appends an ID record, with its count if the block is counted; returns false when it does not fit
+    bool append_id(uint32_t id, uint64_t count) {
+        uint32_t used = header()->bytes_used;
+        if (used + sizeof(id) + (counted() ? MAX_VARINT_BYTES : 0) > capacity_)
+            return false;
+        memcpy(buffer_ + used, &id, sizeof(id));
+        used += sizeof(id);
+        if (counted())
+            used = (uint32_t)(put_varint(buffer_ + used, count) - buffer_);
+        header()->bytes_used = used;
+        header()->record_count++;
+        return true;
+    }
+
+    bool empty() const { return header()->record_count == 0; }
+    uint32_t bytes_used() const { return header()->bytes_used; }
+    uint32_t record_count() const { return header()->record_count; }
+    const char* data() const { return buffer_; }
+
+private:
+    BlockHeader* header() const { return reinterpret_cast<BlockHeader*>(buffer_); }
+
+    char* buffer_;
+    uint32_t capacity_;
+};
+
+// Walks the records of a published block without copying them: next() for word blocks,
+// next_id() for ID blocks (ids() says which). Uncounted records report a count of 1.
+class BlockReader {
+public:
+    explicit BlockReader(const char* block)
+        : cursor_(block + sizeof(BlockHeader)),
+          remaining_(reinterpret_cast<const BlockHeader*>(block)->record_count),
+          counted_((reinterpret_cast<const BlockHeader*>(block)->flags & BLOCK_FLAG_COUNTED) != 0),
+          ids_((reinterpret_cast<const BlockHeader*>(block)->flags & BLOCK_FLAG_IDS) != 0) {}
+
+    bool ids() const { return ids_; }
+
+    bool next(const char*& word, uint8_t& length, uint64_t& count) {
+        if (remaining_ == 0)
+            return false;
+        length = (uint8_t)*cursor_;
+        word = cursor_ + 1;
+        cursor_ += 1 + length;
+        count = 1;
+        if (counted_)
+            cursor_ = get_varint(cursor_, count);
+        remaining_--;
+        return true;
+    }
+
+    bool next_id(uint32_t& id, uint64_t& count) {
+        if (remaining_ == 0)
+            return false;
+        memcpy(&id, cursor_, sizeof(id));
+        cursor_ += sizeof(id);
+        count = 1;
+        if (counted_)
+            cursor_ = get_varint(cursor_, count);
+        remaining_--;
+        return true;
+    }
+
+private:
+    const char* cursor_;
+    uint32_t remaining_;
+    bool counted_;
+    bool ids_;
+};
+
+inline const BlockHeader* block_header(const char* block) {
+    return reinterpret_cast<const BlockHeader*>(block);
+}
+
+#endif
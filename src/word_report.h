@@ -0,0 +1,165 @@
+#ifndef WORD_REPORT_H
+#define WORD_REPORT_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "futex.h"
+#include "word_table.h"
+
+// Multithreaded counting and the final report, shared by the aggregator and the single-process
+// wordcount engine so both produce byte-identical aggregated_word_counts.txt files.
+
+// Runs fn(i) for i in [0, tasks) on up to `threads` threads, each claiming the next index
+template <typename Fn>
+void parallel_for(size_t tasks, unsigned threads, Fn&& fn) {
+    std::atomic<size_t> next_task(0);
+    auto worker = [&]() {
+        for (size_t i; (i = next_task.fetch_add(1)) < tasks;)
+            fn(i);
+    };
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threads && t < tasks; ++t)
+        pool.emplace_back(worker);
+    worker();
+    for (std::thread& thread : pool)
+        thread.join();
+}
+
+// Sorts by count_order on up to `threads` threads: contiguous chunks are sorted concurrently,
+// then neighbouring chunks are merged pairwise until one run is left
+inline void parallel_sort(std::vector<WordCountTable::Entry>& entries, unsigned threads) {
+    const size_t min_chunk = 1 << 16;
+    size_t chunks = std::min<size_t>(threads, entries.size() / min_chunk);
+    if (chunks < 2) {
+        std::sort(entries.begin(), entries.end(), count_order);
+        return;
+    }
+    std::vector<size_t> bounds(chunks + 1);
+    for (size_t i = 0; i <= chunks; ++i)
+        bounds[i] = entries.size() * i / chunks;
+
+    auto begin = entries.begin();
+    parallel_for(chunks, threads, [&](size_t i) {
+        std::sort(begin + bounds[i], begin + bounds[i + 1], count_order);
+    });
+    for (size_t width = 1; width < chunks; width *= 2) {
+        size_t pairs = (chunks + 2 * width - 1) / (2 * width);
+        parallel_for(pairs, threads, [&](size_t pair) {
+            size_t lo = pair * 2 * width;
+            if (lo + width >= chunks)
+                return; // Odd run out: already sorted
+            size_t hi = std::min(lo + 2 * width, chunks);
+            std::inplace_merge(begin + bounds[lo], begin + bounds[lo + width], begin + bounds[hi], count_order);
+        });
+    }
+}
+
+// Moves the `top_k` first entries in count_order to the front, sorted, and leaves the rest behind
+// them unordered (top_k == 0 sorts everything)
+inline void sort_top(std::vector<WordCountTable::Entry>& entries, size_t top_k, unsigned threads) {
+    if (top_k == 0 || top_k >= entries.size())
+        parallel_sort(entries, threads);
+    else
+        std::partial_sort(entries.begin(), entries.begin() + top_k, entries.end(), count_order);
+}
+
+// Keeps only the `top_k` first entries in count_order (top_k == 0 keeps and sorts everything)
+inline void select_top(std::vector<WordCountTable::Entry>& entries, size_t top_k, unsigned threads) {
+    sort_top(entries, top_k, threads);
+    if (top_k && top_k < entries.size())
+        entries.resize(top_k);
+}
+
+// Word counts gathered by several threads at once. Every worker counts into its own set of
+// tables, one per hash shard, so no table is ever shared while counting; merge() then folds
+// shard s of every worker together on one thread per shard.
+class ShardedWordCounts {
+public:
+    explicit ShardedWordCounts(unsigned workers) : shards_(workers ? workers : 1), local_(shards_), totals_(shards_) {
+        for (std::vector<WordCountTable>& tables : local_) {
+            for (unsigned s = 0; s < shards_; ++s)
+                tables.emplace_back(256);
+        }
+    }
+
+    unsigned workers() const { return shards_; }
+
+    // Only ever called by `worker` itself
+    void add(unsigned worker, const char* key, size_t length, uint64_t count = 1) {
+        uint64_t hash = hash_word(key, length);
+        local_[worker][(hash >> 32) % shards_].add_hashed(key, length, hash, count);
+        totals_[worker].value += count;
+    }
+
+    // Merges the shards on up to `threads` threads. Returns every entry, or with `top_k` only each
+    // shard's K best (which always include the global K best). Keys stay owned by this object.
+    std::vector<WordCountTable::Entry> merge(unsigned threads, size_t top_k, size_t& unique_words, uint64_t& total_words) {
+        merged_.clear();
+        for (unsigned s = 0; s < shards_; ++s)
+            merged_.emplace_back(1024);
+        std::vector<std::vector<WordCountTable::Entry>> shard_entries(shards_);
+        parallel_for(shards_, threads, [&](size_t s) {
+            for (unsigned w = 0; w < shards_; ++w) {
+                local_[w][s].for_each([&](const WordCountTable::Entry& e) { merged_[s].add(e.key, e.length, e.count); });
+                local_[w][s] = WordCountTable(16); // The merged copy owns the keys now
+            }
+            shard_entries[s] = merged_[s].entries();
+            if (top_k && top_k < shard_entries[s].size()) {
+                std::partial_sort(shard_entries[s].begin(), shard_entries[s].begin() + top_k, shard_entries[s].end(), count_order);
+                shard_entries[s].resize(top_k);
+            }
+        });
+
+        std::vector<WordCountTable::Entry> entries;
+        for (unsigned s = 0; s < shards_; ++s) {
+            unique_words += merged_[s].size();
+            entries.insert(entries.end(), shard_entries[s].begin(), shard_entries[s].end());
+        }
+        for (const PaddedTotal& total : totals_)
+            total_words += total.value;
+        return entries;
+    }
+
+private:
+    struct alignas(CACHE_LINE_SIZE) PaddedTotal {
+        uint64_t value = 0; // One line per worker so the running totals never share a cache line
+    };
+
+    unsigned shards_;
+    std::vector<std::vector<WordCountTable>> local_; // [worker][shard]
+    std::vector<WordCountTable> merged_;             // [shard], filled by merge()
+    std::vector<PaddedTotal> totals_;
+};
+
+// Parses a positive integer option value; returns false (after reporting) if it is not one
+inline bool parse_count_option(const char* name, const std::string& text, size_t& out) {
+    try {
+        size_t digits = 0;
+        unsigned long long value = std::stoull(text, &digits);
+        if (digits == text.size() && text[0] != '-' && value > 0) {
+            out = (size_t)value;
+            return true;
+        }
+    } catch (const std::exception& e) {
+    }
+    std::cerr << "Error: " << name << " expects a positive integer, got '" << text << "'" << std::endl;
+    return false;
+}
+
+// The summary block at the top of aggregated_word_counts.txt
+inline void write_report_header(std::ostream& out, size_t unique_words, uint64_t total_words, size_t top_k) {
+    out << "--- Truly Aggregated Word Count Summary ---\n";
+    out << "Total Unique Words: " << unique_words << "\n";
+    out << "Total Words Processed (sum of all consumers): " << total_words << "\n";
+    if (top_k)
+        out << "Showing Top " << top_k << " Words\n";
+    out << "-------------------------------------------\n";
+}
+
+#endif
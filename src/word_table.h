@@ -0,0 +1,187 @@
+#ifndef WORD_TABLE_H
+#define WORD_TABLE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include <string_view>
+
+#include "hash.h"
+
+// Bump allocator for key bytes. Chunks are never moved, so pointers into the arena stay valid
+// for the arena's lifetime; nothing is freed individually.
+class ByteArena {
+public:
+    explicit ByteArena(size_t chunk_size = 1 << 20) : chunk_size_(chunk_size) {}
+
+    char* allocate(size_t bytes) {
+        if (bytes > remaining_) {
+            size_t size = bytes > chunk_size_ ? bytes : chunk_size_;
+            chunks_.emplace_back(new char[size]);
+            cursor_ = chunks_.back().get();
+            remaining_ = size;
+            reserved_ += size;
+        }
+        char* out = cursor_;
+        cursor_ += bytes;
+        remaining_ -= bytes;
+        return out;
+    }
+
+    size_t bytes_reserved() const { return reserved_; }
+
+private:
+    std::vector<std::unique_ptr<char[]>> chunks_;
+    size_t chunk_size_;
+    char* cursor_ = nullptr;
+    size_t remaining_ = 0;
+    size_t reserved_ = 0;
+};
+
+// Word -> 64-bit count table. Open addressing with linear probing over a power-of-two slot
+// array; each slot keeps the full hash so probes compare keys only on a hash match and
+// growing never rehashes key bytes. Keys are copied into a ByteArena on first insert, and
+// lookups take (pointer, length) so callers never build a std::string.
+class WordCountTable {
+public:
+    struct Entry {
+        const char* key;
+        uint32_t length;
+        uint64_t count;
+
+        std::string_view word() const { return std::string_view(key, length); }
+    };
+
+    explicit WordCountTable(size_t initial_capacity = 1024) {
+        size_t capacity = 16;
+        while (capacity < initial_capacity)
+            capacity *= 2;
+        slots_.assign(capacity, Slot());
+        mask_ = capacity - 1;
+    }
+
+    // Adds `delta` to the word's count (inserting it at 0 first) and returns the new count
+    uint64_t add(const char* key, size_t length, uint64_t delta = 1) {
+        return add_hashed(key, length, hash_word(key, length), delta);
+    }
+
+    uint64_t add_hashed(const char* key, size_t length, uint64_t hash, uint64_t delta) {
+        if ((size_ + 1) * 10 > slots_.size() * 7) // Keep load under 70%
+            grow();
+        for (size_t i = hash & mask_;; i = (i + 1) & mask_) {
+            Slot& slot = slots_[i];
+            if (!slot.key) {
+                char* copy = arena_.allocate(length ? length : 1); // Never null, even for an empty key
+                memcpy(copy, key, length);
+                slot.key = copy;
+                slot.length = (uint32_t)length;
+                slot.hash = hash;
+                slot.count = delta;
+                size_++;
+                return slot.count;
+            }
+            if (slot.hash == hash && slot.length == length && memcmp(slot.key, key, length) == 0) {
+                slot.count += delta;
+                return slot.count;
+            }
+        }
+    }
+
+    // Returns 0 for a word that was never added
+    uint64_t find(const char* key, size_t length) const {
+        uint64_t hash = hash_word(key, length);
+        for (size_t i = hash & mask_;; i = (i + 1) & mask_) {
+            const Slot& slot = slots_[i];
+            if (!slot.key)
+                return 0;
+            if (slot.hash == hash && slot.length == length && memcmp(slot.key, key, length) == 0)
+                return slot.count;
+        }
+    }
+
+    // Calls fn(const Entry&) for every word, in table order
+    template <typename Fn>
+    void for_each(Fn&& fn) const {
+        for (const Slot& slot : slots_) {
+            if (slot.key)
+                fn(Entry{slot.key, slot.length, slot.count});
+        }
+    }
+
+    // Snapshot of all entries, e.g. for sorting; keys point into the table's arena
+    std::vector<Entry> entries() const {
+        std::vector<Entry> out;
+        out.reserve(size_);
+        for_each([&](const Entry& e) { out.push_back(e); });
+        return out;
+    }
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    size_t memory_bytes() const { return slots_.size() * sizeof(Slot) + arena_.bytes_reserved(); }
+
+private:
+    struct Slot {
+        uint64_t hash = 0;
+        uint64_t count = 0;
+        const char* key = nullptr; // nullptr marks an empty slot
+        uint32_t length = 0;
+    };
+
+    void grow() {
+        std::vector<Slot> old;
+        old.swap(slots_);
+        slots_.assign(old.size() * 2, Slot());
+        mask_ = slots_.size() - 1;
+        for (const Slot& slot : old) {
+            if (!slot.key)
+                continue;
+            size_t i = slot.hash & mask_;
+            while (slots_[i].key)
+                i = (i + 1) & mask_;
+            slots_[i] = slot;
+        }
+    }
+
+    std::vector<Slot> slots_;
+    size_t mask_ = 0;
+    size_t size_ = 0;
+    ByteArena arena_;
+};
+
+// Count descending, ties broken by word: the order every report and output file uses
+inline bool count_order(const WordCountTable::Entry& a, const WordCountTable::Entry& b) {
+    if (a.count != b.count)
+        return a.count > b.count;
+    return a.word() < b.word();
+}
+
+// A consumer's text output starts with this line naming the hash partition it drained, so the
+// aggregator can tell whether the outputs are disjoint. Words never hold spaces, so the line
+// cannot be mistaken for a "word\tcount" record.
+inline std::string partition_line(uint32_t partition, uint32_t partition_count) {
+    return "# partition " + std::to_string(partition) + " of " + std::to_string(partition_count);
+}
+
+// Parses a partition_line(); false if `line` is anything else
+inline bool parse_partition_line(std::string_view line, uint32_t& partition, uint32_t& partition_count) {
+    auto number = [&](std::string_view prefix, uint32_t& value) {
+        if (line.substr(0, prefix.size()) != prefix)
+            return false;
+        line.remove_prefix(prefix.size());
+        uint64_t parsed = 0;
+        size_t digits = 0;
+        while (digits < line.size() && digits < 10 && line[digits] >= '0' && line[digits] <= '9')
+            parsed = parsed * 10 + (line[digits++] - '0');
+        line.remove_prefix(digits);
+        value = (uint32_t)parsed;
+        return digits > 0 && parsed <= UINT32_MAX;
+    };
+    return number("# partition ", partition) && number(" of ", partition_count) && line.empty()
+           && partition < partition_count;
+}
+
+#endif
@@ -0,0 +1,188 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+
+#include "common.h"
+#include "tokenizer.h"
+#include "word_report.h"
+
+// Single-process word count: the whole producer -> consumer -> aggregator pipeline in one binary,
+// for runs on one machine. The input files are mapped and cut into byte-range chunks at word
+// boundaries; a pool of threads counts the chunks into thread-private hash shards and the shards
+// are merged in parallel, giving the same aggregated_word_counts.txt as the multi-process path.
+
+const size_t DEFAULT_CHUNK_SIZE = 1 << 20;
+
+struct Chunk {
+    size_t file;
+    size_t begin;
+    size_t end;
+};
+
+// One worker's chunks. The owner works through them front to back, so it reads its share of a
+// file sequentially; idle workers steal from the back, as far from the owner as possible.
+struct alignas(CACHE_LINE_SIZE) ChunkQueue {
+    std::mutex mutex;
+    std::deque<Chunk> chunks;
+
+    bool pop_front(Chunk& chunk) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (chunks.empty())
+            return false;
+        chunk = chunks.front();
+        chunks.pop_front();
+        return true;
+    }
+
+    bool steal_back(Chunk& chunk) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (chunks.empty())
+            return false;
+        chunk = chunks.back();
+        chunks.pop_back();
+        return true;
+    }
+};
+
+// Cuts every file into chunks of about `chunk_size` bytes, moving each cut forward past the word
+// it lands in. All cuts are made before any thread starts lowercasing the buffers in place.
+std::vector<Chunk> plan_chunks(std::vector<MappedFile>& files, size_t chunk_size) {
+    std::vector<Chunk> chunks;
+    for (size_t f = 0; f < files.size(); ++f) {
+        const char* data = files[f].data();
+        size_t size = files[f].size();
+        for (size_t begin = 0; begin < size;) {
+            size_t end = align_to_word_boundary(data, size, std::min(size, begin + chunk_size));
+            chunks.push_back(Chunk{f, begin, end});
+            begin = end;
+        }
+    }
+    return chunks;
+}
+
+int main(int argc, char* argv[]) {
+    size_t top_k = 0; // 0: write every word
+    size_t chunk_size = DEFAULT_CHUNK_SIZE;
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    std::string output_filename = "aggregated_word_counts.txt";
+    Normalization normalization = NORMALIZE_ASCII;
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--top" && i + 1 < argc) {
+            if (!parse_count_option("--top", argv[++i], top_k))
+                return 1;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            if (!parse_count_option("--threads", argv[++i], threads))
+                return 1;
+        } else if (arg == "--chunk-size" && i + 1 < argc) {
+            if (!parse_count_option("--chunk-size", argv[++i], chunk_size))
+                return 1;
+        } else if (arg == "--output" && i + 1 < argc) {
+            output_filename = argv[++i];
+        } else if (arg == "--normalize" && i + 1 < argc) {
+            if (!parse_normalization(argv[++i], normalization)) {
+                std::cerr << "Error: --normalize must be ascii, ascii-punct or utf8." << std::endl;
+                return 1;
+            }
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            paths.clear();
+            break;
+        } else {
+            paths.push_back(arg);
+        }
+    }
+    if (paths.empty()) {
+        std::cerr << "Usage: " << argv[0] << " [--threads N] [--chunk-size BYTES] [--top K] [--normalize ascii|ascii-punct|utf8] [--output FILE] <input_file>..." << std::endl;
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<MappedFile> files(paths.size());
+    uint64_t input_bytes = 0;
+    for (size_t f = 0; f < paths.size(); ++f) {
+        if (!files[f].open(paths[f].c_str())) {
+            perror(("Wordcount: Error opening input file " + paths[f]).c_str());
+            return 1;
+        }
+        input_bytes += files[f].size();
+    }
+
+    std::vector<Chunk> chunks = plan_chunks(files, chunk_size);
+    unsigned workers = (unsigned)std::max<size_t>(1, std::min(threads, chunks.size()));
+    // Each worker starts with a contiguous run of chunks
+    std::unique_ptr<ChunkQueue[]> queues(new ChunkQueue[workers]);
+    for (size_t i = 0; i < chunks.size(); ++i)
+        queues[i * workers / chunks.size()].chunks.push_back(chunks[i]);
+
+    ShardedWordCounts counts(workers);
+    std::vector<size_t> stolen(workers, 0);
+    auto count_chunks = [&](unsigned worker) {
+        Chunk chunk;
+        for (;;) {
+            bool found = queues[worker].pop_front(chunk);
+            // Chunks are never added once counting starts, so one empty sweep means we are done
+            for (unsigned v = 1; !found && v < workers; ++v) {
+                found = queues[(worker + v) % workers].steal_back(chunk);
+                if (found)
+                    stolen[worker]++;
+            }
+            if (!found)
+                return;
+            tokenize_mapped(normalization, files[chunk.file], chunk.begin, chunk.end, [&](const char* word, size_t length) {
+                counts.add(worker, word, truncate_word(word, length, MAX_WORD_LENGTH - 1));
+                return true;
+            });
+        }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned w = 1; w < workers; ++w)
+        pool.emplace_back(count_chunks, w);
+    count_chunks(0);
+    for (std::thread& thread : pool)
+        thread.join();
+
+    size_t unique_words = 0;
+    uint64_t total_words = 0;
+    std::vector<WordCountTable::Entry> sorted_words = counts.merge((unsigned)threads, top_k, unique_words, total_words);
+    select_top(sorted_words, top_k, (unsigned)threads);
+
+    size_t steals = 0;
+    for (size_t s : stolen)
+        steals += s;
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Counted " << total_words << " words (" << unique_words << " unique) in " << paths.size() << " file(s): "
+              << chunks.size() << " chunks on " << workers << " thread(s), " << steals << " stolen, "
+              << seconds << " s, " << input_bytes / seconds / 1e6 << " MB/s" << std::endl;
+
+    if (unique_words == 0) {
+        std::cout << "No words found in the input files." << std::endl;
+        return 0;
+    }
+
+    std::ofstream final_outfile(output_filename);
+    if (!final_outfile.is_open()) {
+        std::cerr << "Error: Could not open final output file " << output_filename << std::endl;
+        return 1;
+    }
+    write_report_header(final_outfile, unique_words, total_words, top_k);
+    for (const WordCountTable::Entry& entry : sorted_words)
+        final_outfile << entry.word() << ": " << entry.count << "\n";
+    final_outfile.close();
+    if (!final_outfile) {
+        std::cerr << "Error: Could not write final output file " << output_filename << std::endl;
+        return 1;
+    }
+
+    std::cout << "Results are in '" << output_filename << "'" << std::endl;
+    return 0;
+}
@@ -0,0 +1,256 @@
+#ifndef WORK_QUEUE_H
+#define WORK_QUEUE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <glob.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "futex.h"
+#include "decompress.h"
+
+// Shared input queue for a fixed pool of producers. The first producer given a directory, a glob
+// or a manifest expands it into work items (whole files, or word-aligned slices of large files),
+// sorts them largest first and publishes them in their own shared segment; every producer in the
+// pool then claims the next item with one fetch_add until none are left. Taking the largest items
+// first leaves only small ones for the end of the job, so producers finish at about the same time.
+
+const char* WORK_QUEUE_NAME = "/word_work_queue";
+
+// Uncompressed files larger than this are split into slices of about this size
+const uint64_t DEFAULT_WORK_CHUNK_SIZE = 64ull << 20;
+const uint64_t MIN_WORK_CHUNK_SIZE = 1 << 20;
+const size_t WORK_QUEUE_SOURCE_LENGTH = 256; // Bytes of the source description kept in the header
+
+enum WorkQueueState : uint32_t {
+    WORK_QUEUE_BUILDING = 0, // Segment created, items not written yet
+    WORK_QUEUE_READY = 1,    // Items published; producers claim them
+    WORK_QUEUE_FAILED = 2    // The builder could not expand its source and unlinked the segment
+};
+
+struct WorkItem {
+    uint64_t bytes;       // Size of the file, or of this slice of it; items are sorted on it
+    uint64_t path_offset; // NUL-terminated path, from the start of the segment
+    uint32_t part_index;  // Slice part_index of part_count, cut at word boundaries as with --part
+    uint32_t part_count;
+};
+
+// Header of the work queue segment. It is followed by `item_count` WorkItems and then the paths.
+struct WorkQueue {
+    std::atomic<uint32_t> state; // WorkQueueState; futex word
+    uint64_t total_size;         // Size of the whole mapping in bytes
+    uint64_t item_count;
+    uint64_t total_bytes;        // Input bytes over all items
+    char source[WORK_QUEUE_SOURCE_LENGTH]; // What the builder expanded, to spot a pool started on different inputs
+
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> next_item; // Index of the next unclaimed item
+
+    WorkItem* items();
+    const char* path(const WorkItem& item) { return reinterpret_cast<const char*>(this) + item.path_offset; }
+
+    // Claims the next item; false once every item has been handed out
+    bool claim(WorkItem& item, uint64_t& index) {
+        index = next_item.fetch_add(1);
+        if (index >= item_count)
+            return false;
+        item = items()[index];
+        return true;
+    }
+};
+
+inline uint64_t work_queue_header_size() {
+    return (sizeof(WorkQueue) + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+}
+
+inline WorkItem* WorkQueue::items() {
+    return reinterpret_cast<WorkItem*>(reinterpret_cast<char*>(this) + work_queue_header_size());
+}
+
+// An input file found while expanding a source
+struct WorkInput {
+    std::string path;
+    uint64_t size;
+    bool compressed; // Decoded as a stream, so never split
+};
+
+inline bool has_glob_chars(const std::string& text) {
+    return text.find_first_of("*?[") != std::string::npos;
+}
+
+// True if `source` names a directory, or is a glob pattern rather than an existing file: the
+// producer then reads it through the work queue instead of as one file
+inline bool is_work_source(const std::string& source) {
+    struct stat st;
+    if (stat(source.c_str(), &st) == 0)
+        return S_ISDIR(st.st_mode);
+    return has_glob_chars(source);
+}
+
+// Adds a regular file, or every regular file below a directory (recursively, in name order).
+// Empty files are skipped: they hold no words.
+inline bool add_work_path(const std::string& path, std::vector<WorkInput>& inputs, std::string& error) {
+    struct stat st;
+    if (stat(path.c_str(), &st) == -1) {
+        error = path + ": " + strerror(errno);
+        return false;
+    }
+    if (S_ISREG(st.st_mode)) {
+        if (st.st_size > 0)
+            inputs.push_back({path, (uint64_t)st.st_size, detect_compression(path.c_str()) != COMPRESSION_NONE});
+        return true;
+    }
+    if (!S_ISDIR(st.st_mode))
+        return true; // Sockets, devices and the like are not inputs
+    DIR* dir = opendir(path.c_str());
+    if (!dir) {
+        error = path + ": " + strerror(errno);
+        return false;
+    }
+    std::vector<std::string> names;
+    while (struct dirent* entry = readdir(dir)) {
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+            names.push_back(entry->d_name);
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+    std::string prefix = path.back() == '/' ? path : path + "/";
+    for (const std::string& name : names) {
+        if (!add_work_path(prefix + name, inputs, error))
+            return false;
+    }
+    return true;
+}
+
+// Expands a manifest (one file or directory per line; blank lines and lines starting with '#'
+// are ignored), or else a directory, a glob pattern or a single file, into input files
+inline bool expand_work_source(const std::string& source, bool manifest, std::vector<WorkInput>& inputs, std::string& error) {
+    if (manifest) {
+        std::ifstream list(source);
+        if (!list) {
+            error = source + ": " + strerror(errno);
+            return false;
+        }
+        std::string line;
+        while (std::getline(list, line)) {
+            size_t first = line.find_first_not_of(" \t\r");
+            size_t last = line.find_last_not_of(" \t\r");
+            if (first == std::string::npos || line[first] == '#')
+                continue;
+            if (!add_work_path(line.substr(first, last - first + 1), inputs, error))
+                return false;
+        }
+        return true;
+    }
+    struct stat st;
+    if (stat(source.c_str(), &st) == 0 || !has_glob_chars(source))
+        return add_work_path(source, inputs, error);
+
+    glob_t matches;
+    int result = glob(source.c_str(), 0, nullptr, &matches);
+    if (result == GLOB_NOMATCH) {
+        error = source + ": matches no files";
+        return false;
+    }
+    if (result != 0) {
+        error = source + ": glob failed";
+        return false;
+    }
+    bool ok = true;
+    for (size_t i = 0; ok && i < matches.gl_pathc; ++i)
+        ok = add_work_path(matches.gl_pathv[i], inputs, error);
+    globfree(&matches);
+    return ok;
+}
+
+// Size of the segment holding `inputs` cut into items of about `chunk_size` bytes
+inline uint64_t work_queue_size(const std::vector<WorkInput>& inputs, uint64_t chunk_size, uint64_t& item_count) {
+    item_count = 0;
+    uint64_t path_bytes = 0;
+    for (const WorkInput& input : inputs) {
+        item_count += input.compressed ? 1 : (input.size + chunk_size - 1) / chunk_size;
+        path_bytes += input.path.size() + 1;
+    }
+    return work_queue_header_size() + item_count * sizeof(WorkItem) + path_bytes;
+}
+
+// Fills a mapping of work_queue_size() bytes with the items, largest first, and publishes it
+inline void init_work_queue(WorkQueue* queue, const std::string& source, const std::vector<WorkInput>& inputs, uint64_t chunk_size) {
+    uint64_t item_count = 0;
+    queue->total_size = work_queue_size(inputs, chunk_size, item_count);
+    queue->item_count = item_count;
+    queue->total_bytes = 0;
+    strncpy(queue->source, source.c_str(), WORK_QUEUE_SOURCE_LENGTH - 1);
+    queue->next_item.store(0);
+
+    std::vector<WorkItem> items;
+    items.reserve(item_count);
+    char* base = reinterpret_cast<char*>(queue);
+    uint64_t path_offset = work_queue_header_size() + item_count * sizeof(WorkItem);
+    for (const WorkInput& input : inputs) {
+        memcpy(base + path_offset, input.path.c_str(), input.path.size() + 1);
+        uint32_t parts = input.compressed ? 1 : (uint32_t)((input.size + chunk_size - 1) / chunk_size);
+        for (uint32_t part = 0; part < parts; ++part) {
+            uint64_t begin = input.size * part / parts, end = input.size * (part + 1) / parts;
+            items.push_back({end - begin, path_offset, part, parts});
+        }
+        path_offset += input.path.size() + 1;
+        queue->total_bytes += input.size;
+    }
+    // Longest processing time first; slices of one file stay together among equal sizes
+    std::stable_sort(items.begin(), items.end(), [](const WorkItem& a, const WorkItem& b) { return a.bytes > b.bytes; });
+    std::copy(items.begin(), items.end(), queue->items());
+
+    queue->state.store(WORK_QUEUE_READY);
+    futex_wake_all(&queue->state);
+}
+
+// Maps a work queue built by another producer, sleeping on its state word until it is ready.
+// Returns MAP_FAILED on error, if the builder failed, or if `running` is cleared while waiting.
+inline WorkQueue* map_work_queue(int fd, const std::atomic_bool& running, size_t& mapped_size, std::string& error) {
+    struct stat st;
+    for (;;) {
+        if (fstat(fd, &st) == -1) {
+            error = std::string("fstat: ") + strerror(errno);
+            return (WorkQueue*) MAP_FAILED;
+        }
+        if ((uint64_t)st.st_size >= work_queue_header_size())
+            break;
+        if (!running.load())
+            return (WorkQueue*) MAP_FAILED;
+        usleep(1000);
+    }
+
+    WorkQueue* header = (WorkQueue*) mmap(0, work_queue_header_size(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (header == MAP_FAILED) {
+        error = std::string("mmap: ") + strerror(errno);
+        return header;
+    }
+    while (running.load() && header->state.load() == WORK_QUEUE_BUILDING)
+        futex_wait(&header->state, WORK_QUEUE_BUILDING);
+    uint32_t state = header->state.load();
+    uint64_t total_size = header->total_size;
+    munmap(header, work_queue_header_size());
+    if (state == WORK_QUEUE_FAILED)
+        error = "the producer building it could not read its inputs";
+    if (state != WORK_QUEUE_READY)
+        return (WorkQueue*) MAP_FAILED;
+
+    WorkQueue* queue = (WorkQueue*) mmap(0, total_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (queue == MAP_FAILED) {
+        error = std::string("mmap: ") + strerror(errno);
+        return queue;
+    }
+    mapped_size = total_size;
+    return queue;
+}
+
+#endif